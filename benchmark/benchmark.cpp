@@ -0,0 +1,600 @@
+#include "benchmark/benchmark.h"
+#include "trees.h"
+#include "treap.h"
+#include "rb_tree.h"
+#include "avl.h"
+#include "splay_tree.h"
+#include "wb_tree.h"
+#include "scapegoat_tree.h"
+#include "btree.h"
+#include "persistent_avl.h"
+#include "concurrent_tree.h"
+#include "concurrent_skiplist.h"
+#include "sharded_tree.h"
+#include "serialization.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class distribution { uniform, sequential, zipfian, adversarial };
+
+const char* distribution_name(distribution d) {
+    switch (d) {
+        case distribution::uniform: return "uniform";
+        case distribution::sequential: return "sequential";
+        case distribution::zipfian: return "zipfian";
+        case distribution::adversarial: return "adversarial";
+    }
+    return "";
+}
+
+// Zipfian ranks with skew 0.99 (YCSB generator), scattered over the key space so that
+// hot keys are not neighbours.
+std::vector<int> zipfian_keys(size_t n, std::mt19937& gen) {
+    const double theta = 0.99;
+    double zeta_n = 0;
+    for (size_t i = 1; i <= n; ++i) zeta_n += 1.0 / std::pow(double(i), theta);
+    double zeta_2 = 1.0 + 1.0 / std::pow(2.0, theta);
+    double alpha = 1.0 / (1.0 - theta);
+    double eta = (1.0 - std::pow(2.0 / double(n), 1.0 - theta)) / (1.0 - zeta_2 / zeta_n);
+
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    std::vector<int> keys(n);
+    for (size_t i = 0; i < n; ++i) {
+        double u = uniform(gen);
+        double uz = u * zeta_n;
+        size_t rank;
+        if (uz < 1.0) rank = 0;
+        else if (uz < zeta_2) rank = 1;
+        else rank = size_t(double(n) * std::pow(eta * u - eta + 1.0, alpha));
+        keys[i] = int((uint64_t(rank) * 2654435761u) % INT_MAX);
+    }
+    return keys;
+}
+
+std::vector<int> make_keys(distribution d, size_t n, unsigned seed = 0) {
+    std::mt19937 gen(seed);
+    std::vector<int> keys(n);
+    switch (d) {
+        case distribution::uniform: {
+            std::uniform_int_distribution<int> uniform(0, INT_MAX);
+            for (auto& key : keys) key = uniform(gen);
+            break;
+        }
+        case distribution::sequential:
+            for (size_t i = 0; i < n; ++i) keys[i] = int(i);
+            break;
+        case distribution::zipfian:
+            keys = zipfian_keys(n, gen);
+            break;
+        case distribution::adversarial:
+            // Alternates between the two ends of the key range: every access lands on
+            // the opposite extreme of the previous one.
+            for (size_t i = 0; i < n; ++i) keys[i] = i % 2 ? int(n - i / 2) : int(i / 2);
+            break;
+    }
+    return keys;
+}
+
+template <typename Tree>
+void fill(Tree& tree, const std::vector<int>& keys) {
+    for (size_t i = 0; i < keys.size(); ++i) tree.insert(keys[i], int(i));
+}
+
+template <typename Tree>
+void fill_implicit(Tree& tree, size_t n) {
+    for (size_t i = 0; i < n; ++i) tree.insert_kth(i, int(i));
+}
+
+template <typename Tree>
+void bm_insert(benchmark::State& state, distribution d) {
+    auto keys = make_keys(d, state.range(0));
+    for (auto _ : state) {
+        Tree tree;
+        fill(tree, keys);
+        benchmark::DoNotOptimize(tree.root);
+        state.PauseTiming();
+        tree.clear();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+// Appends through the end() hint; compare with insert/<tree>/sequential.
+template <typename Tree>
+void bm_insert_hint(benchmark::State& state) {
+    auto keys = make_keys(distribution::sequential, state.range(0));
+    for (auto _ : state) {
+        Tree tree;
+        for (size_t i = 0; i < keys.size(); ++i) tree.insert(tree.end(), keys[i], int(i));
+        benchmark::DoNotOptimize(tree.root);
+        state.PauseTiming();
+        tree.clear();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template <typename Tree>
+void bm_erase(benchmark::State& state, distribution d) {
+    auto keys = make_keys(d, state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        Tree tree;
+        fill(tree, keys);
+        state.ResumeTiming();
+        for (int key : keys) tree.erase(key);
+        benchmark::DoNotOptimize(tree.root);
+        state.PauseTiming();
+        tree.clear();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+template <typename Tree>
+void bm_find(benchmark::State& state, distribution d) {
+    auto keys = make_keys(d, state.range(0));
+    auto queries = make_keys(d == distribution::zipfian ? d : distribution::uniform, keys.size(), 1);
+    for (size_t i = 0; i < queries.size(); i += 2) queries[i] = keys[queries[i] % keys.size()];
+    Tree tree;
+    fill(tree, keys);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.find(queries[i]));
+        if (++i == queries.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+    tree.clear();
+}
+
+template <typename Tree>
+void bm_frozen_find(benchmark::State& state, distribution d) {
+    auto keys = make_keys(d, state.range(0));
+    auto queries = make_keys(d == distribution::zipfian ? d : distribution::uniform, keys.size(), 1);
+    for (size_t i = 0; i < queries.size(); i += 2) queries[i] = keys[queries[i] % keys.size()];
+    Tree tree;
+    fill(tree, keys);
+    auto frozen = tree.freeze();
+    tree.clear();
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(frozen.find(queries[i]));
+        if (++i == queries.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+// Cold start from an in-memory dump: load() against inserting the keys one by one.
+template <typename Tree>
+void bm_load(benchmark::State& state) {
+    auto keys = make_keys(distribution::uniform, state.range(0));
+    Tree tree;
+    fill(tree, keys);
+    std::stringstream dump;
+    save(tree, dump);
+    tree.clear();
+    for (auto _ : state) {
+        dump.clear();
+        dump.seekg(0);
+        load(tree, dump);
+        benchmark::DoNotOptimize(tree.root);
+        state.PauseTiming();
+        tree.clear();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+// Cold start of a frozen snapshot from a file: map() followed by one lookup.
+void bm_frozen_map(benchmark::State& state) {
+    auto keys = make_keys(distribution::uniform, state.range(0));
+    AVL<avl_node<int, int>> tree;
+    fill(tree, keys);
+    std::string path = "frozen_map_benchmark.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        tree.freeze().save(out);
+    }
+    tree.clear();
+    frozen_tree<avl_node<int, int>> frozen;
+    for (auto _ : state) {
+        frozen.map(path.c_str());
+        benchmark::DoNotOptimize(frozen.find(keys[0]));
+    }
+    frozen = {};
+    std::remove(path.c_str());
+}
+
+template <typename Tree>
+void bm_get_kth(benchmark::State& state, distribution d) {
+    auto keys = make_keys(d, state.range(0));
+    Tree tree;
+    fill(tree, keys);
+    auto queries = make_keys(distribution::uniform, keys.size(), 1);
+    size_t size = tree.size(), i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.get_kth(queries[i] % size));
+        if (++i == queries.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+    tree.clear();
+}
+
+template <typename Tree>
+void bm_order_of_key(benchmark::State& state, distribution d) {
+    auto keys = make_keys(d, state.range(0));
+    Tree tree;
+    fill(tree, keys);
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree.order_of_key(keys[i]));
+        if (++i == keys.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+    tree.clear();
+}
+
+template <typename Tree>
+void bm_scan(benchmark::State& state, distribution d) {
+    auto keys = make_keys(d, state.range(0));
+    Tree tree;
+    fill(tree, keys);
+    for (auto _ : state) {
+        long long sum = 0;
+        for (auto& node : tree) sum += node.value;
+        benchmark::DoNotOptimize(sum);
+    }
+    state.SetItemsProcessed(state.iterations() * tree.size());
+    tree.clear();
+}
+
+template <typename Tree>
+void bm_split_merge(benchmark::State& state, distribution d) {
+    auto keys = make_keys(d, state.range(0));
+    Tree tree;
+    fill(tree, keys);
+    auto queries = make_keys(distribution::uniform, keys.size(), 1);
+    size_t i = 0;
+    for (auto _ : state) {
+        auto [left, right] = Tree::split(tree.root, keys[queries[i] % keys.size()]);
+        tree.root = Tree::merge(left, right);
+        if (++i == queries.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+    tree.clear();
+}
+
+template <typename Tree>
+void bm_cut_subsegment(benchmark::State& state) {
+    size_t n = state.range(0);
+    Tree tree;
+    fill_implicit(tree, n);
+    auto queries = make_keys(distribution::uniform, n, 1);
+    size_t i = 0;
+    for (auto _ : state) {
+        size_t l = queries[i] % n, r = queries[i + 1] % n;
+        if (l > r) std::swap(l, r);
+        auto node = tree.cut_subsegment(l, r);
+        tree.insert_subsegment(l, node);
+        i += 2;
+        if (i + 1 >= queries.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+    tree.clear();
+}
+
+template <typename Key, typename Node>
+using treap_mt19937_node_template = treap_node_template<Key, Node, size_t, mt19937_priority>;
+
+using std_map = std::map<int, int>;
+
+// Read throughput of lookups shared by all benchmark threads: lock-free readers of a
+// concurrent_tree against a mutex-guarded AVL.
+template <typename Tree>
+void bm_concurrent_find(benchmark::State& state) {
+    static concurrent_tree<Tree>* tree;
+    static std::vector<int> keys;
+    if (state.thread_index() == 0) {
+        keys = make_keys(distribution::uniform, state.range(0));
+        Tree version;
+        for (int key : keys) version.insert(key, key);
+        tree = new concurrent_tree<Tree>(version);
+    }
+    size_t i = state.thread_index() * 7919;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tree->exists(keys[i % keys.size()]));
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) delete tree;
+}
+
+void bm_mutex_find(benchmark::State& state) {
+    static AVL<avl_node<int, int>>* tree;
+    static std::mutex mutex;
+    static std::vector<int> keys;
+    if (state.thread_index() == 0) {
+        keys = make_keys(distribution::uniform, state.range(0));
+        tree = new AVL<avl_node<int, int>>();
+        fill(*tree, keys);
+    }
+    size_t i = state.thread_index() * 7919;
+    for (auto _ : state) {
+        std::lock_guard lock(mutex);
+        benchmark::DoNotOptimize(tree->find(keys[i % keys.size()]));
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) {
+        tree->clear();
+        delete tree;
+    }
+}
+
+// Write-heavy mix shared by all benchmark threads: 25% insert, 25% erase, 50% find over a
+// key range of 2n, starting from n keys.
+void bm_concurrent_mixed(benchmark::State& state) {
+    static concurrent_skiplist<int, int>* list;
+    if (state.thread_index() == 0) {
+        list = new concurrent_skiplist<int, int>();
+        for (int key = 0; key < state.range(0); ++key) list->insert(2 * key, key);
+    }
+    std::mt19937 gen(state.thread_index());
+    std::uniform_int_distribution<int> keys(0, 2 * int(state.range(0)) - 1);
+    for (auto _ : state) {
+        int key = keys(gen);
+        switch (gen() % 4) {
+            case 0: benchmark::DoNotOptimize(list->insert(key, key)); break;
+            case 1: benchmark::DoNotOptimize(list->erase(key)); break;
+            default: benchmark::DoNotOptimize(list->find(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) delete list;
+}
+
+void bm_mutex_mixed(benchmark::State& state) {
+    static std::map<int, int>* map;
+    static std::mutex mutex;
+    if (state.thread_index() == 0) {
+        map = new std::map<int, int>();
+        for (int key = 0; key < state.range(0); ++key) map->emplace(2 * key, key);
+    }
+    std::mt19937 gen(state.thread_index());
+    std::uniform_int_distribution<int> keys(0, 2 * int(state.range(0)) - 1);
+    for (auto _ : state) {
+        int key = keys(gen);
+        int type = int(gen() % 4);
+        std::lock_guard lock(mutex);
+        switch (type) {
+            case 0: benchmark::DoNotOptimize(map->emplace(key, key)); break;
+            case 1: benchmark::DoNotOptimize(map->erase(key)); break;
+            default: benchmark::DoNotOptimize(map->find(key));
+        }
+    }
+    state.SetItemsProcessed(state.iterations());
+    if (state.thread_index() == 0) delete map;
+}
+
+// Concurrent ingest of n uniform keys split between the benchmark threads, one pass per run:
+// a sharded AVL against a single AVL behind a mutex (Shards = 1).
+template <size_t Shards>
+void bm_sharded_insert(benchmark::State& state) {
+    using tree_t = AVL<avl_node<int, int>>;
+    static std::vector<int> keys;
+    static sharded_tree<tree_t, Shards>* tree;
+    if (state.thread_index() == 0) {
+        keys = make_keys(distribution::uniform, state.range(0));
+        tree = new sharded_tree<tree_t, Shards>();
+    }
+    size_t begin = keys.size() * state.thread_index() / state.threads();
+    size_t end = keys.size() * (state.thread_index() + 1) / state.threads();
+    for (auto _ : state) {
+        for (size_t i = begin; i < end; ++i) tree->insert(keys[i], 0);
+    }
+    state.SetItemsProcessed(end - begin);
+    if (state.thread_index() == 0) delete tree;
+}
+
+void bm_std_insert(benchmark::State& state, distribution d) {
+    auto keys = make_keys(d, state.range(0));
+    for (auto _ : state) {
+        std_map map;
+        for (size_t i = 0; i < keys.size(); ++i) map.emplace(keys[i], int(i));
+        benchmark::DoNotOptimize(map.size());
+        state.PauseTiming();
+        map.clear();
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+void bm_std_erase(benchmark::State& state, distribution d) {
+    auto keys = make_keys(d, state.range(0));
+    for (auto _ : state) {
+        state.PauseTiming();
+        std_map map;
+        for (size_t i = 0; i < keys.size(); ++i) map.emplace(keys[i], int(i));
+        state.ResumeTiming();
+        for (int key : keys) map.erase(key);
+        benchmark::DoNotOptimize(map.size());
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+void bm_std_find(benchmark::State& state, distribution d) {
+    auto keys = make_keys(d, state.range(0));
+    auto queries = make_keys(d == distribution::zipfian ? d : distribution::uniform, keys.size(), 1);
+    for (size_t i = 0; i < queries.size(); i += 2) queries[i] = keys[queries[i] % keys.size()];
+    std_map map;
+    for (size_t i = 0; i < keys.size(); ++i) map.emplace(keys[i], int(i));
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(map.find(queries[i]));
+        if (++i == queries.size()) i = 0;
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+const distribution distributions[] = {distribution::uniform, distribution::sequential,
+                                      distribution::zipfian, distribution::adversarial};
+
+template <typename Tree>
+void register_search_tree(const std::string& name, const std::vector<int64_t>& sizes) {
+    for (distribution d : distributions) {
+        std::string suffix = std::string("/") + distribution_name(d);
+        auto add = [&](const std::string& op, auto fn) {
+            auto* b = benchmark::RegisterBenchmark((op + "/" + name + suffix).c_str(), fn, d);
+            for (int64_t n : sizes) b->Arg(n);
+            b->Unit(benchmark::kNanosecond);
+        };
+        add("insert", bm_insert<Tree>);
+        add("erase", bm_erase<Tree>);
+        add("find", bm_find<Tree>);
+        add("get_kth", bm_get_kth<Tree>);
+        add("order_of_key", bm_order_of_key<Tree>);
+        add("scan", bm_scan<Tree>);
+        add("split_merge", bm_split_merge<Tree>);
+    }
+}
+
+template <typename Tree>
+void register_implicit_tree(const std::string& name, const std::vector<int64_t>& sizes) {
+    auto* b = benchmark::RegisterBenchmark(("cut_subsegment/" + name).c_str(), bm_cut_subsegment<Tree>);
+    for (int64_t n : sizes) b->Arg(n);
+}
+
+void register_baseline(const std::vector<int64_t>& sizes) {
+    using benchmark_fn = void (*)(benchmark::State&, distribution);
+    const std::pair<std::string, benchmark_fn> baselines[] = {
+            {"insert", bm_std_insert}, {"erase", bm_std_erase}, {"find", bm_std_find}};
+    for (distribution d : distributions) {
+        for (auto& [op, fn] : baselines) {
+            auto* b = benchmark::RegisterBenchmark((op + "/std::map/" + distribution_name(d)).c_str(), fn, d);
+            for (int64_t n : sizes) b->Arg(n);
+        }
+    }
+}
+
+// Sizes run from 1e3 up to --max_size (default 1e6; the full 1e8 sweep needs tens of GB of RAM).
+int main(int argc, char** argv) {
+    int64_t max_size = 1000000;
+    std::vector<char*> args;
+    for (int i = 0; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--max_size=", 11) == 0) {
+            max_size = std::stoll(argv[i] + 11);
+        } else {
+            args.push_back(argv[i]);
+        }
+    }
+    int args_count = int(args.size());
+
+    std::vector<int64_t> sizes;
+    for (int64_t n = 1000; n <= max_size && n <= 100000000; n *= 10) sizes.push_back(n);
+
+    register_search_tree<treap<treap_node<int, int>>>("treap", sizes);
+    register_search_tree<AVL<avl_node<int, int>>>("AVL", sizes);
+    register_search_tree<rb_tree<rb_node<int, int>>>("rb_tree", sizes);
+    register_search_tree<splay_tree<splay_node<int, int>>>("splay_tree", sizes);
+    register_search_tree<btree<btree_node<int, int>>>("btree", sizes);
+    register_search_tree<wb_tree<wb_node<int, int>>>("wb_tree", sizes);
+    register_search_tree<scapegoat_tree<scapegoat_node<int, int>>>("scapegoat_tree", sizes);
+    for (distribution d : distributions) {
+        auto* b = benchmark::RegisterBenchmark((std::string("find/frozen/") + distribution_name(d)).c_str(),
+                                               bm_frozen_find<AVL<avl_node<int, int>>>, d);
+        for (int64_t n : sizes) b->Arg(n);
+    }
+    using append_fn = void (*)(benchmark::State&);
+    const std::pair<std::string, append_fn> appends[] = {
+            {"treap", bm_insert_hint<treap<treap_node<int, int>>>},
+            {"AVL", bm_insert_hint<AVL<avl_node<int, int>>>},
+            {"rb_tree", bm_insert_hint<rb_tree<rb_node<int, int>>>}};
+    for (auto& [name, fn] : appends) {
+        auto* b = benchmark::RegisterBenchmark(("insert_hint/" + name + "/sequential").c_str(), fn);
+        for (int64_t n : sizes) b->Arg(n);
+    }
+    // Priority sources; random_priority is insert/treap.
+    using insert_fn = void (*)(benchmark::State&, distribution);
+    const std::pair<std::string, insert_fn> priority_sources[] = {
+            {"treap_mt19937", bm_insert<treap<common_node<treap_mt19937_node_template, int, int>>>},
+            {"treap_hashed", bm_insert<treap<treap_hashed_node<int, int>>>}};
+    for (auto& [name, fn] : priority_sources) {
+        for (distribution d : {distribution::uniform, distribution::sequential}) {
+            auto* b = benchmark::RegisterBenchmark(("insert/" + name + "/" + distribution_name(d)).c_str(), fn, d);
+            for (int64_t n : sizes) b->Arg(n);
+        }
+    }
+    // Read-only splaying strategies; full splaying is find/splay_tree.
+    using splay_node_t = splay_node<int, int>;
+    using find_fn = void (*)(benchmark::State&, distribution);
+    const std::pair<std::string, find_fn> splay_reads[] = {
+            {"splay_tree_semi", bm_find<splay_tree<splay_node_t, default_node_allocator<splay_node_t>, semi_splaying>>},
+            {"splay_tree_periodic_16",
+             bm_find<splay_tree<splay_node_t, default_node_allocator<splay_node_t>, periodic_splaying<16>>>}};
+    for (auto& [name, fn] : splay_reads) {
+        for (distribution d : {distribution::zipfian, distribution::uniform}) {
+            auto* b = benchmark::RegisterBenchmark(("find/" + name + "/" + distribution_name(d)).c_str(), fn, d);
+            for (int64_t n : sizes) b->Arg(n);
+        }
+    }
+    using load_fn = void (*)(benchmark::State&);
+    const std::pair<std::string, load_fn> loads[] = {
+            {"treap", bm_load<treap<treap_node<int, int>>>}, {"AVL", bm_load<AVL<avl_node<int, int>>>},
+            {"rb_tree", bm_load<rb_tree<rb_node<int, int>>>}, {"splay_tree", bm_load<splay_tree<splay_node<int, int>>>},
+            {"btree", bm_load<btree<btree_node<int, int>>>}, {"frozen_map", bm_frozen_map}};
+    for (auto& [name, fn] : loads) {
+        auto* b = benchmark::RegisterBenchmark(("load/" + name).c_str(), fn);
+        for (int64_t n : sizes) b->Arg(n);
+        b->Unit(benchmark::kMicrosecond);
+    }
+    register_search_tree<treap<treap_compact_node<int, int>>>("treap_compact", sizes);
+    register_search_tree<AVL<avl_compact_node<int, int>>>("AVL_compact", sizes);
+    register_search_tree<rb_tree<rb_compact_node<int, int>>>("rb_tree_compact", sizes);
+    register_search_tree<splay_tree<splay_compact_node<int, int>>>("splay_tree_compact", sizes);
+    register_baseline(sizes);
+
+    int max_threads = int(std::max(1u, std::thread::hardware_concurrency()));
+    auto* concurrent = benchmark::RegisterBenchmark("concurrent_find/persistent_avl",
+                                                    bm_concurrent_find<persistent_avl<persistent_avl_node<int, int>>>);
+    auto* locked = benchmark::RegisterBenchmark("concurrent_find/mutex_AVL", bm_mutex_find);
+    for (auto* b : {concurrent, locked}) {
+        b->Arg(1000000)->ThreadRange(1, max_threads)->UseRealTime();
+    }
+
+    auto* skiplist = benchmark::RegisterBenchmark("concurrent_mixed/concurrent_skiplist", bm_concurrent_mixed);
+    auto* mutex_map = benchmark::RegisterBenchmark("concurrent_mixed/mutex_std::map", bm_mutex_mixed);
+    for (auto* b : {skiplist, mutex_map}) {
+        b->Arg(1000000)->ThreadRange(1, 64)->UseRealTime();
+    }
+
+    auto* sharded = benchmark::RegisterBenchmark("sharded_insert/sharded_AVL_16", bm_sharded_insert<16>);
+    auto* single = benchmark::RegisterBenchmark("sharded_insert/mutex_AVL", bm_sharded_insert<1>);
+    for (auto* b : {sharded, single}) {
+        b->Arg(1000000)->ThreadRange(1, max_threads)->Iterations(1)->UseRealTime()->Unit(benchmark::kMillisecond);
+    }
+
+    register_implicit_tree<treap<treap_implicit_node<int>>>("treap", sizes);
+    register_implicit_tree<AVL<avl_implicit_node<int>>>("AVL", sizes);
+    register_implicit_tree<rb_tree<rb_implicit_node<int>>>("rb_tree", sizes);
+    register_implicit_tree<splay_tree<splay_implicit_node<int>>>("splay_tree", sizes);
+    register_implicit_tree<btree<btree_implicit_node<int>>>("btree", sizes);
+    register_implicit_tree<wb_tree<wb_implicit_node<int>>>("wb_tree", sizes);
+    register_implicit_tree<scapegoat_tree<scapegoat_implicit_node<int>>>("scapegoat_tree", sizes);
+
+    benchmark::Initialize(&args_count, args.data());
+    if (benchmark::ReportUnrecognizedArguments(args_count, args.data())) return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
@@ -3,15 +3,25 @@
 #include <tuple>
 #include "trees.h"
 
-template <typename Node>
-class AVL: public binary_tree<Node> {
+template <typename Node, typename Allocator = default_node_allocator<Node>>
+class AVL: public binary_tree<Node, Allocator>, public join_operations<AVL<Node, Allocator>> {
 public:
-    using key_t = typename binary_tree<Node>::key_t;
+    using binary_tree<Node, Allocator>::binary_tree;
+    using key_t = typename binary_tree<Node, Allocator>::key_t;
+    using iterator = typename binary_tree<Node, Allocator>::iterator;
 
     template <typename... Args>
     void insert(const key_t& key, Args&&... args);
     void insert(Node* node);
 
+    // Inserts next to `hint` (end() stands for the last node). With end() as the hint, a key
+    // greater than the largest one is joined along the right spine; otherwise the search starts from
+    // the lowest node on the hint's root path whose subtree spans the key, so an insert d
+    // positions away from the hint compares O(log d) keys. The path is still rebalanced up to the root.
+    template <typename... Args>
+    void insert(iterator hint, const key_t& key, Args&&... args);
+    void insert(iterator hint, Node* node);
+
     void erase(const key_t& key);
 
     template <typename... Args>
@@ -30,16 +40,21 @@ public:
     void push_back(Args&&... args);
 
 private:
+    friend struct join_algorithms<AVL>;
+
     static inline Node* rotate_left(Node* pivot);
     static inline Node* rotate_right(Node* pivot);
     static inline Node* balance(Node* node);
+    static inline void clear_vertex(Node* node);
 
-    static Node* _insert(Node* node, Node* parent);
+    Node* _insert(Node* node, Node* parent);
+    inline void _insert_below(path_stack<Node**>& path, Node** slot, Node* node);
     Node* _erase(Node* parent, const key_t& key);
     static Node* _remove_min(Node* parent);
 
     static Node* _merge(Node* left, Node* mid, Node* right);
     static std::tuple<Node*, Node*, Node*> _split_k(Node* node, size_t k);
+    static std::tuple<Node*, Node*, Node*> _split_key(Node* node, const key_t& key);
 };
 
 template <typename Node>
@@ -48,20 +63,21 @@ unsigned char get_height(Node* node) {
 }
 
 template <typename Node>
-void clear_vertex(Node* node) {
+char get_balance(Node* node) {
+    return get_height(node->right) - get_height(node->left);
+}
+
+template <typename Node, typename Allocator>
+void AVL<Node, Allocator>::clear_vertex(Node* node) {
     if (node == nullptr) return;
     node->left = nullptr;
     node->right = nullptr;
     node->update();
 }
 
-template <typename Node>
-char get_balance(Node* node) {
-    return get_height(node->right) - get_height(node->left);
-}
-
-template <typename Node>
-Node* AVL<Node>::rotate_right(Node* pivot) {
+template <typename Node, typename Allocator>
+Node* AVL<Node, Allocator>::rotate_right(Node* pivot) {
+    SEARCH_TREES_RECORD(rotation);
     if (pivot) pivot->push();
     Node* q = pivot->left;
     if (q) q->push();
@@ -75,8 +91,9 @@ Node* AVL<Node>::rotate_right(Node* pivot) {
     return q;
 }
 
-template <typename Node>
-Node* AVL<Node>::rotate_left(Node* pivot) {
+template <typename Node, typename Allocator>
+Node* AVL<Node, Allocator>::rotate_left(Node* pivot) {
+    SEARCH_TREES_RECORD(rotation);
     if (pivot) pivot->push();
     Node* q = pivot->right;
     if (q) q->push();
@@ -90,8 +107,8 @@ Node* AVL<Node>::rotate_left(Node* pivot) {
     return q;
 }
 
-template <typename Node>
-Node* AVL<Node>::balance(Node* node) {
+template <typename Node, typename Allocator>
+Node* AVL<Node, Allocator>::balance(Node* node) {
     node->update();
     node->push();
     if (get_balance(node) == 2) {
@@ -109,70 +126,134 @@ Node* AVL<Node>::balance(Node* node) {
     return node;
 }
 
-template <typename Node>
-Node* AVL<Node>::_insert(Node* node, Node* parent) {
-    if (!parent) return node;
-    parent->push();
-    if (node->key == parent->key) {
-        delete node;
-        return parent;
+// Insert and erase descend iteratively, keeping the slots (child pointers) that lead to the
+// changed node, and rebalance the path bottom-up through them.
+template <typename Node, typename Allocator>
+Node* AVL<Node, Allocator>::_insert(Node* node, Node* parent) {
+    path_stack<Node**> path;
+    _insert_below(path, &parent, node);
+    return parent;
+}
+
+// Descends from `slot`, whose ancestors' slots are in `path`.
+template <typename Node, typename Allocator>
+void AVL<Node, Allocator>::_insert_below(path_stack<Node**>& path, Node** slot, Node* node) {
+    while (*slot != nullptr) {
+        Node* current = *slot;
+        current->push();
+        if (node->key == current->key) {
+            this->allocator.destroy(node);
+            return;
+        }
+        path.push(slot);
+        slot = node->key < current->key ? &current->left : &current->right;
     }
-    if (node->key < parent->key) {
-        parent->left = _insert(node, parent->left);
-    } else {
-        parent->right = _insert(node, parent->right);
+    *slot = node;
+    while (!path.empty()) {
+        slot = path.pop();
+        *slot = balance(*slot);
     }
-    return balance(parent);
 }
 
-template <typename Node>
+template <typename Node, typename Allocator>
 template <typename... Args>
-void AVL<Node>::insert(const key_t& key, Args&&... args) {
-    insert(new Node(key, std::forward<Args>(args)...));
+void AVL<Node, Allocator>::insert(const key_t& key, Args&&... args) {
+    insert(this->allocator.create(key, std::forward<Args>(args)...));
 }
 
-template <typename Node>
-void AVL<Node>::insert(Node* node) {
+template <typename Node, typename Allocator>
+void AVL<Node, Allocator>::insert(Node* node) {
     if (!node) return;
     this->root = _insert(node, this->root);
 }
 
-template <typename Node>
-Node* AVL<Node>::_remove_min(Node *parent) {
-    if (!parent) return nullptr;
-    if (!parent->left) return parent->right;
-    parent->left = _remove_min(parent->left);
-    return balance(parent);
+template <typename Node, typename Allocator>
+template <typename... Args>
+void AVL<Node, Allocator>::insert(iterator hint, const key_t& key, Args&&... args) {
+    insert(hint, this->allocator.create(key, std::forward<Args>(args)...));
 }
 
-template <typename Node>
-Node* AVL<Node>::_erase(Node* parent, const key_t& key) {
+// The nodes on the hint's path have been pushed by the iterator; their slots are found by
+// following the path, without comparisons.
+template <typename Node, typename Allocator>
+void AVL<Node, Allocator>::insert(iterator hint, Node* node) {
+    if (hint == this->end()) {
+        Node* last = this->max_in_subtree(this->root);
+        if (last == nullptr || last->key < node->key) {
+            this->root = _merge(this->root, node, nullptr);
+            return;
+        }
+    }
+    std::vector<Node*> nodes = this->finger_path(hint, node->key);
+    path_stack<Node**> path;
+    Node** slot = &this->root;
+    for (size_t i = 0; i + 1 < nodes.size(); ++i) {
+        path.push(slot);
+        slot = nodes[i + 1] == nodes[i]->left ? &nodes[i]->left : &nodes[i]->right;
+    }
+    _insert_below(path, slot, node);
+}
+
+template <typename Node, typename Allocator>
+Node* AVL<Node, Allocator>::_remove_min(Node *parent) {
     if (!parent) return nullptr;
-    parent->push();
-    if (key < parent->key) {
-        parent->left = _erase(parent->left, key);
-    } else if (key > parent->key) {
-        parent->right = _erase(parent->right, key);
-    } else {
-        Node* left = parent->left;
-        Node* right = parent->right;
-        delete parent;
-        if (!right) return left;
-        Node* min = binary_tree<Node>::min_in_subtree(right);
-        min->right = _remove_min(right);
-        min->left = left;
-        return balance(min);
+    path_stack<Node**> path;
+    Node** slot = &parent;
+    while ((*slot)->left) {
+        path.push(slot);
+        slot = &(*slot)->left;
     }
-    return balance(parent);
+    *slot = (*slot)->right;
+    while (!path.empty()) {
+        slot = path.pop();
+        *slot = balance(*slot);
+    }
+    return parent;
 }
 
-template <typename Node>
-void AVL<Node>::erase(const key_t& key) {
+template <typename Node, typename Allocator>
+Node* AVL<Node, Allocator>::_erase(Node* parent, const key_t& key) {
+    path_stack<Node**> path;
+    Node** slot = &parent;
+    while (*slot != nullptr) {
+        Node* current = *slot;
+        current->push();
+        if (key < current->key) {
+            path.push(slot);
+            slot = &current->left;
+        } else if (key > current->key) {
+            path.push(slot);
+            slot = &current->right;
+        } else {
+            Node* left = current->left;
+            Node* right = current->right;
+            this->allocator.destroy(current);
+            if (!right) {
+                *slot = left;
+            } else {
+                Node* min = binary_tree<Node, Allocator>::min_in_subtree(right);
+                min->right = _remove_min(right);
+                min->left = left;
+                *slot = balance(min);
+            }
+            break;
+        }
+    }
+    while (!path.empty()) {
+        slot = path.pop();
+        *slot = balance(*slot);
+    }
+    return parent;
+}
+
+template <typename Node, typename Allocator>
+void AVL<Node, Allocator>::erase(const key_t& key) {
     this->root = _erase(this->root, key);
 }
 
-template <typename Node>
-Node* AVL<Node>::_merge(Node *left, Node *mid, Node *right) {
+template <typename Node, typename Allocator>
+Node* AVL<Node, Allocator>::_merge(Node *left, Node *mid, Node *right) {
+    SEARCH_TREES_RECORD(join_step);
     if (mid) mid->push();
     if (left) left->push();
     if (right) right->push();
@@ -202,8 +283,8 @@ Node* AVL<Node>::_merge(Node *left, Node *mid, Node *right) {
     return balance(higher);
 }
 
-template <typename Node>
-Node* AVL<Node>::merge(Node* left, Node* right) {
+template <typename Node, typename Allocator>
+Node* AVL<Node, Allocator>::merge(Node* left, Node* right) {
     if (!left) return right;
     if (!right) return left;
 
@@ -211,105 +292,95 @@ Node* AVL<Node>::merge(Node* left, Node* right) {
     return _merge(left_part, mid, right);
 }
 
-template <typename Node>
-std::tuple<Node*, Node*, Node*> AVL<Node>::_split_k(Node* node, size_t k) {
-    if (!node) return std::make_tuple(nullptr, nullptr, nullptr);
-    node->push();
-
-    if (get_size(node->left) + 1 == k) {
-        auto res = std::make_tuple(node->left, node, node->right);
-        clear_vertex(node);
-        return res;
-    }
-    if (get_size(node->left) >= k) {
-        auto [left, mid, right] = _split_k(node->left, k);
-        clear_vertex(mid);
-
-        return std::make_tuple(left, mid, _merge(right, node, node->right));
-    } else {
-        auto [left, mid, right] = _split_k(node->right, k - get_size(node->left) - 1);
-        clear_vertex(mid);
+template <typename Node, typename Allocator>
+std::tuple<Node*, Node*, Node*> AVL<Node, Allocator>::_split_k(Node* node, size_t k) {
+    return join_algorithms<AVL>::split_k(node, k);
+}
 
-        return std::make_tuple(_merge(node->left, node, left), mid, right);
-    }
+template <typename Node, typename Allocator>
+std::tuple<Node*, Node*, Node*> AVL<Node, Allocator>::_split_key(Node* node, const key_t& key) {
+    return join_algorithms<AVL>::split_key(node, key);
 }
 
-template <typename Node>
-std::pair<Node*, Node*> AVL<Node>::split_k(Node* node, size_t k) {
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> AVL<Node, Allocator>::split_k(Node* node, size_t k) {
     auto [left, mid, right] = _split_k(node, k);
     left = _merge(left, mid, nullptr);
     return {left, right};
 }
 
-template <typename Node>
-std::pair<Node*, Node*> AVL<Node>::split(Node* node, const key_t& key) {
-    size_t k = binary_tree<Node>::order_of_key(node, key);
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> AVL<Node, Allocator>::split(Node* node, const key_t& key) {
+    size_t k = binary_tree<Node, Allocator>::order_of_key(node, key);
     return split_k(node, k);
 }
 
-template <typename Node>
-void AVL<Node>::insert_kth(size_t k, Node *node) {
+template <typename Node, typename Allocator>
+void AVL<Node, Allocator>::insert_kth(size_t k, Node *node) {
     auto [left, right] = split_k(this->root, k);
     this->root = _merge(left, node, right);
 }
 
-template <typename Node>
+template <typename Node, typename Allocator>
 template <typename... Args>
-void AVL<Node>::insert_kth(size_t k, Args&&... args) {
-    insert_kth(k, new Node(std::forward<Args>(args)...));
+void AVL<Node, Allocator>::insert_kth(size_t k, Args&&... args) {
+    insert_kth(k, this->allocator.create(std::forward<Args>(args)...));
 }
 
-template <typename Node>
-Node* AVL<Node>::cut_subsegment(size_t l, size_t r) {
+template <typename Node, typename Allocator>
+Node* AVL<Node, Allocator>::cut_subsegment(size_t l, size_t r) {
     auto [left, join, right] = _split_k(this->root, l);
     auto [mid, right2] = split_k(right, r - l + 1);
     this->root = _merge(left, join, right2);
     return mid;
 }
 
-template <typename Node>
-void AVL<Node>::insert_subsegment(size_t i, Node* t) {
+template <typename Node, typename Allocator>
+void AVL<Node, Allocator>::insert_subsegment(size_t i, Node* t) {
     auto [left, join, right] = _split_k(this->root, i);
     this->root = merge(_merge(left, join, t), right);
 }
 
-template <typename Node>
-void AVL<Node>::erase_kth(size_t k) {
+template <typename Node, typename Allocator>
+void AVL<Node, Allocator>::erase_kth(size_t k) {
     auto [left, mid, right] = _split_k(this->root, k + 1);
-    delete mid;
+    if (mid) this->allocator.destroy(mid);
     this->root = merge(left, right);
 }
 
-template <typename Node>
+template <typename Node, typename Allocator>
 template <typename... Args>
-void AVL<Node>::push_back(Args&&... args) {
-    this->root = _merge(this->root, new Node(std::forward<Args>(args)...), nullptr);
+void AVL<Node, Allocator>::push_back(Args&&... args) {
+    this->root = _merge(this->root, this->allocator.create(std::forward<Args>(args)...), nullptr);
 }
 
-template <typename Key, typename Node>
+template <typename Key, typename Node, typename Size = size_t>
 struct avl_node_template {
     using key_t = Key;
 
-    [[no_unique_address]] key_t key;
-    unsigned char height;
     Node* left;
     Node* right;
-    size_t size;
+    Size size;
+    [[no_unique_address]] key_t key;
+    unsigned char height;
 
-    avl_node_template() : height(1), left(nullptr), right(nullptr) {
+    avl_node_template() : left(nullptr), right(nullptr), height(1) {
         update();
     }
     avl_node_template(const key_t& key)
-        : key(key), height(1), left(nullptr), right(nullptr) {
+        : left(nullptr), right(nullptr), key(key), height(1) {
         update();
     }
 
     void update() {
+        SEARCH_TREES_RECORD(update);
         height = 1 + std::max(get_height(left), get_height(right));
         size = 1 + get_size(left) + get_size(right);
     }
 
-    void push() {}
+    void push() {
+        SEARCH_TREES_RECORD(push);
+    }
 };
 
 template <typename Key, typename Value>
@@ -322,4 +393,16 @@ template <typename Key>
 using avl_key_node = key_node<avl_node_template, Key>;
 
 template <typename Value>
-using avl_implicit_reverse_node = implicit_reverse_node<avl_node_template, Value>;
\ No newline at end of file
+using avl_implicit_reverse_node = implicit_reverse_node<avl_node_template, Value>;
+
+template <typename Policy>
+using avl_implicit_monoid_node = implicit_monoid_node<avl_node_template, Policy>;
+
+template <typename Key, typename Node>
+using avl_compact_node_template = avl_node_template<Key, Node, uint32_t>;
+
+template <typename Key, typename Value>
+using avl_compact_node = common_node<avl_compact_node_template, Key, Value>;
+
+template <typename Value>
+using avl_compact_implicit_node = implicit_node<avl_compact_node_template, Value>;
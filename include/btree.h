@@ -0,0 +1,1187 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "trees.h"
+
+template <typename Key, typename Value = null_type>
+struct btree_node {
+    using key_t = Key;
+
+    key_t key;
+    [[no_unique_address]] Value value;
+
+    btree_node() = default;
+    btree_node(const Key& key) : key(key), value() {}
+    btree_node(const Key& key, const Value& value) : key(key), value(value) {}
+};
+
+template <typename Key>
+using btree_key_node = btree_node<Key, null_type>;
+
+// Element of an implicit btree, which stores a sequence addressed by position (a rope).
+template <typename Value>
+struct btree_implicit_node {
+    using key_t = null_type;
+
+    [[no_unique_address]] null_type key;
+    Value value;
+
+    btree_implicit_node() = default;
+    btree_implicit_node(const Value& value) : value(value) {}
+};
+
+// B+ tree with the interface of the binary trees. Entries live in the leaves, inner blocks keep
+// the smallest key and the size of every child, so routing a search touches one array of keys
+// (compared with SSE2/AVX2 for 32-bit integer keys) and get_kth never reads the children.
+// With btree_implicit_node the tree is a chunked sequence: positions are resolved through the
+// subtree sizes and reverse() is applied lazily, by reversing the item order of a block when it
+// is pushed. Node pointers returned by queries stay valid until the next modification of the tree.
+template <typename Node, size_t InnerCapacity = 32, size_t LeafCapacity = std::max<size_t>(8, 256 / sizeof(Node))>
+class btree {
+    static_assert(InnerCapacity >= 4 && LeafCapacity >= 2);
+
+    struct leaf;
+    struct inner;
+
+public:
+    using key_t = typename Node::key_t;
+    using node_t = Node;
+
+    struct block {
+        unsigned char level;  // 0 for leaves
+        bool reversed;
+        size_t count;
+        size_t size;
+
+        void reverse() {
+            reversed ^= 1;
+        }
+    };
+
+    class iterator;
+
+    btree(block* root = nullptr) : root(root) {}
+
+    Node* find(const key_t& key);
+    bool exists(const key_t& key);
+    Node* get_min();
+    Node* get_kth(size_t k);
+    Node* next(const key_t& key);
+    Node* prev(const key_t& key);
+    size_t order_of_key(const key_t& key);
+    size_t size();
+
+    template <typename... Args>
+    void insert(const key_t& key, Args&&... args);
+    void insert(const Node& node);
+    void erase(const key_t& key);
+
+    template <typename... Args>
+    void insert_kth(size_t k, Args&&... args);
+    void insert_kth(size_t k, const Node& node);
+    void erase_kth(size_t k);
+
+    // Left part gets the keys less than `key`.
+    static std::pair<block*, block*> split(block* node, const key_t& key);
+    // Every key of `left` has to be less than every key of `right`.
+    static block* merge(block* left, block* right);
+    // Left part gets the first k elements.
+    static std::pair<block*, block*> split_k(block* node, size_t k);
+
+    block* cut_subsegment(size_t l, size_t r);
+    void insert_subsegment(size_t i, block* t);
+
+    iterator begin();
+    iterator end();
+    iterator lower_bound(const key_t& key);
+    iterator upper_bound(const key_t& key);
+
+    std::vector<Node*> get_traversal(const execution_policy& policy = sequential_policy());
+    frozen_tree<Node> freeze();
+
+    void clear(const execution_policy& policy = sequential_policy());
+
+    // Bulk loading fills the leaves evenly from left to right in O(n).
+    template <typename Iterator>
+    void build_from_sorted(Iterator first, Iterator last, const execution_policy& policy = sequential_policy());
+
+    // Small batches are applied one by one, large ones rebuild the tree in O(n + m).
+    template <typename Iterator>
+    void insert_batch(Iterator first, Iterator last);
+    template <typename Iterator>
+    void erase_batch(Iterator first, Iterator last);
+
+    // Set operations consume `other` and merge the two sorted sequences in O(n + m).
+    void set_union(btree& other, const execution_policy& policy = sequential_policy());
+    void set_intersection(btree& other, const execution_policy& policy = sequential_policy());
+    void set_difference(btree& other, const execution_policy& policy = sequential_policy());
+
+    template <typename Predicate>
+    void filter(Predicate pred, const execution_policy& policy = sequential_policy());
+
+    template <typename F>
+    void for_each(F f, const execution_policy& policy = sequential_policy());
+
+    template <typename T, typename Map, typename Combine>
+    T reduce(T identity, Map map, Combine combine, const execution_policy& policy = sequential_policy());
+
+    // Calls f(node) in order for the entries with keys in [lo, hi] (at positions [l, r]), keeping
+    // only the root path; stops early if f returns false.
+    template <typename F>
+    void for_each_in_range(const key_t& lo, const key_t& hi, F f);
+    template <typename F>
+    void for_each_kth_range(size_t l, size_t r, F f);
+
+    block* root;
+
+private:
+    // One spare slot absorbs the overflow before a block is split. Inner keys are padded so that
+    // vector loads past the last separator stay inside the array.
+    static constexpr size_t key_slots = 1 + (InnerCapacity + 7) / 8 * 8;
+
+    struct leaf : block {
+        Node entries[LeafCapacity + 1];
+    };
+
+    struct inner : block {
+        key_t keys[key_slots];
+        size_t sizes[InnerCapacity + 1];
+        block* children[InnerCapacity + 1];
+    };
+
+    static bool is_leaf(const block* b) { return b->level == 0; }
+    static leaf* as_leaf(block* b) { return static_cast<leaf*>(b); }
+    static inner* as_inner(block* b) { return static_cast<inner*>(b); }
+    static size_t capacity(const block* b) { return is_leaf(b) ? LeafCapacity : InnerCapacity; }
+
+    static leaf* new_leaf();
+    static inner* new_inner(unsigned char level);
+    static void delete_block(block* b);
+    static void destroy(block* b, const execution_policy& policy);
+
+    static const key_t& min_key(block* b);
+    static size_t leaf_lower_bound(leaf* l, const key_t& key);
+    static size_t leaf_upper_bound(leaf* l, const key_t& key);
+    template <bool Strict>
+    static size_t child_index(const inner* n, const key_t& key);
+#if defined(__SSE2__)
+    template <bool Strict>
+    static size_t simd_count(const int32_t* keys, size_t count, int32_t key);
+#endif
+
+    static void push(block* b);
+    static void update(block* b);
+    static void refresh(inner* n, size_t i);
+    static void insert_child(inner* n, size_t i, block* child);
+    static void remove_child(inner* n, size_t i);
+    static void move_tail(block* from, block* to, size_t k);
+    static void move_head(block* from, block* to, size_t k);
+    static void rebalance(inner* n, size_t i);
+    static void normalize(inner* n, size_t i);
+    static block* fix_root(block* b);
+
+    static bool _insert(block* b, const Node& node);
+    static bool _erase(block* b, const key_t& key);
+    static void _insert_kth(block* b, size_t k, const Node& node);
+    static void _erase_kth(block* b, size_t k);
+    static void attach_right(block* node, block* right);
+    static void attach_left(block* node, block* left);
+    static block* take_children(inner* n, size_t from, size_t to);
+
+    template <typename Iterator>
+    static block* build(Iterator first, size_t count);
+    void rebuild(std::vector<Node>& nodes);
+
+    template <typename F>
+    static void for_children(inner* n, size_t from, size_t to, const execution_policy& policy, F& f);
+    static void traversal(block* b, Node** out, const execution_policy& policy);
+    template <typename F>
+    static void for_each(block* b, F& f, const execution_policy& policy);
+    template <typename T, typename Map, typename Combine>
+    static T reduce(block* b, const T& identity, Map& map, Combine& combine, const execution_policy& policy);
+
+    // Iterator to the entry at position k, or end().
+    iterator kth_iterator(size_t k);
+};
+
+// In-order iterator over the leaf entries. It keeps the root path with the child index taken
+// at every level, so ++ and -- are O(1) amortized.
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+class btree<Node, InnerCapacity, LeafCapacity>::iterator {
+public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = Node;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Node*;
+    using reference = Node&;
+
+    iterator() = default;
+    iterator(block* root, std::vector<std::pair<block*, size_t>> path) : root(root), path(std::move(path)) {}
+
+    reference operator*() const {
+        return as_leaf(path.back().first)->entries[path.back().second];
+    }
+
+    pointer operator->() const {
+        return &**this;
+    }
+
+    iterator& operator++() {
+        if (++path.back().second < path.back().first->count) return *this;
+        path.pop_back();
+        while (!path.empty() && path.back().second + 1 == path.back().first->count) {
+            path.pop_back();
+        }
+        if (!path.empty()) {
+            ++path.back().second;
+            descend(as_inner(path.back().first)->children[path.back().second], false);
+        }
+        return *this;
+    }
+
+    iterator& operator--() {
+        if (path.empty()) {
+            if (root) descend(root, true);
+            return *this;
+        }
+        if (path.back().second-- > 0) return *this;
+        path.pop_back();
+        while (!path.empty() && path.back().second == 0) {
+            path.pop_back();
+        }
+        if (!path.empty()) {
+            --path.back().second;
+            descend(as_inner(path.back().first)->children[path.back().second], true);
+        }
+        return *this;
+    }
+
+    iterator operator++(int) {
+        iterator result = *this;
+        ++*this;
+        return result;
+    }
+
+    iterator operator--(int) {
+        iterator result = *this;
+        --*this;
+        return result;
+    }
+
+    bool operator==(const iterator& other) const {
+        if (path.empty() || other.path.empty()) return path.empty() == other.path.empty();
+        return path.back() == other.path.back();
+    }
+
+private:
+    friend class btree;
+
+    // Appends the path to the first (or the last) entry under `b`.
+    void descend(block* b, bool to_last) {
+        while (true) {
+            push(b);
+            path.emplace_back(b, to_last ? b->count - 1 : 0);
+            if (is_leaf(b)) return;
+            b = as_inner(b)->children[path.back().second];
+        }
+    }
+
+    block* root = nullptr;
+    std::vector<std::pair<block*, size_t>> path;
+};
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::new_leaf() -> leaf* {
+    leaf* l = new leaf();
+    l->level = 0;
+    l->reversed = false;
+    l->count = 0;
+    l->size = 0;
+    return l;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::new_inner(unsigned char level) -> inner* {
+    inner* n = new inner();
+    n->level = level;
+    n->reversed = false;
+    n->count = 0;
+    n->size = 0;
+    return n;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::delete_block(block* b) {
+    if (is_leaf(b)) {
+        delete as_leaf(b);
+    } else {
+        delete as_inner(b);
+    }
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::destroy(block* b, const execution_policy& policy) {
+    if (b == nullptr) return;
+    if (!is_leaf(b)) {
+        auto f = [](inner* n, size_t i, const execution_policy& p) { destroy(n->children[i], p); };
+        for_children(as_inner(b), 0, b->count, policy, f);
+    }
+    delete_block(b);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::min_key(block* b) -> const key_t& {
+    return is_leaf(b) ? as_leaf(b)->entries[0].key : as_inner(b)->keys[0];
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+size_t btree<Node, InnerCapacity, LeafCapacity>::leaf_lower_bound(leaf* l, const key_t& key) {
+    return std::partition_point(l->entries, l->entries + l->count,
+                                [&](const Node& node) { return node.key < key; }) - l->entries;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+size_t btree<Node, InnerCapacity, LeafCapacity>::leaf_upper_bound(leaf* l, const key_t& key) {
+    return std::partition_point(l->entries, l->entries + l->count,
+                                [&](const Node& node) { return !(key < node.key); }) - l->entries;
+}
+
+// Number of separators keys[1..count) that are less than (Strict) or not greater than `key`,
+// which is the index of the child to descend into.
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <bool Strict>
+size_t btree<Node, InnerCapacity, LeafCapacity>::child_index(const inner* n, const key_t& key) {
+    const key_t* keys = n->keys + 1;
+    size_t count = n->count - 1;
+#if defined(__SSE2__)
+    if constexpr (std::is_same_v<key_t, int32_t>) {
+        return simd_count<Strict>(keys, count, key);
+    }
+#endif
+    size_t result = 0;
+    for (size_t j = 0; j < count; ++j) {
+        result += Strict ? keys[j] < key : !(key < keys[j]);
+    }
+    return result;
+}
+
+#if defined(__SSE2__)
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <bool Strict>
+size_t btree<Node, InnerCapacity, LeafCapacity>::simd_count(const int32_t* keys, size_t count, int32_t key) {
+    size_t result = 0;
+#if defined(__AVX2__)
+    const size_t lanes = 8;
+    __m256i pivot = _mm256_set1_epi32(key);
+    for (size_t j = 0; j < count; j += lanes) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + j));
+        __m256i greater = Strict ? _mm256_cmpgt_epi32(pivot, block) : _mm256_cmpgt_epi32(block, pivot);
+        unsigned bits = _mm256_movemask_ps(_mm256_castsi256_ps(greater));
+#elif defined(__SSE2__)
+    const size_t lanes = 4;
+    __m128i pivot = _mm_set1_epi32(key);
+    for (size_t j = 0; j < count; j += lanes) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys + j));
+        __m128i greater = Strict ? _mm_cmpgt_epi32(pivot, block) : _mm_cmpgt_epi32(block, pivot);
+        unsigned bits = _mm_movemask_ps(_mm_castsi128_ps(greater));
+#endif
+        if (!Strict) bits = ~bits;
+        unsigned valid = count - j >= lanes ? (1u << lanes) - 1 : (1u << (count - j)) - 1;
+        result += std::popcount(bits & valid);
+    }
+    return result;
+}
+#endif
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::push(block* b) {
+    if (!b->reversed) return;
+    if (is_leaf(b)) {
+        std::reverse(as_leaf(b)->entries, as_leaf(b)->entries + b->count);
+    } else {
+        inner* n = as_inner(b);
+        std::reverse(n->keys, n->keys + n->count);
+        std::reverse(n->sizes, n->sizes + n->count);
+        std::reverse(n->children, n->children + n->count);
+        for (size_t i = 0; i < n->count; ++i) n->children[i]->reverse();
+    }
+    b->reversed = false;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::update(block* b) {
+    if (is_leaf(b)) {
+        b->size = b->count;
+        return;
+    }
+    inner* n = as_inner(b);
+    n->size = 0;
+    for (size_t i = 0; i < n->count; ++i) n->size += n->sizes[i];
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::refresh(inner* n, size_t i) {
+    n->keys[i] = min_key(n->children[i]);
+    n->sizes[i] = n->children[i]->size;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::insert_child(inner* n, size_t i, block* child) {
+    std::move_backward(n->keys + i, n->keys + n->count, n->keys + n->count + 1);
+    std::move_backward(n->sizes + i, n->sizes + n->count, n->sizes + n->count + 1);
+    std::move_backward(n->children + i, n->children + n->count, n->children + n->count + 1);
+    n->children[i] = child;
+    ++n->count;
+    refresh(n, i);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::remove_child(inner* n, size_t i) {
+    std::move(n->keys + i + 1, n->keys + n->count, n->keys + i);
+    std::move(n->sizes + i + 1, n->sizes + n->count, n->sizes + i);
+    std::move(n->children + i + 1, n->children + n->count, n->children + i);
+    --n->count;
+}
+
+// Moves the last k items of `from` to the front of `to`; both blocks are on the same level.
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::move_tail(block* from, block* to, size_t k) {
+    push(from);
+    push(to);
+    auto move = [&](auto* src, auto* dst) {
+        std::move_backward(dst, dst + to->count, dst + to->count + k);
+        std::move(src + from->count - k, src + from->count, dst);
+    };
+    if (is_leaf(from)) {
+        move(as_leaf(from)->entries, as_leaf(to)->entries);
+    } else {
+        move(as_inner(from)->keys, as_inner(to)->keys);
+        move(as_inner(from)->sizes, as_inner(to)->sizes);
+        move(as_inner(from)->children, as_inner(to)->children);
+    }
+    from->count -= k;
+    to->count += k;
+    update(from);
+    update(to);
+}
+
+// Moves the first k items of `from` to the back of `to`; both blocks are on the same level.
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::move_head(block* from, block* to, size_t k) {
+    push(from);
+    push(to);
+    auto move = [&](auto* src, auto* dst) {
+        std::move(src, src + k, dst + to->count);
+        std::move(src + k, src + from->count, src);
+    };
+    if (is_leaf(from)) {
+        move(as_leaf(from)->entries, as_leaf(to)->entries);
+    } else {
+        move(as_inner(from)->keys, as_inner(to)->keys);
+        move(as_inner(from)->sizes, as_inner(to)->sizes);
+        move(as_inner(from)->children, as_inner(to)->children);
+    }
+    from->count -= k;
+    to->count += k;
+    update(from);
+    update(to);
+}
+
+// Merges children i and i + 1 when they fit into one block, otherwise splits their items evenly.
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::rebalance(inner* n, size_t i) {
+    block* a = n->children[i];
+    block* b = n->children[i + 1];
+    size_t total = a->count + b->count;
+    if (total <= capacity(a)) {
+        move_head(b, a, b->count);
+        delete_block(b);
+        remove_child(n, i + 1);
+        refresh(n, i);
+        return;
+    }
+    if (a->count < total / 2) {
+        move_head(b, a, total / 2 - a->count);
+    } else if (a->count > total / 2) {
+        move_tail(a, b, a->count - total / 2);
+    }
+    refresh(n, i);
+    refresh(n, i + 1);
+}
+
+// Restores the fill bounds of child i after it has changed, and refreshes its key and size.
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::normalize(inner* n, size_t i) {
+    block* child = n->children[i];
+    if (child->count > capacity(child)) {
+        block* right = is_leaf(child) ? static_cast<block*>(new_leaf()) : new_inner(child->level);
+        move_tail(child, right, child->count / 2);
+        refresh(n, i);
+        insert_child(n, i + 1, right);
+    } else if (child->count < capacity(child) / 2 && n->count > 1) {
+        rebalance(n, i + 1 < n->count ? i : i - 1);
+    } else {
+        refresh(n, i);
+    }
+}
+
+// The root may be underfull, but it must not overflow and an inner root needs two children.
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::fix_root(block* b) -> block* {
+    if (b->count > capacity(b)) {
+        inner* n = new_inner(b->level + 1);
+        insert_child(n, 0, b);
+        normalize(n, 0);
+        update(n);
+        b = n;
+    }
+    while (!is_leaf(b) && b->count == 1) {
+        push(b);
+        block* child = as_inner(b)->children[0];
+        delete_block(b);
+        b = child;
+    }
+    if (b->count == 0) {
+        delete_block(b);
+        return nullptr;
+    }
+    return b;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+Node* btree<Node, InnerCapacity, LeafCapacity>::find(const key_t& key) {
+    block* b = root;
+    if (b == nullptr) return nullptr;
+    while (!is_leaf(b)) {
+        inner* n = as_inner(b);
+        b = n->children[child_index<false>(n, key)];
+    }
+    leaf* l = as_leaf(b);
+    size_t i = leaf_lower_bound(l, key);
+    return i < l->count && !(key < l->entries[i].key) ? l->entries + i : nullptr;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+bool btree<Node, InnerCapacity, LeafCapacity>::exists(const key_t& key) {
+    return find(key) != nullptr;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+Node* btree<Node, InnerCapacity, LeafCapacity>::get_min() {
+    return get_kth(0);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+Node* btree<Node, InnerCapacity, LeafCapacity>::get_kth(size_t k) {
+    if (k >= size()) return nullptr;
+    block* b = root;
+    while (!is_leaf(b)) {
+        push(b);
+        inner* n = as_inner(b);
+        size_t i = 0;
+        while (k >= n->sizes[i]) k -= n->sizes[i++];
+        b = n->children[i];
+    }
+    push(b);
+    return as_leaf(b)->entries + k;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+Node* btree<Node, InnerCapacity, LeafCapacity>::next(const key_t& key) {
+    iterator it = upper_bound(key);
+    return it == end() ? nullptr : &*it;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+Node* btree<Node, InnerCapacity, LeafCapacity>::prev(const key_t& key) {
+    iterator it = lower_bound(key);
+    return it == begin() ? nullptr : &*--it;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+size_t btree<Node, InnerCapacity, LeafCapacity>::order_of_key(const key_t& key) {
+    block* b = root;
+    if (b == nullptr) return 0;
+    size_t result = 0;
+    while (!is_leaf(b)) {
+        inner* n = as_inner(b);
+        size_t i = child_index<true>(n, key);
+        for (size_t j = 0; j < i; ++j) result += n->sizes[j];
+        b = n->children[i];
+    }
+    return result + leaf_lower_bound(as_leaf(b), key);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+size_t btree<Node, InnerCapacity, LeafCapacity>::size() {
+    return root ? root->size : 0;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename... Args>
+void btree<Node, InnerCapacity, LeafCapacity>::insert(const key_t& key, Args&&... args) {
+    const Node node(key, std::forward<Args>(args)...);
+    insert(node);
+}
+
+// Keys already present keep their entry.
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::insert(const Node& node) {
+    if (root == nullptr) root = new_leaf();
+    if (_insert(root, node)) root = fix_root(root);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+bool btree<Node, InnerCapacity, LeafCapacity>::_insert(block* b, const Node& node) {
+    if (is_leaf(b)) {
+        leaf* l = as_leaf(b);
+        size_t i = leaf_lower_bound(l, node.key);
+        if (i < l->count && !(node.key < l->entries[i].key)) return false;
+        std::move_backward(l->entries + i, l->entries + l->count, l->entries + l->count + 1);
+        l->entries[i] = node;
+        ++l->count;
+        update(l);
+        return true;
+    }
+    inner* n = as_inner(b);
+    size_t i = child_index<false>(n, node.key);
+    if (!_insert(n->children[i], node)) return false;
+    normalize(n, i);
+    update(n);
+    return true;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::erase(const key_t& key) {
+    if (root != nullptr && _erase(root, key)) root = fix_root(root);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+bool btree<Node, InnerCapacity, LeafCapacity>::_erase(block* b, const key_t& key) {
+    if (is_leaf(b)) {
+        leaf* l = as_leaf(b);
+        size_t i = leaf_lower_bound(l, key);
+        if (i == l->count || key < l->entries[i].key) return false;
+        std::move(l->entries + i + 1, l->entries + l->count, l->entries + i);
+        --l->count;
+        update(l);
+        return true;
+    }
+    inner* n = as_inner(b);
+    size_t i = child_index<false>(n, key);
+    if (!_erase(n->children[i], key)) return false;
+    normalize(n, i);
+    update(n);
+    return true;
+}
+
+// Hangs `right` (lower than `node`) after the last entry of `node`'s level right->level + 1.
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::attach_right(block* node, block* right) {
+    push(node);
+    inner* n = as_inner(node);
+    if (n->level == right->level + 1) {
+        insert_child(n, n->count, right);
+    } else {
+        attach_right(n->children[n->count - 1], right);
+    }
+    normalize(n, n->count - 1);
+    update(n);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::attach_left(block* node, block* left) {
+    push(node);
+    inner* n = as_inner(node);
+    if (n->level == left->level + 1) {
+        insert_child(n, 0, left);
+    } else {
+        attach_left(n->children[0], left);
+    }
+    normalize(n, 0);
+    update(n);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::merge(block* left, block* right) -> block* {
+    if (left == nullptr) return right;
+    if (right == nullptr) return left;
+    if (left->level > right->level) {
+        attach_right(left, right);
+        return fix_root(left);
+    }
+    if (left->level < right->level) {
+        attach_left(right, left);
+        return fix_root(right);
+    }
+    inner* n = new_inner(left->level + 1);
+    insert_child(n, 0, left);
+    insert_child(n, 1, right);
+    if (left->count < capacity(left) / 2 || right->count < capacity(right) / 2) {
+        rebalance(n, 0);
+    }
+    update(n);
+    return fix_root(n);
+}
+
+// Children [from, to) of `n` as a standalone tree; the block may be underfull like any root.
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::take_children(inner* n, size_t from, size_t to) -> block* {
+    if (from == to) return nullptr;
+    if (from + 1 == to) return n->children[from];
+    inner* result = new_inner(n->level);
+    for (size_t i = from; i < to; ++i) {
+        insert_child(result, i - from, n->children[i]);
+    }
+    update(result);
+    return result;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::split(block* node, const key_t& key) -> std::pair<block*, block*> {
+    if (node == nullptr) return {nullptr, nullptr};
+    if (is_leaf(node)) {
+        leaf* l = as_leaf(node);
+        leaf* right = new_leaf();
+        move_tail(l, right, l->count - leaf_lower_bound(l, key));
+        return {fix_root(l), fix_root(right)};
+    }
+    inner* n = as_inner(node);
+    size_t i = child_index<true>(n, key);
+    auto [left, right] = split(n->children[i], key);
+    block* before = take_children(n, 0, i);
+    block* after = take_children(n, i + 1, n->count);
+    delete_block(n);
+    return {merge(before, left), merge(right, after)};
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::split_k(block* node, size_t k) -> std::pair<block*, block*> {
+    if (node == nullptr) return {nullptr, nullptr};
+    if (k == 0) return {nullptr, node};
+    if (k >= node->size) return {node, nullptr};
+    push(node);
+    if (is_leaf(node)) {
+        leaf* right = new_leaf();
+        move_tail(node, right, node->count - k);
+        return {node, right};
+    }
+    inner* n = as_inner(node);
+    size_t i = 0;
+    while (k >= n->sizes[i]) k -= n->sizes[i++];
+    auto [left, right] = split_k(n->children[i], k);
+    block* before = take_children(n, 0, i);
+    block* after = take_children(n, i + 1, n->count);
+    delete_block(n);
+    return {merge(before, left), merge(right, after)};
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename... Args>
+void btree<Node, InnerCapacity, LeafCapacity>::insert_kth(size_t k, Args&&... args) {
+    const Node node(std::forward<Args>(args)...);
+    insert_kth(k, node);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::insert_kth(size_t k, const Node& node) {
+    if (root == nullptr) root = new_leaf();
+    _insert_kth(root, k, node);
+    root = fix_root(root);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::_insert_kth(block* b, size_t k, const Node& node) {
+    push(b);
+    if (is_leaf(b)) {
+        leaf* l = as_leaf(b);
+        std::move_backward(l->entries + k, l->entries + l->count, l->entries + l->count + 1);
+        l->entries[k] = node;
+        ++l->count;
+        update(l);
+        return;
+    }
+    inner* n = as_inner(b);
+    size_t i = 0;
+    while (i + 1 < n->count && k > n->sizes[i]) k -= n->sizes[i++];
+    _insert_kth(n->children[i], k, node);
+    normalize(n, i);
+    update(n);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::erase_kth(size_t k) {
+    if (k >= size()) return;
+    _erase_kth(root, k);
+    root = fix_root(root);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::_erase_kth(block* b, size_t k) {
+    push(b);
+    if (is_leaf(b)) {
+        leaf* l = as_leaf(b);
+        std::move(l->entries + k + 1, l->entries + l->count, l->entries + k);
+        --l->count;
+        update(l);
+        return;
+    }
+    inner* n = as_inner(b);
+    size_t i = 0;
+    while (k >= n->sizes[i]) k -= n->sizes[i++];
+    _erase_kth(n->children[i], k);
+    normalize(n, i);
+    update(n);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::cut_subsegment(size_t l, size_t r) -> block* {
+    auto [left, rest] = split_k(root, l);
+    auto [mid, right] = split_k(rest, r - l + 1);
+    root = merge(left, right);
+    return mid;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::insert_subsegment(size_t i, block* t) {
+    auto [left, right] = split_k(root, i);
+    root = merge(merge(left, t), right);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::begin() -> iterator {
+    iterator result(root, {});
+    if (root) result.descend(root, false);
+    return result;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::end() -> iterator {
+    return iterator(root, {});
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::lower_bound(const key_t& key) -> iterator {
+    iterator result(root, {});
+    if (root == nullptr) return result;
+    block* b = root;
+    while (!is_leaf(b)) {
+        size_t i = child_index<true>(as_inner(b), key);
+        result.path.emplace_back(b, i);
+        b = as_inner(b)->children[i];
+    }
+    size_t i = leaf_lower_bound(as_leaf(b), key);
+    if (i < b->count) {
+        result.path.emplace_back(b, i);
+    } else {
+        result.path.emplace_back(b, b->count - 1);
+        ++result;
+    }
+    return result;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::upper_bound(const key_t& key) -> iterator {
+    iterator result(root, {});
+    if (root == nullptr) return result;
+    block* b = root;
+    while (!is_leaf(b)) {
+        size_t i = child_index<false>(as_inner(b), key);
+        result.path.emplace_back(b, i);
+        b = as_inner(b)->children[i];
+    }
+    size_t i = leaf_upper_bound(as_leaf(b), key);
+    if (i < b->count) {
+        result.path.emplace_back(b, i);
+    } else {
+        result.path.emplace_back(b, b->count - 1);
+        ++result;
+    }
+    return result;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename F>
+void btree<Node, InnerCapacity, LeafCapacity>::for_children(inner* n, size_t from, size_t to,
+                                                            const execution_policy& policy, F& f) {
+    if (from + 1 == to) {
+        f(n, from, policy);
+        return;
+    }
+    size_t mid = (from + to) / 2, work = 0;
+    for (size_t i = from; i < to; ++i) work += n->sizes[i];
+    fork_join(policy, work,
+              [&](const execution_policy& p) { for_children(n, from, mid, p, f); },
+              [&](const execution_policy& p) { for_children(n, mid, to, p, f); });
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::traversal(block* b, Node** out, const execution_policy& policy) {
+    push(b);
+    if (is_leaf(b)) {
+        for (size_t i = 0; i < b->count; ++i) out[i] = as_leaf(b)->entries + i;
+        return;
+    }
+    inner* n = as_inner(b);
+    std::vector<size_t> offsets(n->count, 0);
+    for (size_t i = 1; i < n->count; ++i) offsets[i] = offsets[i - 1] + n->sizes[i - 1];
+    auto f = [&](inner* n, size_t i, const execution_policy& p) { traversal(n->children[i], out + offsets[i], p); };
+    for_children(n, 0, n->count, policy, f);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+std::vector<Node*> btree<Node, InnerCapacity, LeafCapacity>::get_traversal(const execution_policy& policy) {
+    std::vector<Node*> result(size());
+    if (root) traversal(root, result.data(), policy);
+    return result;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+frozen_tree<Node> btree<Node, InnerCapacity, LeafCapacity>::freeze() {
+    return frozen_tree<Node>(*this);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::clear(const execution_policy& policy) {
+    destroy(root, policy);
+    root = nullptr;
+}
+
+// Splits `count` items into the fewest blocks of at most `capacity` items with sizes differing
+// by at most one, so that every block is at least half full.
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename Iterator>
+auto btree<Node, InnerCapacity, LeafCapacity>::build(Iterator first, size_t count) -> block* {
+    if (count == 0) return nullptr;
+    std::vector<block*> level;
+    size_t blocks = (count + LeafCapacity - 1) / LeafCapacity;
+    for (size_t b = 0; b < blocks; ++b) {
+        leaf* l = new_leaf();
+        l->count = count / blocks + (b < count % blocks);
+        for (size_t i = 0; i < l->count; ++i, ++first) {
+            if constexpr (requires { std::tuple_size<std::remove_cvref_t<decltype(*first)>>::value; }) {
+                l->entries[i] = std::make_from_tuple<Node>(*first);
+            } else {
+                l->entries[i] = Node(*first);
+            }
+        }
+        update(l);
+        level.push_back(l);
+    }
+    for (unsigned char height = 1; level.size() > 1; ++height) {
+        std::vector<block*> parents;
+        blocks = (level.size() + InnerCapacity - 1) / InnerCapacity;
+        for (size_t b = 0, next = 0; b < blocks; ++b) {
+            inner* n = new_inner(height);
+            size_t children = level.size() / blocks + (b < level.size() % blocks);
+            for (size_t i = 0; i < children; ++i) insert_child(n, i, level[next++]);
+            update(n);
+            parents.push_back(n);
+        }
+        level = std::move(parents);
+    }
+    return level[0];
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename Iterator>
+void btree<Node, InnerCapacity, LeafCapacity>::build_from_sorted(Iterator first, Iterator last,
+                                                                 const execution_policy&) {
+    clear();
+    root = build(first, std::distance(first, last));
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::rebuild(std::vector<Node>& nodes) {
+    clear();
+    root = build(nodes.begin(), nodes.size());
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename Iterator>
+void btree<Node, InnerCapacity, LeafCapacity>::insert_batch(Iterator first, Iterator last) {
+    std::vector<Node> batch;
+    for (; first != last; ++first) {
+        if constexpr (requires { std::tuple_size<std::remove_cvref_t<decltype(*first)>>::value; }) {
+            batch.push_back(std::make_from_tuple<Node>(*first));
+        } else {
+            batch.push_back(Node(*first));
+        }
+    }
+    auto less = [](const Node& a, const Node& b) { return a.key < b.key; };
+    std::stable_sort(batch.begin(), batch.end(), less);
+    batch.erase(std::unique(batch.begin(), batch.end(), [](const Node& a, const Node& b) { return !(a.key < b.key); }),
+                batch.end());
+    if (batch.size() * 16 < size()) {
+        for (const Node& node : batch) insert(node);
+        return;
+    }
+    std::vector<Node> merged;
+    merged.reserve(size() + batch.size());
+    auto it = batch.begin();
+    for (Node& node : *this) {
+        for (; it != batch.end() && it->key < node.key; ++it) merged.push_back(*it);
+        if (it != batch.end() && !(node.key < it->key)) ++it;
+        merged.push_back(node);
+    }
+    merged.insert(merged.end(), it, batch.end());
+    rebuild(merged);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename Iterator>
+void btree<Node, InnerCapacity, LeafCapacity>::erase_batch(Iterator first, Iterator last) {
+    std::vector<key_t> keys(first, last);
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    if (keys.size() * 16 < size()) {
+        for (const key_t& key : keys) erase(key);
+        return;
+    }
+    std::vector<Node> kept;
+    kept.reserve(size());
+    auto it = keys.begin();
+    for (Node& node : *this) {
+        while (it != keys.end() && *it < node.key) ++it;
+        if (it == keys.end() || node.key < *it) kept.push_back(node);
+    }
+    rebuild(kept);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::set_union(btree& other, const execution_policy& policy) {
+    std::vector<Node> merged;
+    merged.reserve(size() + other.size());
+    auto it = other.begin();
+    for (Node& node : *this) {
+        for (; it != other.end() && it->key < node.key; ++it) merged.push_back(*it);
+        if (it != other.end() && !(node.key < it->key)) ++it;
+        merged.push_back(node);
+    }
+    for (; it != other.end(); ++it) merged.push_back(*it);
+    other.clear(policy);
+    rebuild(merged);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::set_intersection(btree& other, const execution_policy& policy) {
+    std::vector<Node> kept;
+    auto it = other.begin();
+    for (Node& node : *this) {
+        while (it != other.end() && it->key < node.key) ++it;
+        if (it != other.end() && !(node.key < it->key)) kept.push_back(node);
+    }
+    other.clear(policy);
+    rebuild(kept);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+void btree<Node, InnerCapacity, LeafCapacity>::set_difference(btree& other, const execution_policy& policy) {
+    std::vector<Node> kept;
+    auto it = other.begin();
+    for (Node& node : *this) {
+        while (it != other.end() && it->key < node.key) ++it;
+        if (it == other.end() || node.key < it->key) kept.push_back(node);
+    }
+    other.clear(policy);
+    rebuild(kept);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename Predicate>
+void btree<Node, InnerCapacity, LeafCapacity>::filter(Predicate pred, const execution_policy&) {
+    std::vector<Node> kept;
+    for (Node& node : *this) {
+        if (pred(&node)) kept.push_back(node);
+    }
+    rebuild(kept);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename F>
+void btree<Node, InnerCapacity, LeafCapacity>::for_each(block* b, F& f, const execution_policy& policy) {
+    push(b);
+    if (is_leaf(b)) {
+        for (size_t i = 0; i < b->count; ++i) f(as_leaf(b)->entries + i);
+        return;
+    }
+    auto visit = [&](inner* n, size_t i, const execution_policy& p) { for_each(n->children[i], f, p); };
+    for_children(as_inner(b), 0, b->count, policy, visit);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename F>
+void btree<Node, InnerCapacity, LeafCapacity>::for_each(F f, const execution_policy& policy) {
+    if (root) for_each(root, f, policy);
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename T, typename Map, typename Combine>
+T btree<Node, InnerCapacity, LeafCapacity>::reduce(block* b, const T& identity, Map& map, Combine& combine,
+                                                   const execution_policy& policy) {
+    push(b);
+    T result = identity;
+    if (is_leaf(b)) {
+        for (size_t i = 0; i < b->count; ++i) result = combine(result, map(as_leaf(b)->entries + i));
+        return result;
+    }
+    std::vector<T> parts(b->count, identity);
+    auto visit = [&](inner* n, size_t i, const execution_policy& p) {
+        parts[i] = reduce(n->children[i], identity, map, combine, p);
+    };
+    for_children(as_inner(b), 0, b->count, policy, visit);
+    for (const T& part : parts) result = combine(result, part);
+    return result;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename T, typename Map, typename Combine>
+T btree<Node, InnerCapacity, LeafCapacity>::reduce(T identity, Map map, Combine combine, const execution_policy& policy) {
+    return root ? reduce(root, identity, map, combine, policy) : identity;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+auto btree<Node, InnerCapacity, LeafCapacity>::kth_iterator(size_t k) -> iterator {
+    iterator result(root, {});
+    if (k >= size()) return result;
+    block* b = root;
+    while (!is_leaf(b)) {
+        push(b);
+        inner* n = as_inner(b);
+        size_t i = 0;
+        while (k >= n->sizes[i]) k -= n->sizes[i++];
+        result.path.emplace_back(b, i);
+        b = n->children[i];
+    }
+    push(b);
+    result.path.emplace_back(b, k);
+    return result;
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename F>
+void btree<Node, InnerCapacity, LeafCapacity>::for_each_in_range(const key_t& lo, const key_t& hi, F f) {
+    for (iterator it = lower_bound(lo); it != end() && !(hi < it->key); ++it) {
+        if (!visit_node(f, *it)) return;
+    }
+}
+
+template <typename Node, size_t InnerCapacity, size_t LeafCapacity>
+template <typename F>
+void btree<Node, InnerCapacity, LeafCapacity>::for_each_kth_range(size_t l, size_t r, F f) {
+    iterator it = kth_iterator(l);
+    for (size_t i = l; i <= r && it != end(); ++i, ++it) {
+        if (!visit_node(f, *it)) return;
+    }
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <optional>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "epoch.h"
+
+// Ordered map for many concurrent writers: a lazy skiplist (Herlihy, Lev, Luchangco, Shavit).
+// Searches take no locks; insert and erase lock only the predecessors of the affected node at
+// the levels they change, validate them, and retry on a conflict. Erase marks the node first,
+// so searches skip it before it is unlinked, and unlinked nodes are reclaimed through an
+// epoch_domain once no operation can still reach them.
+//
+// All operations are linearizable except next and prev, which return an entry that was present
+// at some point during the call. Values are copied out, so they must be copyable; the value of
+// an inserted key never changes (inserting an existing key keeps it, as in the trees).
+template <typename Key, typename Value, size_t MaxLevel = 20>
+class concurrent_skiplist {
+public:
+    using key_t = Key;
+    using value_t = Value;
+
+    concurrent_skiplist() : head(node::create(Key(), Value(), MaxLevel)) {}
+
+    concurrent_skiplist(const concurrent_skiplist&) = delete;
+    concurrent_skiplist& operator=(const concurrent_skiplist&) = delete;
+
+    // No operation may be running.
+    ~concurrent_skiplist() {
+        node* current = head;
+        while (current != nullptr) {
+            node* next = current->next(0).load(std::memory_order_relaxed);
+            node::destroy(current);
+            current = next;
+        }
+    }
+
+    // Returns false if the key is already present.
+    bool insert(const Key& key, const Value& value) {
+        auto guard = domain.pin();
+        size_t top = random_level();
+        node* preds[MaxLevel];
+        node* succs[MaxLevel];
+        while (true) {
+            int found = search(key, preds, succs);
+            if (found != -1) {
+                node* existing = succs[found];
+                if (!existing->marked.load(std::memory_order_acquire)) {
+                    while (!existing->fully_linked.load(std::memory_order_acquire)) std::this_thread::yield();
+                    return false;
+                }
+                continue;
+            }
+
+            size_t locked = lock_preds(preds, top);
+            bool valid = true;
+            for (size_t level = 0; valid && level < top; ++level) {
+                valid = !preds[level]->marked.load(std::memory_order_acquire) &&
+                        (succs[level] == nullptr || !succs[level]->marked.load(std::memory_order_acquire)) &&
+                        preds[level]->next(level).load(std::memory_order_acquire) == succs[level];
+            }
+            if (!valid) {
+                unlock_preds(preds, locked);
+                continue;
+            }
+
+            node* created = node::create(key, value, top);
+            for (size_t level = 0; level < top; ++level) {
+                created->next(level).store(succs[level], std::memory_order_relaxed);
+            }
+            for (size_t level = 0; level < top; ++level) {
+                preds[level]->next(level).store(created, std::memory_order_release);
+            }
+            created->fully_linked.store(true, std::memory_order_release);
+            unlock_preds(preds, locked);
+            count.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+
+    // Returns false if the key is not present.
+    bool erase(const Key& key) {
+        auto guard = domain.pin();
+        node* preds[MaxLevel];
+        node* succs[MaxLevel];
+        node* victim = nullptr;
+        while (true) {
+            int found = search(key, preds, succs);
+            if (victim == nullptr) {
+                if (found == -1) return false;
+                node* candidate = succs[found];
+                if (!candidate->fully_linked.load(std::memory_order_acquire) ||
+                    candidate->level != size_t(found) + 1 || candidate->marked.load(std::memory_order_acquire)) {
+                    return false;
+                }
+                candidate->lock.lock();
+                if (candidate->marked.load(std::memory_order_relaxed)) {
+                    candidate->lock.unlock();
+                    return false;
+                }
+                candidate->marked.store(true, std::memory_order_release);
+                victim = candidate;
+            }
+
+            size_t locked = lock_preds(preds, victim->level);
+            bool valid = true;
+            for (size_t level = 0; valid && level < victim->level; ++level) {
+                valid = !preds[level]->marked.load(std::memory_order_acquire) &&
+                        preds[level]->next(level).load(std::memory_order_acquire) == victim;
+            }
+            if (!valid) {
+                unlock_preds(preds, locked);
+                continue;
+            }
+
+            for (size_t level = victim->level; level-- > 0;) {
+                preds[level]->next(level).store(victim->next(level).load(std::memory_order_relaxed),
+                                                std::memory_order_release);
+            }
+            victim->lock.unlock();
+            unlock_preds(preds, locked);
+            count.fetch_sub(1, std::memory_order_relaxed);
+            domain.retire(victim, &node::destroy_erased);
+            return true;
+        }
+    }
+
+    std::optional<Value> find(const Key& key) const {
+        auto guard = domain.pin();
+        node* preds[MaxLevel];
+        node* succs[MaxLevel];
+        int found = search(key, preds, succs);
+        if (found == -1) return std::nullopt;
+        node* result = succs[found];
+        if (!result->fully_linked.load(std::memory_order_acquire) || result->marked.load(std::memory_order_acquire)) {
+            return std::nullopt;
+        }
+        return result->value;
+    }
+
+    bool exists(const Key& key) const {
+        return find(key).has_value();
+    }
+
+    // The entry with the smallest key greater than `key`.
+    std::optional<std::pair<Key, Value>> next(const Key& key) const {
+        auto guard = domain.pin();
+        node* preds[MaxLevel];
+        node* succs[MaxLevel];
+        search(key, preds, succs);
+        node* current = succs[0];
+        while (current != nullptr && (!(key < current->key) || !live(current))) {
+            current = current->next(0).load(std::memory_order_acquire);
+        }
+        if (current == nullptr) return std::nullopt;
+        return std::pair<Key, Value>(current->key, current->value);
+    }
+
+    // The entry with the largest key less than `key`.
+    std::optional<std::pair<Key, Value>> prev(const Key& key) const {
+        auto guard = domain.pin();
+        node* preds[MaxLevel];
+        node* succs[MaxLevel];
+        while (true) {
+            search(key, preds, succs);
+            node* result = preds[0];
+            if (result == head) return std::nullopt;
+            if (live(result)) return std::pair<Key, Value>(result->key, result->value);
+        }
+    }
+
+    std::optional<std::pair<Key, Value>> get_min() const {
+        auto guard = domain.pin();
+        node* current = head->next(0).load(std::memory_order_acquire);
+        while (current != nullptr && !live(current)) {
+            current = current->next(0).load(std::memory_order_acquire);
+        }
+        if (current == nullptr) return std::nullopt;
+        return std::pair<Key, Value>(current->key, current->value);
+    }
+
+    // Exact when no update is running.
+    size_t size() const {
+        return count.load(std::memory_order_relaxed);
+    }
+
+    // Entries in key order. Exact when no update is running.
+    std::vector<std::pair<Key, Value>> get_traversal() const {
+        auto guard = domain.pin();
+        std::vector<std::pair<Key, Value>> result;
+        for (node* current = head->next(0).load(std::memory_order_acquire); current != nullptr;
+             current = current->next(0).load(std::memory_order_acquire)) {
+            if (live(current)) result.emplace_back(current->key, current->value);
+        }
+        return result;
+    }
+
+private:
+    struct spin_lock {
+        std::atomic<bool> locked{false};
+
+        void lock() {
+            while (locked.exchange(true, std::memory_order_acquire)) {
+                while (locked.load(std::memory_order_relaxed)) std::this_thread::yield();
+            }
+        }
+
+        void unlock() {
+            locked.store(false, std::memory_order_release);
+        }
+    };
+
+    // The `level` forward pointers are allocated right after the node.
+    struct node {
+        Key key;
+        Value value;
+        size_t level;
+        spin_lock lock;
+        std::atomic<bool> marked{false};
+        std::atomic<bool> fully_linked{false};
+
+        node(const Key& key, const Value& value, size_t level) : key(key), value(value), level(level) {}
+
+        std::atomic<node*>& next(size_t i) {
+            return reinterpret_cast<std::atomic<node*>*>(this + 1)[i];
+        }
+
+        static node* create(const Key& key, const Value& value, size_t level) {
+            static_assert(alignof(node) >= alignof(std::atomic<node*>));
+            void* memory = ::operator new(sizeof(node) + level * sizeof(std::atomic<node*>));
+            node* result = new (memory) node(key, value, level);
+            for (size_t i = 0; i < level; ++i) new (&result->next(i)) std::atomic<node*>(nullptr);
+            return result;
+        }
+
+        static void destroy(node* n) {
+            n->~node();
+            ::operator delete(n);
+        }
+
+        static void destroy_erased(void* n) {
+            destroy(static_cast<node*>(n));
+        }
+    };
+
+    static bool live(node* n) {
+        return n->fully_linked.load(std::memory_order_acquire) && !n->marked.load(std::memory_order_acquire);
+    }
+
+    // Fills the predecessors and successors of `key` on every level; returns the highest level
+    // on which a node with this key was found, -1 if there is none.
+    int search(const Key& key, node** preds, node** succs) const {
+        int found = -1;
+        node* pred = head;
+        for (size_t level = MaxLevel; level-- > 0;) {
+            node* current = pred->next(level).load(std::memory_order_acquire);
+            while (current != nullptr && current->key < key) {
+                pred = current;
+                current = pred->next(level).load(std::memory_order_acquire);
+            }
+            if (found == -1 && current != nullptr && !(key < current->key)) found = int(level);
+            preds[level] = pred;
+            succs[level] = current;
+        }
+        return found;
+    }
+
+    // Locks the distinct predecessors of levels [0, levels); returns `levels` for unlock_preds.
+    static size_t lock_preds(node** preds, size_t levels) {
+        for (size_t level = 0; level < levels; ++level) {
+            if (level == 0 || preds[level] != preds[level - 1]) preds[level]->lock.lock();
+        }
+        return levels;
+    }
+
+    static void unlock_preds(node** preds, size_t levels) {
+        for (size_t level = 0; level < levels; ++level) {
+            if (level == 0 || preds[level] != preds[level - 1]) preds[level]->lock.unlock();
+        }
+    }
+
+    // Geometric with p = 1/4, capped at MaxLevel.
+    static size_t random_level() {
+        thread_local std::mt19937_64 generator(std::random_device{}());
+        size_t level = 1 + size_t(std::countr_zero(generator() | (uint64_t(1) << 62))) / 2;
+        return level < MaxLevel ? level : MaxLevel;
+    }
+
+    node* head;
+    std::atomic<size_t> count{0};
+    mutable epoch_domain domain;
+};
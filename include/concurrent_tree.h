@@ -0,0 +1,75 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include "epoch.h"
+
+// Concurrent wrapper around a persistent tree (persistent_treap, persistent_avl). Readers run
+// lock-free against the published version: they pin an epoch, load the current version and
+// never write to the tree. Writers are serialized; each update is applied copy-on-write to a
+// snapshot of the current version, which is then published, and the replaced version (with
+// the nodes only it still references) is reclaimed once the readers that could see it leave.
+//
+// Mutable trees (treap, AVL, rb_tree, splay_tree) update nodes in place and cannot be used.
+template <typename Tree>
+class concurrent_tree {
+    static_assert(Tree::allocator_t::thread_safe, "versions are released from reader and writer threads");
+
+public:
+    using key_t = typename Tree::key_t;
+    using tree_t = Tree;
+
+    explicit concurrent_tree(const Tree& tree = Tree()) : current(new Tree(tree)) {}
+
+    concurrent_tree(const concurrent_tree&) = delete;
+    concurrent_tree& operator=(const concurrent_tree&) = delete;
+
+    ~concurrent_tree() {
+        delete current.load();
+    }
+
+    // Calls f(const Tree&) on the current version. Pointers into the version stay valid only
+    // until f returns; take a snapshot() to keep a version longer.
+    template <typename F>
+    decltype(auto) read(F&& f) const {
+        auto guard = domain.pin();
+        return std::forward<F>(f)(*current.load());
+    }
+
+    Tree snapshot() const {
+        return read([](const Tree& tree) { return tree; });
+    }
+
+    bool exists(const key_t& key) const {
+        return read([&](const Tree& tree) { return tree.exists(key); });
+    }
+
+    size_t size() const {
+        return read([](const Tree& tree) { return tree.size(); });
+    }
+
+    // Calls f(Tree&) on a copy of the current version and publishes the result.
+    template <typename F>
+    void update(F&& f) {
+        std::lock_guard lock(writer_mutex);
+        auto next = std::make_unique<Tree>(*current.load(std::memory_order_relaxed));
+        std::forward<F>(f)(*next);
+        domain.retire(current.exchange(next.release()));
+    }
+
+    template <typename... Args>
+    void insert(const key_t& key, Args&&... args) {
+        update([&](Tree& tree) { tree.insert(key, std::forward<Args>(args)...); });
+    }
+
+    void erase(const key_t& key) {
+        update([&](Tree& tree) { tree.erase(key); });
+    }
+
+private:
+    std::atomic<Tree*> current;
+    mutable epoch_domain domain;
+    std::mutex writer_mutex;
+};
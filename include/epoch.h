@@ -0,0 +1,128 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Epoch-based reclamation. Readers pin the domain for the duration of a read and may use any
+// object they reach while pinned; writers retire objects they have unlinked, and a retired
+// object is destroyed once every reader that was pinned when it was retired has left.
+//
+// A pinned reader publishes the global epoch in a slot of its own (threads start their search
+// at different slots, so readers do not share cache lines); retiring an object tags it with the
+// current epoch and advances it. Pinning never blocks unless more threads than slots are pinned.
+class epoch_domain {
+public:
+    class guard {
+    public:
+        guard(guard&& other) noexcept : slot(other.slot) {
+            other.slot = nullptr;
+        }
+
+        guard(const guard&) = delete;
+        guard& operator=(const guard&) = delete;
+
+        ~guard() {
+            if (slot != nullptr) slot->store(0, std::memory_order_release);
+        }
+
+    private:
+        friend class epoch_domain;
+        explicit guard(std::atomic<uint64_t>* slot) : slot(slot) {}
+
+        std::atomic<uint64_t>* slot;
+    };
+
+    explicit epoch_domain(size_t slot_count = std::max<size_t>(64, 2 * std::thread::hardware_concurrency()))
+        : slot_count(slot_count), slots(new padded_slot[slot_count]) {}
+
+    epoch_domain(const epoch_domain&) = delete;
+    epoch_domain& operator=(const epoch_domain&) = delete;
+
+    // Readers must have left before the domain is destroyed.
+    ~epoch_domain() {
+        for (auto& object : retired) object.destroy(object.pointer);
+    }
+
+    guard pin() {
+        for (size_t i = thread_index() % slot_count;; i = (i + 1) % slot_count) {
+            uint64_t expected = 0;
+            if (slots[i].epoch.compare_exchange_strong(expected, global_epoch.load())) {
+                return guard(&slots[i].epoch);
+            }
+        }
+    }
+
+    // Destroys `object` with `delete` once no pinned reader can still reach it. The object must
+    // already be unreachable for readers that pin from now on. Reclamation is amortized over
+    // batches of retired objects.
+    template <typename T>
+    void retire(T* object) {
+        retire(object, [](void* p) { delete static_cast<T*>(p); });
+    }
+
+    void retire(void* object, void (*destroy)(void*)) {
+        std::lock_guard lock(retired_mutex);
+        retired.push_back({global_epoch.fetch_add(1), object, destroy});
+        if (retired.size() >= next_reclaim) {
+            reclaim_locked();
+            next_reclaim = std::max(reclaim_batch, 2 * retired.size());
+        }
+    }
+
+    // Destroys the retired objects that no pinned reader can reach.
+    void reclaim() {
+        std::lock_guard lock(retired_mutex);
+        reclaim_locked();
+    }
+
+    size_t retired_count() const {
+        std::lock_guard lock(retired_mutex);
+        return retired.size();
+    }
+
+private:
+    struct alignas(64) padded_slot {
+        std::atomic<uint64_t> epoch{0};   // 0 when the slot is free
+    };
+
+    struct retired_object {
+        uint64_t epoch;
+        void* pointer;
+        void (*destroy)(void*);
+    };
+
+    static size_t thread_index() {
+        static std::atomic<size_t> next{0};
+        thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed);
+        return index;
+    }
+
+    void reclaim_locked() {
+        uint64_t oldest = std::numeric_limits<uint64_t>::max();
+        for (size_t i = 0; i < slot_count; ++i) {
+            uint64_t epoch = slots[i].epoch.load();
+            if (epoch != 0) oldest = std::min(oldest, epoch);
+        }
+        auto alive = std::partition(retired.begin(), retired.end(),
+                                    [&](const retired_object& object) { return object.epoch >= oldest; });
+        for (auto it = alive; it != retired.end(); ++it) it->destroy(it->pointer);
+        retired.erase(alive, retired.end());
+    }
+
+    static constexpr size_t reclaim_batch = 64;
+
+    size_t slot_count;
+    std::unique_ptr<padded_slot[]> slots;
+    std::atomic<uint64_t> global_epoch{1};
+
+    mutable std::mutex retired_mutex;
+    std::vector<retired_object> retired;
+    size_t next_reclaim = reclaim_batch;
+};
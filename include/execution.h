@@ -0,0 +1,51 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include "instrumentation.h"
+
+// Work on a subtree is split between at most `threads` threads; subtrees with fewer than
+// `grain_size` nodes are always processed by the calling thread.
+struct execution_policy {
+    size_t threads = 1;
+    size_t grain_size = 1 << 14;
+
+    bool forks(size_t work) const {
+        return threads > 1 && work >= grain_size;
+    }
+};
+
+struct sequential_policy : execution_policy {
+    sequential_policy() : execution_policy{1} {}
+};
+
+struct parallel_policy : execution_policy {
+    explicit parallel_policy(size_t threads = std::max(1u, std::thread::hardware_concurrency()),
+                             size_t grain_size = 1 << 14)
+        : execution_policy{threads, grain_size} {}
+};
+
+// Runs left(policy) and right(policy) for two independent halves of `work` nodes. When the
+// policy allows it, left runs on a new thread and the thread budget is split between the halves.
+template <typename Left, typename Right>
+void fork_join(const execution_policy& policy, size_t work, Left&& left, Right&& right) {
+    if (!policy.forks(work)) {
+        left(policy);
+        right(policy);
+        return;
+    }
+    execution_policy left_policy{policy.threads / 2, policy.grain_size};
+    execution_policy right_policy{policy.threads - policy.threads / 2, policy.grain_size};
+#ifdef SEARCH_TREES_INSTRUMENTATION
+    forked_stats worker_stats;
+    std::thread worker([&] { worker_stats.run([&] { left(left_policy); }); });
+    right(right_policy);
+    worker.join();
+    worker_stats.merge();
+#else
+    std::thread worker([&] { left(left_policy); });
+    right(right_policy);
+    worker.join();
+#endif
+}
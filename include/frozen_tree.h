@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <type_traits>
+#include <vector>
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define SEARCH_TREES_HAS_MMAP 1
+#endif
+
+// Immutable snapshot of a tree for read-mostly workloads. Keys are stored in Eytzinger (BFS)
+// order, so the top levels of every search share a few cache lines and the next levels can be
+// prefetched; the search itself is branchless. Nodes are copied in sorted order with their
+// links cleared, so get_kth and iteration are plain array accesses. Ranks are stored as 32-bit
+// integers, which limits a snapshot to 2^32 nodes.
+//
+// save() writes the three arrays as they are laid out in memory, so map() can answer queries
+// straight from a memory-mapped file without reading or copying it. This needs trivially
+// copyable nodes, and a file can only be used by a build with the same node type and byte order.
+template <typename Node>
+class frozen_tree {
+public:
+    using key_t = typename Node::key_t;
+    using node_t = Node;
+    using iterator = const Node*;
+
+    frozen_tree() = default;
+
+    template <typename Tree>
+    explicit frozen_tree(Tree& tree) {
+        auto data = std::make_shared<buffers>();
+        count = tree.size();
+        data->nodes.reserve(count);
+        for (auto& node : tree) {
+            data->nodes.push_back(node);
+            Node& copy = data->nodes.back();
+            if constexpr (requires { copy.left; }) copy.left = copy.right = nullptr;
+            if constexpr (requires { copy.parent; }) copy.parent = nullptr;
+        }
+        data->keys.resize(count + 1);
+        data->ranks.resize(count + 1);
+        size_t rank = 0;
+        fill(*data, 1, rank);
+        keys = data->keys.data();
+        ranks = data->ranks.data();
+        nodes = data->nodes.data();
+        storage = std::move(data);
+    }
+
+    const Node* find(const key_t& key) const {
+        size_t k = lower_bound_index(key);
+        return k != 0 && !(key < keys[k]) ? nodes + ranks[k] : nullptr;
+    }
+
+    const Node* get_kth(size_t k) const {
+        return k < count ? nodes + k : nullptr;
+    }
+
+    const Node* get_min() const {
+        return get_kth(0);
+    }
+
+    // Number of keys less than `key`.
+    size_t order_of_key(const key_t& key) const {
+        size_t k = lower_bound_index(key);
+        return k != 0 ? ranks[k] : count;
+    }
+
+    const Node* next(const key_t& key) const {
+        size_t k = upper_bound_index(key);
+        return k != 0 ? nodes + ranks[k] : nullptr;
+    }
+
+    const Node* prev(const key_t& key) const {
+        size_t rank = order_of_key(key);
+        return rank != 0 ? nodes + rank - 1 : nullptr;
+    }
+
+    bool exists(const key_t& key) const {
+        return find(key) != nullptr;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    iterator begin() const {
+        return nodes;
+    }
+
+    iterator end() const {
+        return nodes + count;
+    }
+
+    bool save(std::ostream& out) const {
+        static_assert(std::is_trivially_copyable_v<Node>, "nodes are saved as raw bytes");
+        file_header header = make_header(count);
+        write_section(out, &header, sizeof(header), header.keys_offset);
+        write_section(out, keys, (count + 1) * sizeof(key_t), header.ranks_offset - header.keys_offset);
+        write_section(out, ranks, (count + 1) * sizeof(uint32_t), header.nodes_offset - header.ranks_offset);
+        write_section(out, nodes, count * sizeof(Node), count * sizeof(Node));
+        return bool(out);
+    }
+
+    // Reads a snapshot written by save(); returns false, leaving the snapshot empty, if the
+    // stream does not hold one of this node type.
+    bool load(std::istream& in) {
+        static_assert(std::is_trivially_copyable_v<Node>, "nodes are saved as raw bytes");
+        *this = frozen_tree();
+        file_header header;
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!in || !valid(header)) return false;
+        in.ignore(header.keys_offset - sizeof(header));
+
+        auto data = std::make_shared<buffers>();
+        read_section(in, data->keys, header.count + 1, header.ranks_offset - header.keys_offset);
+        read_section(in, data->ranks, header.count + 1, header.nodes_offset - header.ranks_offset);
+        read_section(in, data->nodes, header.count, header.count * sizeof(Node));
+        if (!in) return false;
+        const buffers& arrays = *data;
+        attach(header.count, arrays.keys.data(), arrays.ranks.data(), arrays.nodes.data(), std::move(data));
+        return true;
+    }
+
+#ifdef SEARCH_TREES_HAS_MMAP
+    // Maps a file written by save() read-only; queries read the mapping directly and pages are
+    // loaded on first access. Returns false, leaving the snapshot empty, if the file cannot be
+    // mapped or does not hold a snapshot of this node type.
+    bool map(const char* path) {
+        static_assert(std::is_trivially_copyable_v<Node>, "nodes are saved as raw bytes");
+        *this = frozen_tree();
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+        struct stat info;
+        void* address = MAP_FAILED;
+        if (::fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(file_header)) {
+            address = ::mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (address == MAP_FAILED) return false;
+
+        size_t length = info.st_size;
+        std::shared_ptr<const void> mapping(address, [length](const void* p) { ::munmap(const_cast<void*>(p), length); });
+        const char* base = static_cast<const char*>(address);
+        file_header header;
+        std::memcpy(&header, base, sizeof(header));
+        if (!valid(header) || length < header.nodes_offset + header.count * sizeof(Node)) return false;
+        attach(header.count, reinterpret_cast<const key_t*>(base + header.keys_offset),
+               reinterpret_cast<const uint32_t*>(base + header.ranks_offset),
+               reinterpret_cast<const Node*>(base + header.nodes_offset), std::move(mapping));
+        return true;
+    }
+#endif
+
+private:
+    // Sections start at multiples of 64 bytes, which keeps them aligned inside a mapping.
+    struct file_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t key_size;
+        uint32_t node_size;
+        uint32_t node_align;
+        uint64_t count;
+        uint64_t keys_offset;
+        uint64_t ranks_offset;
+        uint64_t nodes_offset;
+    };
+
+    static constexpr char file_magic[8] = {'S', 'T', 'R', 'E', 'E', 'F', 'R', 'Z'};
+    static constexpr size_t section_align = 64;
+
+    static_assert(alignof(key_t) <= section_align && alignof(Node) <= section_align);
+
+    static uint64_t align_up(uint64_t offset) {
+        return (offset + section_align - 1) / section_align * section_align;
+    }
+
+    static file_header make_header(uint64_t count) {
+        file_header header;
+        std::memcpy(header.magic, file_magic, sizeof(file_magic));
+        header.version = 1;
+        header.key_size = sizeof(key_t);
+        header.node_size = sizeof(Node);
+        header.node_align = alignof(Node);
+        header.count = count;
+        header.keys_offset = align_up(sizeof(file_header));
+        header.ranks_offset = align_up(header.keys_offset + (count + 1) * sizeof(key_t));
+        header.nodes_offset = align_up(header.ranks_offset + (count + 1) * sizeof(uint32_t));
+        return header;
+    }
+
+    static bool valid(const file_header& header) {
+        file_header expected = make_header(header.count);
+        // Ranks are 32-bit, which also keeps the section sizes below from overflowing.
+        return header.count <= UINT32_MAX && std::memcmp(header.magic, file_magic, sizeof(file_magic)) == 0 &&
+               header.version == expected.version && header.key_size == expected.key_size &&
+               header.node_size == expected.node_size && header.node_align == expected.node_align &&
+               header.keys_offset == expected.keys_offset && header.ranks_offset == expected.ranks_offset &&
+               header.nodes_offset == expected.nodes_offset;
+    }
+
+    // Writes `size` bytes of `data` (zeros if there is none) padded with zeros to `length`.
+    static void write_section(std::ostream& out, const void* data, size_t size, size_t length) {
+        if (data != nullptr) out.write(static_cast<const char*>(data), size);
+        else length = std::max(length, size);
+        for (size_t i = data != nullptr ? size : 0; i < length; ++i) out.put(0);
+    }
+
+    // Reads `count` elements into `array` and skips the padding up to `length` bytes. The array
+    // grows with the data actually read, so a corrupted count fails at the end of the stream
+    // instead of being allocated up front.
+    template <typename T>
+    static void read_section(std::istream& in, std::vector<T>& array, uint64_t count, uint64_t length) {
+        constexpr size_t chunk = std::max<size_t>(1, (size_t(1) << 16) / sizeof(T));
+        while (in && array.size() < count) {
+            size_t first = array.size();
+            array.resize(first + std::min<uint64_t>(chunk, count - first));
+            in.read(reinterpret_cast<char*>(array.data() + first), (array.size() - first) * sizeof(T));
+        }
+        if (in) in.ignore(length - count * sizeof(T));
+    }
+
+    void attach(size_t count, const key_t* keys, const uint32_t* ranks, const Node* nodes,
+                std::shared_ptr<const void> storage) {
+        this->count = count;
+        this->keys = keys;
+        this->ranks = ranks;
+        this->nodes = nodes;
+        this->storage = std::move(storage);
+    }
+
+    struct buffers {
+        std::vector<key_t> keys;
+        std::vector<uint32_t> ranks;
+        std::vector<Node> nodes;
+    };
+
+    // In-order walk over the implicit Eytzinger tree rooted at index k.
+    void fill(buffers& data, size_t k, size_t& rank) {
+        if (k > count) return;
+        fill(data, 2 * k, rank);
+        data.keys[k] = data.nodes[rank].key;
+        data.ranks[k] = uint32_t(rank);
+        ++rank;
+        fill(data, 2 * k + 1, rank);
+    }
+
+    // Index of the first key not less than `key`, 0 if there is none.
+    size_t lower_bound_index(const key_t& key) const {
+        size_t k = 1;
+        while (k <= count) {
+            prefetch(k);
+            k = 2 * k + (keys[k] < key);
+        }
+        return k >> (std::countr_one(k) + 1);
+    }
+
+    // Index of the first key greater than `key`, 0 if there is none.
+    size_t upper_bound_index(const key_t& key) const {
+        size_t k = 1;
+        while (k <= count) {
+            prefetch(k);
+            k = 2 * k + !(key < keys[k]);
+        }
+        return k >> (std::countr_one(k) + 1);
+    }
+
+    // The descendants of k four levels down are contiguous: keys[16k .. 16k + 15].
+    void prefetch(size_t k) const {
+#if defined(__GNUC__)
+        __builtin_prefetch(keys + 16 * k);
+#endif
+    }
+
+    size_t count = 0;
+    const key_t* keys = nullptr;   // 1-based, Eytzinger order
+    const uint32_t* ranks = nullptr;
+    const Node* nodes = nullptr;   // sorted
+    std::shared_ptr<const void> storage;
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Operation counters for the tree internals. They are compiled out unless
+// SEARCH_TREES_INSTRUMENTATION is defined, in which case every SEARCH_TREES_RECORD point adds
+// one to the stats of the innermost stats_scope of the calling thread (and calls its hook).
+// The stats follow the thread rather than a tree object because split, merge and the node
+// methods are static: wrap the operations to be measured in a scope over the tree's stats.
+// Threads forked by a parallel policy count into stats of their own, which are added to the
+// forking thread's stats when they join; the hook is then called from those threads too.
+enum class tree_event : uint8_t {
+    rotation,    // a single rotation
+    push,        // a node push() call
+    update,      // a node update() call
+    search,      // a find, get_kth or order_of_key descent
+    visit,       // a node visited by a search
+    split_step,  // a node detached on a split path
+    join_step,   // a level descended by a join or merge
+    splay,       // a splay of a splay_tree
+    splay_step,  // a level of depth moved to the root by a splay
+    allocation,
+    deallocation,
+    count_
+};
+
+struct tree_stats {
+    std::array<uint64_t, static_cast<size_t>(tree_event::count_)> counts{};
+
+    // Optional tracing hook, called after each count with the event and `context`.
+    void (*hook)(tree_event event, void* context) = nullptr;
+    void* context = nullptr;
+
+    uint64_t& operator[](tree_event event) {
+        return counts[static_cast<size_t>(event)];
+    }
+
+    uint64_t operator[](tree_event event) const {
+        return counts[static_cast<size_t>(event)];
+    }
+
+    void reset() {
+        counts.fill(0);
+    }
+};
+
+inline thread_local tree_stats* active_tree_stats = nullptr;
+
+inline void record_tree_event(tree_event event) {
+    tree_stats* stats = active_tree_stats;
+    if (stats == nullptr) return;
+    ++(*stats)[event];
+    if (stats->hook != nullptr) stats->hook(event, stats->context);
+}
+
+#ifdef SEARCH_TREES_INSTRUMENTATION
+#define SEARCH_TREES_RECORD(event) record_tree_event(tree_event::event)
+#else
+#define SEARCH_TREES_RECORD(event) ((void)0)
+#endif
+
+// Directs the events of the current thread to `stats` until the end of the scope. Scopes nest;
+// the outer one gets the events again once the inner one ends.
+class stats_scope {
+public:
+    explicit stats_scope(tree_stats& stats) : previous(active_tree_stats) {
+        active_tree_stats = &stats;
+    }
+
+    stats_scope(const stats_scope&) = delete;
+    stats_scope& operator=(const stats_scope&) = delete;
+
+    ~stats_scope() {
+        active_tree_stats = previous;
+    }
+
+private:
+    tree_stats* previous;
+};
+
+// Counts the events of a forked worker apart from the forking thread and adds them to its stats
+// once the worker has joined. Does nothing if the forking thread is outside every scope.
+class forked_stats {
+public:
+    forked_stats() : parent(active_tree_stats) {
+        if (parent != nullptr) {
+            stats.hook = parent->hook;
+            stats.context = parent->context;
+        }
+    }
+
+    // Runs `f` on the worker thread with its events directed to these stats.
+    template <typename F>
+    void run(F&& f) {
+        if (parent == nullptr) return f();
+        stats_scope scope(stats);
+        f();
+    }
+
+    void merge() {
+        if (parent == nullptr) return;
+        for (size_t i = 0; i < stats.counts.size(); ++i) parent->counts[i] += stats.counts[i];
+    }
+
+private:
+    tree_stats* parent;
+    tree_stats stats;
+};
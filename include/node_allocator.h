@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+#include "instrumentation.h"
+
+template <typename Node>
+struct default_node_allocator {
+    static constexpr bool thread_safe = true;
+
+    template <typename... Args>
+    Node* create(Args&&... args) {
+        SEARCH_TREES_RECORD(allocation);
+        return new Node(std::forward<Args>(args)...);
+    }
+
+    void destroy(Node* node) {
+        SEARCH_TREES_RECORD(deallocation);
+        delete node;
+    }
+
+    void reserve(size_t) {}
+
+    // Nodes are owned individually, so there is nothing to free in bulk.
+    bool release() {
+        return false;
+    }
+};
+
+// Slab arena: nodes are carved out of large blocks and recycled through an intrusive free list.
+template <typename Node, size_t SlabSize = 1024>
+class node_pool {
+public:
+    node_pool() = default;
+    node_pool(const node_pool&) = delete;
+    node_pool& operator=(const node_pool&) = delete;
+
+    ~node_pool() {
+        release();
+    }
+
+    template <typename... Args>
+    Node* create(Args&&... args) {
+        SEARCH_TREES_RECORD(allocation);
+        if (free_list == nullptr) grow(SlabSize);
+        slot* s = free_list;
+        free_list = s->next;
+        return new (s->storage) Node(std::forward<Args>(args)...);
+    }
+
+    void destroy(Node* node) {
+        SEARCH_TREES_RECORD(deallocation);
+        node->~Node();
+        slot* s = reinterpret_cast<slot*>(node);
+        s->next = free_list;
+        free_list = s;
+    }
+
+    // The next `count` nodes will be taken from one contiguous block.
+    void reserve(size_t count) {
+        if (count > 0) grow(count);
+    }
+
+    void release() {
+        slabs.clear();
+        free_list = nullptr;
+    }
+
+private:
+    union slot {
+        slot* next;
+        alignas(Node) unsigned char storage[sizeof(Node)];
+    };
+
+    void grow(size_t count) {
+        slabs.emplace_back(new slot[count]);
+        slot* slab = slabs.back().get();
+        slab[count - 1].next = free_list;
+        for (size_t i = 0; i + 1 < count; ++i) {
+            slab[i].next = &slab[i + 1];
+        }
+        free_list = slab;
+    }
+
+    std::vector<std::unique_ptr<slot[]>> slabs;
+    slot* free_list = nullptr;
+};
+
+// Handle to a shared node_pool. Copies of the handle share the pool, so trees that exchange
+// nodes (split/merge, cut_subsegment) must be constructed with copies of the same allocator.
+// The pool itself is created lazily, so temporary trees that never allocate stay cheap.
+template <typename Node, size_t SlabSize = 1024>
+class pool_node_allocator {
+public:
+    static constexpr bool thread_safe = false;
+
+    pool_node_allocator() = default;
+    pool_node_allocator(const pool_node_allocator& other) : pool(other.get_pool()) {}
+
+    pool_node_allocator& operator=(const pool_node_allocator& other) {
+        pool = other.get_pool();
+        return *this;
+    }
+
+    template <typename... Args>
+    Node* create(Args&&... args) {
+        return get_pool()->create(std::forward<Args>(args)...);
+    }
+
+    void destroy(Node* node) {
+        get_pool()->destroy(node);
+    }
+
+    void reserve(size_t count) {
+        get_pool()->reserve(count);
+    }
+
+    // Frees every slab at once. Only possible when no other allocator shares the pool,
+    // otherwise the caller has to return the nodes one by one.
+    bool release() {
+        if (!pool || pool.use_count() != 1) return false;
+        pool->release();
+        return true;
+    }
+
+private:
+    using pool_t = node_pool<Node, SlabSize>;
+
+    const std::shared_ptr<pool_t>& get_pool() const {
+        if (!pool) pool = std::make_shared<pool_t>();
+        return pool;
+    }
+
+    mutable std::shared_ptr<pool_t> pool;
+};
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <algorithm>
+#include <tuple>
+#include <utility>
+#include "avl.h"
+#include "persistent_tree.h"
+
+// AVL tree with path copying: see persistent_tree. Updates are join-based, so every operation
+// copies O(log n) nodes along the paths it splits and rejoins, unless the current version is
+// their only owner.
+template <typename Node, typename Allocator = default_node_allocator<Node>>
+class persistent_avl : public persistent_tree<persistent_avl<Node, Allocator>, Node, Allocator> {
+    using base = persistent_tree<persistent_avl<Node, Allocator>, Node, Allocator>;
+
+public:
+    using base::base;
+    using key_t = typename base::key_t;
+
+private:
+    friend base;
+
+    Node* rotate_left(Node* pivot) const;
+    Node* rotate_right(Node* pivot) const;
+    Node* balance(Node* node) const;
+    std::pair<Node*, Node*> _remove_min(Node* node) const;
+
+    Node* _merge(Node* left, Node* right) const;
+    Node* _join(Node* left, Node* mid, Node* right) const;
+    std::tuple<Node*, Node*, Node*> _split_key(Node* node, const key_t& key) const;
+    std::pair<Node*, Node*> _split_k(Node* node, size_t k) const;
+};
+
+// The pivot is owned by the caller; its child is copied if it is shared.
+template <typename Node, typename Allocator>
+Node* persistent_avl<Node, Allocator>::rotate_left(Node* pivot) const {
+    SEARCH_TREES_RECORD(rotation);
+    Node* q = this->own(pivot->right);
+    pivot->right = q->left;
+    q->left = pivot;
+    pivot->update();
+    q->update();
+    return q;
+}
+
+template <typename Node, typename Allocator>
+Node* persistent_avl<Node, Allocator>::rotate_right(Node* pivot) const {
+    SEARCH_TREES_RECORD(rotation);
+    Node* q = this->own(pivot->left);
+    pivot->left = q->right;
+    q->right = pivot;
+    pivot->update();
+    q->update();
+    return q;
+}
+
+template <typename Node, typename Allocator>
+Node* persistent_avl<Node, Allocator>::balance(Node* node) const {
+    node->update();
+    if (get_balance(node) == 2) {
+        if (get_balance(node->right) < 0) {
+            node->right = rotate_right(this->own(node->right));
+        }
+        return rotate_left(node);
+    }
+    if (get_balance(node) == -2) {
+        if (get_balance(node->left) > 0) {
+            node->left = rotate_left(this->own(node->left));
+        }
+        return rotate_right(node);
+    }
+    return node;
+}
+
+// Returns (rest, detached minimum).
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> persistent_avl<Node, Allocator>::_remove_min(Node* node) const {
+    node = this->own(node);
+    SEARCH_TREES_RECORD(split_step);
+    if (node->left == nullptr) {
+        Node* right = node->right;
+        node->right = nullptr;
+        node->update();
+        return {right, node};
+    }
+    auto [rest, min] = _remove_min(node->left);
+    node->left = rest;
+    return {balance(node), min};
+}
+
+template <typename Node, typename Allocator>
+Node* persistent_avl<Node, Allocator>::_join(Node* left, Node* mid, Node* right) const {
+    SEARCH_TREES_RECORD(join_step);
+    if (get_height(left) > get_height(right) + 1) {
+        left = this->own(left);
+        left->right = _join(left->right, mid, right);
+        return balance(left);
+    }
+    if (get_height(right) > get_height(left) + 1) {
+        right = this->own(right);
+        right->left = _join(left, mid, right->left);
+        return balance(right);
+    }
+    mid->left = left;
+    mid->right = right;
+    mid->update();
+    return mid;
+}
+
+template <typename Node, typename Allocator>
+Node* persistent_avl<Node, Allocator>::_merge(Node* left, Node* right) const {
+    if (left == nullptr) return right;
+    if (right == nullptr) return left;
+    auto [rest, min] = _remove_min(right);
+    return _join(left, min, rest);
+}
+
+template <typename Node, typename Allocator>
+std::tuple<Node*, Node*, Node*> persistent_avl<Node, Allocator>::_split_key(Node* node, const key_t& key) const {
+    if (node == nullptr) return {nullptr, nullptr, nullptr};
+    node = this->own(node);
+    SEARCH_TREES_RECORD(split_step);
+
+    Node* left = node->left;
+    Node* right = node->right;
+    node->left = node->right = nullptr;
+    node->update();
+
+    if (node->key == key) {
+        return {left, node, right};
+    }
+    if (node->key < key) {
+        auto [less, mid, greater] = _split_key(right, key);
+        return {_join(left, node, less), mid, greater};
+    } else {
+        auto [less, mid, greater] = _split_key(left, key);
+        return {less, mid, _join(greater, node, right)};
+    }
+}
+
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> persistent_avl<Node, Allocator>::_split_k(Node* node, size_t k) const {
+    if (node == nullptr) return {nullptr, nullptr};
+    if (k == 0) return {nullptr, node};
+    if (k >= get_size(node)) return {node, nullptr};
+    node = this->own(node);
+    SEARCH_TREES_RECORD(split_step);
+
+    Node* left = node->left;
+    Node* right = node->right;
+    node->left = node->right = nullptr;
+    node->update();
+
+    size_t left_size = get_size(left);
+    if (left_size < k) {
+        auto [first, rest] = _split_k(right, k - left_size - 1);
+        return {_join(left, node, first), rest};
+    } else {
+        auto [first, rest] = _split_k(left, k);
+        return {first, _join(rest, node, right)};
+    }
+}
+
+template <typename Key, typename Node, typename Size = size_t>
+struct persistent_avl_node_template : public persistent_refcount {
+    using key_t = Key;
+
+    Node* left;
+    Node* right;
+    Size size;
+    [[no_unique_address]] key_t key;
+    unsigned char height;
+
+    persistent_avl_node_template() : left(nullptr), right(nullptr), height(1) {
+        update();
+    }
+    persistent_avl_node_template(const key_t& key)
+        : left(nullptr), right(nullptr), key(key), height(1) {
+        update();
+    }
+
+    void update() {
+        SEARCH_TREES_RECORD(update);
+        height = 1 + std::max(get_height(left), get_height(right));
+        size = 1 + get_size(left) + get_size(right);
+    }
+
+    void push() {
+        SEARCH_TREES_RECORD(push);
+    }
+};
+
+template <typename Key, typename Value>
+using persistent_avl_node = common_node<persistent_avl_node_template, Key, Value>;
+
+template <typename Value>
+using persistent_avl_implicit_node = implicit_node<persistent_avl_node_template, Value>;
+
+template <typename Key>
+using persistent_avl_key_node = key_node<persistent_avl_node_template, Key>;
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <tuple>
+#include <utility>
+#include "persistent_tree.h"
+#include "treap.h"
+
+// Treap with path copying: see persistent_tree. Every update copies the O(log n) nodes on the
+// paths of its splits and merges, unless the current version is their only owner.
+template <typename Node, typename Allocator = default_node_allocator<Node>>
+class persistent_treap : public persistent_tree<persistent_treap<Node, Allocator>, Node, Allocator> {
+    using base = persistent_tree<persistent_treap<Node, Allocator>, Node, Allocator>;
+
+public:
+    using base::base;
+    using key_t = typename base::key_t;
+
+private:
+    friend base;
+
+    Node* _merge(Node* left, Node* right) const;
+    Node* _join(Node* left, Node* mid, Node* right) const;
+    std::tuple<Node*, Node*, Node*> _split_key(Node* node, const key_t& key) const;
+    std::pair<Node*, Node*> _split_k(Node* node, size_t k) const;
+};
+
+template <typename Node, typename Allocator>
+Node* persistent_treap<Node, Allocator>::_merge(Node* left, Node* right) const {
+    if (left == nullptr) return right;
+    if (right == nullptr) return left;
+    SEARCH_TREES_RECORD(join_step);
+
+    if (left->priority > right->priority) {
+        left = this->own(left);
+        left->right = _merge(left->right, right);
+        left->update();
+        return left;
+    } else {
+        right = this->own(right);
+        right->left = _merge(left, right->left);
+        right->update();
+        return right;
+    }
+}
+
+template <typename Node, typename Allocator>
+Node* persistent_treap<Node, Allocator>::_join(Node* left, Node* mid, Node* right) const {
+    return _merge(_merge(left, mid), right);
+}
+
+template <typename Node, typename Allocator>
+std::tuple<Node*, Node*, Node*> persistent_treap<Node, Allocator>::_split_key(Node* node, const key_t& key) const {
+    if (node == nullptr) return {nullptr, nullptr, nullptr};
+    node = this->own(node);
+    SEARCH_TREES_RECORD(split_step);
+
+    if (node->key == key) {
+        Node* left = node->left;
+        Node* right = node->right;
+        node->left = node->right = nullptr;
+        node->update();
+        return {left, node, right};
+    }
+    if (node->key < key) {
+        auto [left, mid, right] = _split_key(node->right, key);
+        node->right = left;
+        node->update();
+        return {node, mid, right};
+    } else {
+        auto [left, mid, right] = _split_key(node->left, key);
+        node->left = right;
+        node->update();
+        return {left, mid, node};
+    }
+}
+
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> persistent_treap<Node, Allocator>::_split_k(Node* node, size_t k) const {
+    if (node == nullptr) return {nullptr, nullptr};
+    if (k == 0) return {nullptr, node};
+    if (k >= get_size(node)) return {node, nullptr};
+    node = this->own(node);
+    SEARCH_TREES_RECORD(split_step);
+
+    size_t left_size = get_size(node->left);
+    if (left_size < k) {
+        auto [left, right] = _split_k(node->right, k - left_size - 1);
+        node->right = left;
+        node->update();
+        return {node, right};
+    } else {
+        auto [left, right] = _split_k(node->left, k);
+        node->left = right;
+        node->update();
+        return {left, node};
+    }
+}
+
+template <typename Key, typename Node, typename Size = size_t, typename Priority = random_priority>
+class persistent_treap_node_template : public persistent_refcount {
+public:
+    using key_t = Key;
+
+    Node* left;
+    Node* right;
+
+    Size size;
+    uint32_t priority;
+    [[no_unique_address]] Key key;
+
+    persistent_treap_node_template() : left(nullptr), right(nullptr), size(1), priority(Priority::next()) {}
+    persistent_treap_node_template(const Key& key)
+        : left(nullptr), right(nullptr), size(1), priority(Priority::next(key)), key(key) {}
+
+    void update() {
+        SEARCH_TREES_RECORD(update);
+        size = 1 + get_size(left) + get_size(right);
+    }
+
+    void push() {
+        SEARCH_TREES_RECORD(push);
+    }
+};
+
+template <typename Key, typename Value>
+using persistent_treap_node = common_node<persistent_treap_node_template, Key, Value>;
+
+template <typename Value>
+using persistent_treap_implicit_node = implicit_node<persistent_treap_node_template, Value>;
+
+template <typename Key>
+using persistent_treap_key_node = key_node<persistent_treap_node_template, Key>;
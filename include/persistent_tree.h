@@ -0,0 +1,270 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <tuple>
+#include <utility>
+#include <vector>
+#include "trees.h"
+
+// Base of the persistent (copy-on-write) trees. A tree object is one version: copying it is an
+// O(1) snapshot that shares every node, and updates copy only the nodes on the paths they
+// change, so other versions never observe them. Nodes are reference counted and returned to
+// the allocator when the last version using them goes away, so versions may be released from
+// different threads as long as the allocator is thread safe.
+//
+// Derived trees implement the structural operations on owned references: every Node* argument
+// passes one reference to the callee and every returned Node* carries one reference back.
+//   _split_key(node, key) -> (less, equal, greater), _split_k(node, k) -> (first k, rest),
+//   _join(left, mid, right) with a detached mid, _merge(left, right).
+// They are private; derived trees befriend this class.
+// Lazy propagation (push) is not supported, since nodes are shared between versions.
+template <typename Tree, typename Node, typename Allocator>
+class persistent_tree {
+public:
+    using key_t = typename Node::key_t;
+    using node_t = Node;
+    using allocator_t = Allocator;
+
+    persistent_tree(const Allocator& allocator = Allocator()) : root(nullptr), allocator(allocator) {}
+
+    persistent_tree(const persistent_tree& other) : root(acquire(other.root)), allocator(other.allocator) {}
+
+    persistent_tree(persistent_tree&& other) noexcept : root(other.root), allocator(other.allocator) {
+        other.root = nullptr;
+    }
+
+    persistent_tree& operator=(const persistent_tree& other) {
+        if (this != &other) {
+            Node* old = root;
+            root = acquire(other.root);
+            allocator = other.allocator;
+            release(old);
+        }
+        return *this;
+    }
+
+    persistent_tree& operator=(persistent_tree&& other) noexcept {
+        std::swap(root, other.root);
+        std::swap(allocator, other.allocator);
+        return *this;
+    }
+
+    ~persistent_tree() {
+        release(root);
+    }
+
+    const Node* get_root() const {
+        return root;
+    }
+
+    const Node* find(const key_t& key) const {
+        const Node* node = root;
+        while (node != nullptr && !(node->key == key)) {
+            node = key < node->key ? node->left : node->right;
+        }
+        return node;
+    }
+
+    bool exists(const key_t& key) const {
+        return find(key) != nullptr;
+    }
+
+    const Node* get_min() const {
+        return get_kth(0);
+    }
+
+    const Node* get_kth(size_t k) const {
+        const Node* node = root;
+        while (node != nullptr) {
+            size_t left_size = get_size(node->left);
+            if (left_size == k) return node;
+            if (left_size > k) {
+                node = node->left;
+            } else {
+                k -= left_size + 1;
+                node = node->right;
+            }
+        }
+        return nullptr;
+    }
+
+    // Number of keys less than `key`.
+    size_t order_of_key(const key_t& key) const {
+        size_t result = 0;
+        for (const Node* node = root; node != nullptr;) {
+            if (node->key < key) {
+                result += get_size(node->left) + 1;
+                node = node->right;
+            } else {
+                node = node->left;
+            }
+        }
+        return result;
+    }
+
+    const Node* next(const key_t& key) const {
+        const Node* result = nullptr;
+        for (const Node* node = root; node != nullptr;) {
+            if (key < node->key) {
+                result = node;
+                node = node->left;
+            } else {
+                node = node->right;
+            }
+        }
+        return result;
+    }
+
+    const Node* prev(const key_t& key) const {
+        const Node* result = nullptr;
+        for (const Node* node = root; node != nullptr;) {
+            if (node->key < key) {
+                result = node;
+                node = node->right;
+            } else {
+                node = node->left;
+            }
+        }
+        return result;
+    }
+
+    size_t size() const {
+        return get_size(root);
+    }
+
+    std::vector<const Node*> get_traversal() const {
+        std::vector<const Node*> result;
+        result.reserve(size());
+        traversal(root, result);
+        return result;
+    }
+
+    Tree snapshot() const {
+        return static_cast<const Tree&>(*this);
+    }
+
+    void clear() {
+        release(root);
+        root = nullptr;
+    }
+
+    // Keys already present keep their node.
+    template <typename... Args>
+    void insert(const key_t& key, Args&&... args) {
+        auto [left, mid, right] = derived()._split_key(root, key);
+        if (mid == nullptr) mid = allocator.create(key, std::forward<Args>(args)...);
+        root = derived()._join(left, mid, right);
+    }
+
+    void erase(const key_t& key) {
+        auto [left, mid, right] = derived()._split_key(root, key);
+        release(mid);
+        root = derived()._merge(left, right);
+    }
+
+    template <typename... Args>
+    void insert_kth(size_t k, Args&&... args) {
+        auto [left, right] = derived()._split_k(root, k);
+        root = derived()._join(left, allocator.create(std::forward<Args>(args)...), right);
+    }
+
+    void erase_kth(size_t k) {
+        auto [left, rest] = derived()._split_k(root, k);
+        auto [mid, right] = derived()._split_k(rest, 1);
+        release(mid);
+        root = derived()._merge(left, right);
+    }
+
+    // The left version gets the keys less than `key`; this version is unchanged.
+    std::pair<Tree, Tree> split(const key_t& key) const {
+        auto [left, mid, right] = derived()._split_key(acquire(root), key);
+        if (mid != nullptr) right = derived()._join(nullptr, mid, right);
+        return {make(left), make(right)};
+    }
+
+    std::pair<Tree, Tree> split_k(size_t k) const {
+        auto [left, right] = derived()._split_k(acquire(root), k);
+        return {make(left), make(right)};
+    }
+
+    // Every key of `left` has to be less than every key of `right`.
+    static Tree merge(const Tree& left, const Tree& right) {
+        Tree result(left.allocator);
+        result.root = result.derived()._merge(acquire(left.root), acquire(right.root));
+        return result;
+    }
+
+    // Removes positions [l, r] from this version and returns them as a version of their own.
+    Tree cut_subsegment(size_t l, size_t r) {
+        auto [left, rest] = derived()._split_k(root, l);
+        auto [mid, right] = derived()._split_k(rest, r - l + 1);
+        root = derived()._merge(left, right);
+        return make(mid);
+    }
+
+    void insert_subsegment(size_t i, const Tree& segment) {
+        auto [left, right] = derived()._split_k(root, i);
+        root = derived()._merge(derived()._merge(left, acquire(segment.root)), right);
+    }
+
+protected:
+    Tree& derived() {
+        return static_cast<Tree&>(*this);
+    }
+
+    const Tree& derived() const {
+        return static_cast<const Tree&>(*this);
+    }
+
+    Tree make(Node* node) const {
+        Tree result(allocator);
+        result.root = node;
+        return result;
+    }
+
+    static Node* acquire(Node* node) {
+        if (node != nullptr) node->refs.fetch_add(1, std::memory_order_relaxed);
+        return node;
+    }
+
+    void release(Node* node) const {
+        while (node != nullptr && node->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            Node* right = node->right;
+            release(node->left);
+            allocator.destroy(node);
+            node = right;
+        }
+    }
+
+    // Returns a node that only the caller references: the node itself when it is not shared,
+    // a copy holding its own references to the children otherwise.
+    Node* own(Node* node) const {
+        if (node->refs.load(std::memory_order_acquire) == 1) return node;
+        Node* copy = allocator.create(*node);
+        acquire(copy->left);
+        acquire(copy->right);
+        release(node);
+        return copy;
+    }
+
+    static void traversal(const Node* node, std::vector<const Node*>& out) {
+        if (node == nullptr) return;
+        traversal(node->left, out);
+        out.push_back(node);
+        traversal(node->right, out);
+    }
+
+    Node* root;
+    [[no_unique_address]] mutable Allocator allocator;
+};
+
+// Reference count shared by the persistent node templates. A copy starts with one reference.
+struct persistent_refcount {
+    std::atomic<uint32_t> refs{1};
+
+    persistent_refcount() = default;
+    persistent_refcount(const persistent_refcount&) {}
+    persistent_refcount& operator=(const persistent_refcount&) = delete;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
+
+// Ready-made policies for implicit_monoid_node.
+
+// Range sum with range add.
+template <typename T>
+struct sum_add_policy {
+    using value_t = T;
+    using summary_t = T;
+    using tag_t = T;
+
+    static summary_t identity() { return T(); }
+    static summary_t summarize(const value_t& value) { return value; }
+    static summary_t combine(const summary_t& left, const summary_t& right) { return left + right; }
+
+    static void apply_value(value_t& value, const tag_t& tag) { value += tag; }
+    static void apply_summary(summary_t& summary, const tag_t& tag, size_t size) { summary += tag * T(size); }
+    static tag_t compose(const tag_t& older, const tag_t& newer) { return older + newer; }
+};
+
+// Range sum with range assignment.
+template <typename T>
+struct sum_assign_policy {
+    using value_t = T;
+    using summary_t = T;
+    using tag_t = T;
+
+    static summary_t identity() { return T(); }
+    static summary_t summarize(const value_t& value) { return value; }
+    static summary_t combine(const summary_t& left, const summary_t& right) { return left + right; }
+
+    static void apply_value(value_t& value, const tag_t& tag) { value = tag; }
+    static void apply_summary(summary_t& summary, const tag_t& tag, size_t size) { summary = tag * T(size); }
+    static tag_t compose(const tag_t&, const tag_t& newer) { return newer; }
+};
+
+// Range minimum with range add.
+template <typename T>
+struct min_add_policy {
+    using value_t = T;
+    using summary_t = T;
+    using tag_t = T;
+
+    static summary_t identity() { return std::numeric_limits<T>::max(); }
+    static summary_t summarize(const value_t& value) { return value; }
+    static summary_t combine(const summary_t& left, const summary_t& right) { return std::min(left, right); }
+
+    static void apply_value(value_t& value, const tag_t& tag) { value += tag; }
+    static void apply_summary(summary_t& summary, const tag_t& tag, size_t) { summary += tag; }
+    static tag_t compose(const tag_t& older, const tag_t& newer) { return older + newer; }
+};
+
+// Range maximum with range add.
+template <typename T>
+struct max_add_policy {
+    using value_t = T;
+    using summary_t = T;
+    using tag_t = T;
+
+    static summary_t identity() { return std::numeric_limits<T>::lowest(); }
+    static summary_t summarize(const value_t& value) { return value; }
+    static summary_t combine(const summary_t& left, const summary_t& right) { return std::max(left, right); }
+
+    static void apply_value(value_t& value, const tag_t& tag) { value += tag; }
+    static void apply_summary(summary_t& summary, const tag_t& tag, size_t) { summary += tag; }
+    static tag_t compose(const tag_t& older, const tag_t& newer) { return older + newer; }
+};
@@ -2,16 +2,116 @@
 
 #include "trees.h"
 
+// In-order iterator that walks parent pointers instead of keeping a stack. Children are pushed
+// on the way down; ancestors of the current node have already been pushed by then.
 template <typename Node>
-class rb_tree : public binary_tree<Node> {
+class rb_tree_iterator {
 public:
-    using key_t = typename binary_tree<Node>::key_t;
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = Node;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Node*;
+    using reference = Node&;
+
+    rb_tree_iterator() = default;
+    rb_tree_iterator(Node* root, Node* node) : root(root), node(node) {}
+
+    reference operator*() const {
+        return *node;
+    }
+
+    pointer operator->() const {
+        return node;
+    }
+
+    rb_tree_iterator& operator++() {
+        if (node->right != nullptr) {
+            node = descend(node->right, &Node::left);
+        } else {
+            node = ascend(node, &Node::right);
+        }
+        return *this;
+    }
+
+    rb_tree_iterator& operator--() {
+        if (node == nullptr) {
+            node = descend(root, &Node::right);
+        } else if (node->left != nullptr) {
+            node = descend(node->left, &Node::right);
+        } else {
+            node = ascend(node, &Node::left);
+        }
+        return *this;
+    }
+
+    rb_tree_iterator operator++(int) {
+        rb_tree_iterator result = *this;
+        ++*this;
+        return result;
+    }
+
+    rb_tree_iterator operator--(int) {
+        rb_tree_iterator result = *this;
+        --*this;
+        return result;
+    }
+
+    bool operator==(const rb_tree_iterator& other) const {
+        return node == other.node;
+    }
+
+    static Node* descend(Node* node, Node* Node::*child) {
+        if (node == nullptr) return nullptr;
+        node->push();
+        while (node->*child != nullptr) {
+            node = node->*child;
+            node->push();
+        }
+        return node;
+    }
+
+private:
+    static Node* ascend(Node* node, Node* Node::*child) {
+        while (node->parent != nullptr && node->parent->*child == node) {
+            node = node->parent;
+        }
+        return node->parent;
+    }
+
+    Node* root = nullptr;
+    Node* node = nullptr;
+};
+
+template <typename Node, typename Allocator = default_node_allocator<Node>>
+class rb_tree : public binary_tree<Node, Allocator>, public join_operations<rb_tree<Node, Allocator>> {
+public:
+    using binary_tree<Node, Allocator>::binary_tree;
+    using key_t = typename binary_tree<Node, Allocator>::key_t;
+    using iterator = rb_tree_iterator<Node>;
+
+    iterator begin();
+    iterator end();
+    iterator lower_bound(const key_t& key);
+    iterator upper_bound(const key_t& key);
+
+    // As in binary_tree, but walking the parent pointers, so no path is kept.
+    template <typename F>
+    void for_each_in_range(const key_t& lo, const key_t& hi, F f);
+    template <typename F>
+    void for_each_kth_range(size_t l, size_t r, F f);
 
     template <typename... Args>
     void insert(const key_t& key, Args&&... args);
     void insert(Node* node);
     void erase(const key_t& key);
 
+    // Inserts next to `hint` (end() stands for the last node): the search climbs the parent
+    // pointers only until the key range of a subtree holds the key, so an insert d positions
+    // away from the hint compares O(log d) keys, and appends to end() compare one.
+    template <typename... Args>
+    void insert(iterator hint, const key_t& key, Args&&... args);
+    void insert(iterator hint, Node* node);
+
     template <typename... Args>
     void insert_kth(size_t k, Args&&... args);
     void insert_kth(size_t k, Node* node);
@@ -27,20 +127,86 @@ public:
     template<typename... Args>
     void push_back(Args&&... args);
 
+    template <typename Iterator>
+    void build_from_sorted(Iterator first, Iterator last, const execution_policy& policy = sequential_policy());
+
 private:
+    friend struct join_algorithms<rb_tree>;
+
+    void _insert_below(Node* start, Node* node);
     void inline rb_insert_fixup(Node* node);
     void inline rotate_left(Node* pivot);
     void inline rotate_right(Node* pivot);
 
     static Node* _merge(Node* left, Node* mid, Node* right);
-    static std::pair<Node*, Node*> _merge_no_fix(Node* left, Node* mid, Node* right);
+    template <bool right_spine>
+    static Node* _join_spine(Node* node, Node* mid, Node* other);
     static std::tuple<Node*, Node*, Node*> _split_k(Node* node, size_t k);
+    static std::tuple<Node*, Node*, Node*> _split_key(Node* node, const key_t& key);
     static inline void clear_vertex(Node* node);
 
 };
 
-template <typename Node>
-void rb_tree<Node>::clear_vertex(Node *node) {
+template <typename Node, typename Allocator>
+typename rb_tree<Node, Allocator>::iterator rb_tree<Node, Allocator>::begin() {
+    return iterator(this->root, iterator::descend(this->root, &Node::left));
+}
+
+template <typename Node, typename Allocator>
+typename rb_tree<Node, Allocator>::iterator rb_tree<Node, Allocator>::end() {
+    return iterator(this->root, nullptr);
+}
+
+template <typename Node, typename Allocator>
+typename rb_tree<Node, Allocator>::iterator rb_tree<Node, Allocator>::lower_bound(const key_t& key) {
+    Node* node = this->root;
+    Node* result = nullptr;
+    while (node != nullptr) {
+        node->push();
+        if (!(node->key < key)) {
+            result = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return iterator(this->root, result);
+}
+
+template <typename Node, typename Allocator>
+typename rb_tree<Node, Allocator>::iterator rb_tree<Node, Allocator>::upper_bound(const key_t& key) {
+    Node* node = this->root;
+    Node* result = nullptr;
+    while (node != nullptr) {
+        node->push();
+        if (key < node->key) {
+            result = node;
+            node = node->left;
+        } else {
+            node = node->right;
+        }
+    }
+    return iterator(this->root, result);
+}
+
+template <typename Node, typename Allocator>
+template <typename F>
+void rb_tree<Node, Allocator>::for_each_in_range(const key_t& lo, const key_t& hi, F f) {
+    this->scan(lower_bound(lo), end(), [&](const Node& node) { return hi < node.key; }, f);
+}
+
+template <typename Node, typename Allocator>
+template <typename F>
+void rb_tree<Node, Allocator>::for_each_kth_range(size_t l, size_t r, F f) {
+    if (l > r) return;
+    this->scan(iterator(this->root, this->get_kth(l)), end(),
+               [count = r - l + 1](const Node&) mutable { return count-- == 0; }, f);
+}
+
+// Leaves the augmented fields of `node` stale: a split joins it back right away, and _merge
+// recomputes them with the new children. The split wrappers refresh the node they return.
+template <typename Node, typename Allocator>
+void rb_tree<Node, Allocator>::clear_vertex(Node *node) {
     if (node == nullptr) return;
     node->push();
     if (node->left) {
@@ -64,19 +230,59 @@ void rb_tree<Node>::clear_vertex(Node *node) {
         node->parent->update();
         node->parent = nullptr;
     }
-    node->update();
 }
 
-template <typename Node>
-void rb_tree<Node>::insert(Node *node) {
+template <typename Node, typename Allocator>
+void rb_tree<Node, Allocator>::insert(Node *node) {
     if (this->root == nullptr) {
         this->root = node;
         this->root->set_black(true);
         return;
     }
-    Node* cur = this->root;
+    this->root->push();
+    _insert_below(this->root, node);
+}
+
+template <typename Node, typename Allocator>
+template <typename... Args>
+void rb_tree<Node, Allocator>::insert(iterator hint, const key_t& key, Args&&... args) {
+    insert(hint, this->allocator.create(key, std::forward<Args>(args)...));
+}
+
+// Climbing through a right child link keeps the upper bound of the key range (a left link the
+// lower bound), so the start of the descent only moves up where the other bound is compared.
+template <typename Node, typename Allocator>
+void rb_tree<Node, Allocator>::insert(iterator hint, Node* node) {
+    if (this->root == nullptr) {
+        insert(node);
+        return;
+    }
+    Node* start = hint == end() ? iterator::descend(this->root, &Node::right) : &*hint;
+    if (!(node->key < start->key)) {
+        for (Node* x = start; x->parent != nullptr; x = x->parent) {
+            if (x == x->parent->left) {
+                if (node->key < x->parent->key) break;
+                start = x->parent;
+            }
+        }
+    } else {
+        for (Node* x = start; x->parent != nullptr; x = x->parent) {
+            if (x == x->parent->right) {
+                if (!(node->key < x->parent->key)) break;
+                start = x->parent;
+            }
+        }
+    }
+    _insert_below(start, node);
+}
+
+// `start` and its ancestors have been pushed (the iterators keep them so).
+template <typename Node, typename Allocator>
+void rb_tree<Node, Allocator>::_insert_below(Node* start, Node* node) {
+    Node* cur = start;
     Node* parent = nullptr;
     while (cur != nullptr) {
+        if (cur != start) cur->push();
         parent = cur;
         if (node->key < cur->key) {
             cur = cur->left;
@@ -92,10 +298,6 @@ void rb_tree<Node>::insert(Node *node) {
         parent->right = node;
     }
 
-    for (Node* n = node; n != nullptr; n = n->parent) {
-        n->update();
-    }
-
     node->set_black(false);
     rb_insert_fixup(node);
 }
@@ -107,104 +309,97 @@ void flip_colors(Node* node) {
     node->flip_color();
 }
 
-template <typename Node>
-void rb_tree<Node>::rb_insert_fixup(Node *node) {
+// Insert fixup. On entry `node` and its ancestors are stale (their subtrees changed) and
+// everything below is up to date; the path has been pushed. Every stale node is updated exactly
+// once, children first: below a colour flip, around the final rotation, or by the closing climb.
+template <typename Node, typename Allocator>
+void rb_tree<Node, Allocator>::rb_insert_fixup(Node *node) {
     while (node != this->root && !node->parent->black) {
-        if (node->parent == node->parent->parent->left) {
-            Node* uncle = node->parent->parent->right;
-            if (uncle != nullptr && !uncle->black) {
-                flip_colors(node->parent->parent);
-                node = node->parent->parent;
-            } else {
-                if (node == node->parent->right) {
-                    node = node->parent;
-                    rotate_left(node);
-                }
-                node->parent->set_black(true);
-                node->parent->parent->set_black(false);
-                rotate_right(node->parent->parent);
-            }
+        Node* parent = node->parent;
+        Node* grandparent = parent->parent;
+        bool parent_is_left = parent == grandparent->left;
+        Node* uncle = parent_is_left ? grandparent->right : grandparent->left;
+        if (uncle != nullptr && !uncle->black) {
+            node->update();
+            parent->update();
+            flip_colors(grandparent);
+            node = grandparent;
+            continue;
+        }
+
+        Node* top;
+        if (parent_is_left == (node == parent->left)) {
+            node->update();
+            top = parent;
         } else {
-            Node* uncle = node->parent->parent->left;
-            if (uncle != nullptr && !uncle->black) {
-                flip_colors(node->parent->parent);
-                node = node->parent->parent;
+            if (parent_is_left) {
+                rotate_left(parent);
             } else {
-                if (node == node->parent->left) {
-                    node = node->parent;
-                    rotate_right(node);
-                }
-                node->parent->set_black(true);
-                node->parent->parent->set_black(false);
-                rotate_left(node->parent->parent);
+                rotate_right(parent);
             }
+            parent->update();
+            top = node;
         }
+        if (parent_is_left) {
+            rotate_right(grandparent);
+        } else {
+            rotate_left(grandparent);
+        }
+        top->set_black(true);
+        grandparent->set_black(false);
+        grandparent->update();
+        top->update();
+        node = top->parent;
+        break;
+    }
+    for (; node != nullptr; node = node->parent) {
+        node->update();
     }
     this->root->set_black(true);
 }
 
-template <typename Node>
-void rb_tree<Node>::rotate_left(Node *pivot) {
+// Rotations only relink; the fixup updates the nodes in order. Callers have pushed them.
+template <typename Node, typename Allocator>
+void rb_tree<Node, Allocator>::rotate_left(Node *pivot) {
+    SEARCH_TREES_RECORD(rotation);
     Node* new_pivot = pivot->right;
     if (this->root == pivot) this->root = new_pivot;
 
     Node* pivot_parent = pivot->parent;
-    bool pivot_is_left = pivot_parent && pivot_parent->left == pivot;
-
-    if (pivot->parent && pivot->parent->parent) pivot->parent->parent->push();
-    if (pivot->parent) pivot->parent->push();
-    pivot->push();
-    new_pivot->push();
-
     pivot->right = new_pivot->left;
     if (new_pivot->left) new_pivot->left->parent = pivot;
     new_pivot->left = pivot;
-    new_pivot->parent = pivot->parent;
+    new_pivot->parent = pivot_parent;
     pivot->parent = new_pivot;
 
-    pivot->update();
-    new_pivot->update();
-
     if (pivot_parent) {
-        if (pivot_is_left) {
+        if (pivot_parent->left == pivot) {
             pivot_parent->left = new_pivot;
         } else {
             pivot_parent->right = new_pivot;
         }
-        pivot_parent->update();
     }
 }
 
-template <typename Node>
-void rb_tree<Node>::rotate_right(Node *pivot) {
+template <typename Node, typename Allocator>
+void rb_tree<Node, Allocator>::rotate_right(Node *pivot) {
+    SEARCH_TREES_RECORD(rotation);
     Node* new_pivot = pivot->left;
     if (this->root == pivot) this->root = new_pivot;
 
     Node* pivot_parent = pivot->parent;
-    bool pivot_is_left = pivot_parent && pivot_parent->left == pivot;
-
-    if (pivot->parent && pivot->parent->parent) pivot->parent->parent->push();
-    if (pivot->parent) pivot->parent->push();
-    pivot->push();
-    new_pivot->push();
-
     pivot->left = new_pivot->right;
     if (new_pivot->right) new_pivot->right->parent = pivot;
-
     new_pivot->right = pivot;
-    new_pivot->parent = pivot->parent;
+    new_pivot->parent = pivot_parent;
     pivot->parent = new_pivot;
 
-    pivot->update();
-    new_pivot->update();
-
     if (pivot_parent) {
-        if (pivot_is_left) {
+        if (pivot_parent->left == pivot) {
             pivot_parent->left = new_pivot;
         } else {
             pivot_parent->right = new_pivot;
         }
-        pivot_parent->update();
     }
 }
 
@@ -217,65 +412,77 @@ bool is_black(Node* node) {
     return node == nullptr || node->black;
 }
 
-template <typename Node>
-std::pair<Node*, Node*> rb_tree<Node>::_merge_no_fix(Node *left, Node *mid, Node *right) {
-    if (mid) mid->push();
-    if (left) left->push();
-    if (right) right->push();
-
-    if (get_black_height(left) == get_black_height(right)) {
-        mid->left = left;
-        mid->right = right;
+// Hangs the red `mid` with `other` on the `inner` spine of the higher tree `node` and repairs
+// red-red edges on the way back up, so every spine node is updated once, children first. A red
+// subtree root left with a red `inner` child is returned stale: its parent rotates and updates it.
+template <typename Node, typename Allocator>
+template <bool right_spine>
+Node* rb_tree<Node, Allocator>::_join_spine(Node* node, Node* mid, Node* other) {
+    constexpr Node* Node::*inner = right_spine ? &Node::right : &Node::left;
+    constexpr Node* Node::*outer = right_spine ? &Node::left : &Node::right;
+    SEARCH_TREES_RECORD(join_step);
+    if (is_black(node) && get_black_height(node) == get_black_height(other)) {
+        mid->*outer = node;
+        mid->*inner = other;
+        if (node) node->parent = mid;
+        if (other) other->parent = mid;
         mid->set_black(false);
-        mid->parent = nullptr;
         mid->update();
-        if (left) left->parent = mid;
-        if (right) right->parent = mid;
-
-        return {mid, mid};
+        return mid;
     }
 
-    if (left) left->push();
-    if (right) right->push();
-
-    bool left_is_higher = get_black_height(left) > get_black_height(right);
-    Node* higher = left_is_higher ? left : right;
-    Node* lower = left_is_higher ? right : left;
-
-    Node* to_fix;
-    if (left_is_higher) {
-        auto [new_higher, fix] = _merge_no_fix(higher->right, mid, lower);
-        higher->right = new_higher;
-        if (new_higher) new_higher->parent = higher;
-        to_fix = fix;
-    } else {
-        auto [new_higher, fix] = _merge_no_fix(lower, mid, higher->left);
-        higher->left = new_higher;
-        if (new_higher) new_higher->parent = higher;
-        to_fix = fix;
+    node->push();
+    Node* child = _join_spine<right_spine>(node->*inner, mid, other);
+    node->*inner = child;
+    child->parent = node;
+    if (!node->black) {
+        if (!child->black) return node;
+        node->update();
+        return node;
+    }
+    if (!child->black && !is_black(child->*inner)) {
+        SEARCH_TREES_RECORD(rotation);
+        node->*inner = child->*outer;
+        if (node->*inner) (node->*inner)->parent = node;
+        child->*outer = node;
+        node->parent = child;
+        (child->*inner)->set_black(true);
+        node->update();
+        child->update();
+        return child;
     }
-    higher->update();
-    return {higher, to_fix};
+    node->update();
+    return node;
 }
 
-template <typename Node>
-Node* rb_tree<Node>::_merge(Node *left, Node *mid, Node *right) {
+// Both roots are made black first, which keeps them valid trees and `other` black; a black root
+// is never left stale by _join_spine.
+template <typename Node, typename Allocator>
+Node* rb_tree<Node, Allocator>::_merge(Node *left, Node *mid, Node *right) {
     if (!mid) {
         if (!left) return right;
         if (!right) return left;
     }
 
-    auto [new_root, to_fix] = _merge_no_fix(left, mid, right);
-    new_root->set_black(true);
-    new_root->update();
-    rb_tree<Node> new_tree = {new_root};
+    mid->push();
+    if (left) {
+        left->push();
+        left->set_black(true);
+    }
+    if (right) {
+        right->push();
+        right->set_black(true);
+    }
 
-    if (to_fix != nullptr && !is_black(to_fix->parent)) new_tree.rb_insert_fixup(to_fix);
-    return new_tree.root;
+    Node* root = get_black_height(left) >= get_black_height(right) ? _join_spine<true>(left, mid, right)
+                                                                    : _join_spine<false>(right, mid, left);
+    root->parent = nullptr;
+    root->set_black(true);
+    return root;
 }
 
-template <typename Node>
-Node* rb_tree<Node>::merge(Node* left, Node* right) {
+template <typename Node, typename Allocator>
+Node* rb_tree<Node, Allocator>::merge(Node* left, Node* right) {
     if (!left) return right;
     if (!right) return left;
 
@@ -283,94 +490,85 @@ Node* rb_tree<Node>::merge(Node* left, Node* right) {
     return _merge(left_part, mid, right);
 }
 
-template <typename Node>
-std::tuple<Node*, Node*, Node*> rb_tree<Node>::_split_k(Node* node, size_t k) {
-    if (!node) return std::make_tuple(nullptr, nullptr, nullptr);
-    node->push();
-    Node* node_left = node->left;
-    Node* node_right = node->right;
-    clear_vertex(node);
-
-    if (get_size(node_left) + 1 == k) {
-        auto res = std::make_tuple(node_left, node, node_right);
-        return res;
-    }
-    if (get_size(node_left) >= k) {
-        auto [left, mid, right] = _split_k(node_left, k);
-
-        return std::make_tuple(left, mid, _merge(right, node, node_right));
-    } else {
-        auto [left, mid, right] = _split_k(node_right, k - get_size(node_left) - 1);
+template <typename Node, typename Allocator>
+std::tuple<Node*, Node*, Node*> rb_tree<Node, Allocator>::_split_k(Node* node, size_t k) {
+    auto result = join_algorithms<rb_tree>::split_k(node, k);
+    if (Node* mid = std::get<1>(result)) mid->update();
+    return result;
+}
 
-        return std::make_tuple(_merge(node_left, node, left), mid, right);
-    }
+template <typename Node, typename Allocator>
+std::tuple<Node*, Node*, Node*> rb_tree<Node, Allocator>::_split_key(Node* node, const key_t& key) {
+    auto result = join_algorithms<rb_tree>::split_key(node, key);
+    if (Node* mid = std::get<1>(result)) mid->update();
+    return result;
 }
 
-template <typename Node>
-std::pair<Node*, Node*> rb_tree<Node>::split_k(Node* node, size_t k) {
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> rb_tree<Node, Allocator>::split_k(Node* node, size_t k) {
     auto [left, mid, right] = _split_k(node, k);
     left = _merge(left, mid, nullptr);
     return {left, right};
 }
 
-template <typename Node>
-std::pair<Node*, Node*> rb_tree<Node>::split(Node* node, const key_t& key) {
-    size_t k = binary_tree<Node>::order_of_key(node, key);
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> rb_tree<Node, Allocator>::split(Node* node, const key_t& key) {
+    size_t k = binary_tree<Node, Allocator>::order_of_key(node, key);
     return split_k(node, k);
 }
 
-template <typename Node>
-void rb_tree<Node>::insert_kth(size_t k, Node *node) {
+template <typename Node, typename Allocator>
+void rb_tree<Node, Allocator>::insert_kth(size_t k, Node *node) {
     auto [left, right] = split_k(this->root, k);
     this->root = _merge(left, node, right);
 }
 
-template <typename Node>
+template <typename Node, typename Allocator>
 template <typename... Args>
-void rb_tree<Node>::insert_kth(size_t k, Args&&... args) {
-    insert_kth(k, new Node(std::forward<Args>(args)...));
+void rb_tree<Node, Allocator>::insert_kth(size_t k, Args&&... args) {
+    insert_kth(k, this->allocator.create(std::forward<Args>(args)...));
 }
 
-template <typename Node>
-Node* rb_tree<Node>::cut_subsegment(size_t l, size_t r) {
+template <typename Node, typename Allocator>
+Node* rb_tree<Node, Allocator>::cut_subsegment(size_t l, size_t r) {
     auto [left, join, right] = _split_k(this->root, l);
     auto [mid, right2] = split_k(right, r - l + 1);
     this->root = _merge(left, join, right2);
     return mid;
 }
 
-template <typename Node>
-void rb_tree<Node>::insert_subsegment(size_t i, Node* t) {
+template <typename Node, typename Allocator>
+void rb_tree<Node, Allocator>::insert_subsegment(size_t i, Node* t) {
     auto [left, join, right] = _split_k(this->root, i);
     this->root = merge(_merge(left, join, t), right);
 }
 
-template <typename Node>
-void rb_tree<Node>::erase_kth(size_t k) {
+template <typename Node, typename Allocator>
+void rb_tree<Node, Allocator>::erase_kth(size_t k) {
     auto [left, mid, right] = _split_k(this->root, k + 1);
-    delete mid;
+    if (mid) this->allocator.destroy(mid);
     this->root = merge(left, right);
 }
 
-template <typename Node>
-void rb_tree<Node>::erase(const key_t &key) {
-    auto [left, mid, right] = _split_k(this->root, binary_tree<Node>::order_of_key(this->root, key) + 1);
-    delete mid;
+template <typename Node, typename Allocator>
+void rb_tree<Node, Allocator>::erase(const key_t &key) {
+    auto [left, mid, right] = _split_key(this->root, key);
+    if (mid) this->allocator.destroy(mid);
     this->root = merge(left, right);
 }
 
 
-template <typename Node>
+template <typename Node, typename Allocator>
 template <typename... Args>
-void rb_tree<Node>::insert(const key_t& key, Args&&... args) {
-    insert(new Node(key, std::forward<Args>(args)...));
+void rb_tree<Node, Allocator>::insert(const key_t& key, Args&&... args) {
+    insert(this->allocator.create(key, std::forward<Args>(args)...));
 }
 
-template <typename Node>
+template <typename Node, typename Allocator>
 template <typename... Args>
-void rb_tree<Node>::push_back(Args&&... args) {
+void rb_tree<Node, Allocator>::push_back(Args&&... args) {
     if (!this->root) {
-        this->root = new Node(std::forward<Args>(args)...);
+        this->root = this->allocator.create(std::forward<Args>(args)...);
         return;
     }
     Node* cur = this->root;
@@ -380,35 +578,47 @@ void rb_tree<Node>::push_back(Args&&... args) {
         prev = cur;
         cur = cur->right;
     }
-    prev->right = new Node(std::forward<Args>(args)...);
+    prev->right = this->allocator.create(std::forward<Args>(args)...);
     prev->right->parent = prev;
     prev->right->set_black(false);
-
-    for (cur = prev->right; cur != nullptr; cur = cur->parent) {
-        cur->update();
-    }
-
-    if (!prev->black) rb_insert_fixup(prev->right);
+    rb_insert_fixup(prev->right);
 }
 
+// Perfectly balanced build: only the deepest level is red, so every path has the same black height.
+template <typename Node, typename Allocator>
+template <typename Iterator>
+void rb_tree<Node, Allocator>::build_from_sorted(Iterator first, Iterator last, const execution_policy& policy) {
+    size_t count = std::distance(first, last);
+    size_t red_depth = 0;
+    while ((size_t(2) << red_depth) <= count) ++red_depth;
+
+    this->build(first, last, policy, [red_depth](Node* node, size_t depth) {
+        if (node->left) node->left->parent = node;
+        if (node->right) node->right->parent = node;
+        node->black = depth != red_depth;
+        node->update();
+    });
+    if (this->root) this->root->set_black(true);
+}
 
-template <typename Key, typename Node>
+// The colour and the black height (at most 2 log n) share one byte after the key.
+template <typename Key, typename Node, typename Size = size_t>
 struct rb_node_template {
     using key_t = Key;
 
-    bool black = true;
-    key_t key;
-    unsigned char black_height = 1;
     Node* left;
     Node* right;
     Node* parent = nullptr;
-    size_t size;
+    Size size;
+    [[no_unique_address]] key_t key;
+    bool black : 1 = true;
+    unsigned char black_height : 7 = 1;
 
     rb_node_template() : left(nullptr), right(nullptr), size(1) {
         update();
     }
     rb_node_template(const key_t& key)
-            : key(key), left(nullptr), right(nullptr), size(1) {
+            : left(nullptr), right(nullptr), size(1), key(key) {
         update();
     }
 
@@ -427,11 +637,14 @@ struct rb_node_template {
     }
 
     void update() {
+        SEARCH_TREES_RECORD(update);
         update_black_height();
         size = 1 + get_size(left) + get_size(right);
     }
 
-    void push() {}
+    void push() {
+        SEARCH_TREES_RECORD(push);
+    }
 };
 
 template <typename Key, typename Value>
@@ -446,3 +659,14 @@ using rb_key_node = key_node<rb_node_template, Key>;
 template <typename Value>
 using rb_implicit_reverse_node = implicit_reverse_node<rb_node_template, Value>;
 
+template <typename Policy>
+using rb_implicit_monoid_node = implicit_monoid_node<rb_node_template, Policy>;
+
+template <typename Key, typename Node>
+using rb_compact_node_template = rb_node_template<Key, Node, uint32_t>;
+
+template <typename Key, typename Value>
+using rb_compact_node = common_node<rb_compact_node_template, Key, Value>;
+
+template <typename Value>
+using rb_compact_implicit_node = implicit_node<rb_compact_node_template, Value>;
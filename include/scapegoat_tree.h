@@ -0,0 +1,346 @@
+#pragma once
+
+#include <tuple>
+#include <vector>
+#include "trees.h"
+#include "wb_tree.h"
+
+// Scapegoat tree: insert and erase never rotate. They walk their path back up and rebuild the
+// highest node that broke the weight_balance invariant into a perfectly balanced subtree.
+// Joins (and so split, merge and the subsegment operations) use weight_balance::join: a
+// rebuild there would cost the size of the whole freshly joined tree.
+template <typename Node, typename Allocator = default_node_allocator<Node>>
+class scapegoat_tree: public binary_tree<Node, Allocator>,
+                      public join_operations<scapegoat_tree<Node, Allocator>> {
+public:
+    using binary_tree<Node, Allocator>::binary_tree;
+    using key_t = typename binary_tree<Node, Allocator>::key_t;
+    using iterator = typename binary_tree<Node, Allocator>::iterator;
+
+    template <typename... Args>
+    void insert(const key_t& key, Args&&... args);
+    void insert(Node* node);
+
+    // Hinted insert. With end() as the hint and a key not less than the largest one, the node
+    // is joined along the right spine without a search; otherwise it is a plain insert.
+    template <typename... Args>
+    void insert(iterator hint, const key_t& key, Args&&... args);
+    void insert(iterator hint, Node* node);
+
+    void erase(const key_t& key);
+
+    template <typename... Args>
+    void insert_kth(size_t k, Args&&... args);
+    void insert_kth(size_t k, Node* node);
+    void erase_kth(size_t k);
+
+    static Node* merge(Node* left, Node* right);
+    static std::pair<Node*, Node*> split(Node* node, const key_t& key);
+    static std::pair<Node*, Node*> split_k(Node* node, size_t k);
+
+    Node* cut_subsegment(size_t l, size_t r);
+    void insert_subsegment(size_t i, Node* t);
+
+    template<typename... Args>
+    void push_back(Args&&... args);
+
+private:
+    friend struct join_algorithms<scapegoat_tree>;
+    using balancing = weight_balance<Node>;
+
+    static Node* rebuild(Node* node);
+    static Node* link_balanced(Node** nodes, size_t count);
+    static void fix_path(path_stack<Node**>& path);
+    static inline void clear_vertex(Node* node);
+
+    Node* _insert(Node* node, Node* parent);
+    Node* _erase(Node* parent, const key_t& key);
+    static std::pair<Node*, Node*> _remove_min(Node* parent);
+
+    static Node* _merge(Node* left, Node* mid, Node* right);
+    static std::tuple<Node*, Node*, Node*> _split_k(Node* node, size_t k);
+    static std::tuple<Node*, Node*, Node*> _split_key(Node* node, const key_t& key);
+};
+
+template <typename Node, typename Allocator>
+void scapegoat_tree<Node, Allocator>::clear_vertex(Node* node) {
+    if (node == nullptr) return;
+    node->left = nullptr;
+    node->right = nullptr;
+    node->update();
+}
+
+template <typename Node, typename Allocator>
+Node* scapegoat_tree<Node, Allocator>::link_balanced(Node** nodes, size_t count) {
+    if (count == 0) return nullptr;
+    size_t mid = count / 2;
+    Node* node = nodes[mid];
+    node->left = link_balanced(nodes, mid);
+    node->right = link_balanced(nodes + mid + 1, count - mid - 1);
+    node->update();
+    return node;
+}
+
+// Relinks the subtree into a perfectly balanced one. Lazy tags are pushed while the nodes are
+// collected in order, so the rebuilt subtree holds the same sequence.
+template <typename Node, typename Allocator>
+Node* scapegoat_tree<Node, Allocator>::rebuild(Node* node) {
+    std::vector<Node*> nodes;
+    nodes.reserve(get_size(node));
+    path_stack<Node*> stack;
+    Node* current = node;
+    while (current != nullptr || !stack.empty()) {
+        while (current != nullptr) {
+            current->push();
+            stack.push(current);
+            current = current->left;
+        }
+        current = stack.pop();
+        nodes.push_back(current);
+        current = current->right;
+    }
+    return link_balanced(nodes.data(), nodes.size());
+}
+
+// Updates the nodes behind `path` bottom-up and rebuilds the highest one that is out of
+// balance; everything below it is rebuilt along with it.
+template <typename Node, typename Allocator>
+void scapegoat_tree<Node, Allocator>::fix_path(path_stack<Node**>& path) {
+    Node** scapegoat = nullptr;
+    while (!path.empty()) {
+        Node** slot = path.pop();
+        (*slot)->update();
+        if (!balancing::is_balanced(*slot)) scapegoat = slot;
+    }
+    if (scapegoat) *scapegoat = rebuild(*scapegoat);
+}
+
+template <typename Node, typename Allocator>
+Node* scapegoat_tree<Node, Allocator>::_insert(Node* node, Node* parent) {
+    path_stack<Node**> path;
+    Node** slot = &parent;
+    while (*slot != nullptr) {
+        Node* current = *slot;
+        current->push();
+        if (node->key == current->key) {
+            this->allocator.destroy(node);
+            return parent;
+        }
+        path.push(slot);
+        slot = node->key < current->key ? &current->left : &current->right;
+    }
+    *slot = node;
+    fix_path(path);
+    return parent;
+}
+
+template <typename Node, typename Allocator>
+template <typename... Args>
+void scapegoat_tree<Node, Allocator>::insert(const key_t& key, Args&&... args) {
+    insert(this->allocator.create(key, std::forward<Args>(args)...));
+}
+
+template <typename Node, typename Allocator>
+void scapegoat_tree<Node, Allocator>::insert(Node* node) {
+    if (!node) return;
+    this->root = _insert(node, this->root);
+}
+
+template <typename Node, typename Allocator>
+template <typename... Args>
+void scapegoat_tree<Node, Allocator>::insert(iterator hint, const key_t& key, Args&&... args) {
+    insert(hint, this->allocator.create(key, std::forward<Args>(args)...));
+}
+
+template <typename Node, typename Allocator>
+void scapegoat_tree<Node, Allocator>::insert(iterator hint, Node* node) {
+    if (hint == this->end()) {
+        Node* last = this->max_in_subtree(this->root);
+        if (last == nullptr || last->key < node->key) {
+            this->root = _merge(this->root, node, nullptr);
+            return;
+        }
+    }
+    insert(node);
+}
+
+// Returns the subtree without its minimum, and the minimum itself.
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> scapegoat_tree<Node, Allocator>::_remove_min(Node* parent) {
+    path_stack<Node**> path;
+    Node** slot = &parent;
+    (*slot)->push();
+    while ((*slot)->left) {
+        path.push(slot);
+        slot = &(*slot)->left;
+        (*slot)->push();
+    }
+    Node* min = *slot;
+    *slot = min->right;
+    fix_path(path);
+    return {parent, min};
+}
+
+template <typename Node, typename Allocator>
+Node* scapegoat_tree<Node, Allocator>::_erase(Node* parent, const key_t& key) {
+    path_stack<Node**> path;
+    Node** slot = &parent;
+    while (*slot != nullptr) {
+        Node* current = *slot;
+        current->push();
+        if (key < current->key) {
+            path.push(slot);
+            slot = &current->left;
+        } else if (key > current->key) {
+            path.push(slot);
+            slot = &current->right;
+        } else {
+            Node* left = current->left;
+            Node* right = current->right;
+            this->allocator.destroy(current);
+            if (!right) {
+                *slot = left;
+            } else {
+                auto [rest, min] = _remove_min(right);
+                min->left = left;
+                min->right = rest;
+                *slot = min;
+                path.push(slot);
+            }
+            break;
+        }
+    }
+    fix_path(path);
+    return parent;
+}
+
+template <typename Node, typename Allocator>
+void scapegoat_tree<Node, Allocator>::erase(const key_t& key) {
+    this->root = _erase(this->root, key);
+}
+
+template <typename Node, typename Allocator>
+Node* scapegoat_tree<Node, Allocator>::_merge(Node *left, Node *mid, Node *right) {
+    return balancing::join(left, mid, right);
+}
+
+template <typename Node, typename Allocator>
+Node* scapegoat_tree<Node, Allocator>::merge(Node* left, Node* right) {
+    if (!left) return right;
+    if (!right) return left;
+
+    auto [left_part, mid] = split_k(left, get_size(left) - 1);
+    return _merge(left_part, mid, right);
+}
+
+template <typename Node, typename Allocator>
+std::tuple<Node*, Node*, Node*> scapegoat_tree<Node, Allocator>::_split_k(Node* node, size_t k) {
+    return join_algorithms<scapegoat_tree>::split_k(node, k);
+}
+
+template <typename Node, typename Allocator>
+std::tuple<Node*, Node*, Node*> scapegoat_tree<Node, Allocator>::_split_key(Node* node, const key_t& key) {
+    return join_algorithms<scapegoat_tree>::split_key(node, key);
+}
+
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> scapegoat_tree<Node, Allocator>::split_k(Node* node, size_t k) {
+    auto [left, mid, right] = _split_k(node, k);
+    left = _merge(left, mid, nullptr);
+    return {left, right};
+}
+
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> scapegoat_tree<Node, Allocator>::split(Node* node, const key_t& key) {
+    size_t k = binary_tree<Node, Allocator>::order_of_key(node, key);
+    return split_k(node, k);
+}
+
+template <typename Node, typename Allocator>
+void scapegoat_tree<Node, Allocator>::insert_kth(size_t k, Node *node) {
+    auto [left, right] = split_k(this->root, k);
+    this->root = _merge(left, node, right);
+}
+
+template <typename Node, typename Allocator>
+template <typename... Args>
+void scapegoat_tree<Node, Allocator>::insert_kth(size_t k, Args&&... args) {
+    insert_kth(k, this->allocator.create(std::forward<Args>(args)...));
+}
+
+template <typename Node, typename Allocator>
+Node* scapegoat_tree<Node, Allocator>::cut_subsegment(size_t l, size_t r) {
+    auto [left, join, right] = _split_k(this->root, l);
+    auto [mid, right2] = split_k(right, r - l + 1);
+    this->root = _merge(left, join, right2);
+    return mid;
+}
+
+template <typename Node, typename Allocator>
+void scapegoat_tree<Node, Allocator>::insert_subsegment(size_t i, Node* t) {
+    auto [left, join, right] = _split_k(this->root, i);
+    this->root = merge(_merge(left, join, t), right);
+}
+
+template <typename Node, typename Allocator>
+void scapegoat_tree<Node, Allocator>::erase_kth(size_t k) {
+    auto [left, mid, right] = _split_k(this->root, k + 1);
+    if (mid) this->allocator.destroy(mid);
+    this->root = merge(left, right);
+}
+
+template <typename Node, typename Allocator>
+template <typename... Args>
+void scapegoat_tree<Node, Allocator>::push_back(Args&&... args) {
+    this->root = _merge(this->root, this->allocator.create(std::forward<Args>(args)...), nullptr);
+}
+
+template <typename Key, typename Node, typename Size = size_t>
+struct scapegoat_node_template {
+    using key_t = Key;
+
+    Node* left;
+    Node* right;
+    Size size;
+    [[no_unique_address]] key_t key;
+
+    scapegoat_node_template() : left(nullptr), right(nullptr) {
+        update();
+    }
+    scapegoat_node_template(const key_t& key) : left(nullptr), right(nullptr), key(key) {
+        update();
+    }
+
+    void update() {
+        SEARCH_TREES_RECORD(update);
+        size = 1 + get_size(left) + get_size(right);
+    }
+
+    void push() {
+        SEARCH_TREES_RECORD(push);
+    }
+};
+
+template <typename Key, typename Value>
+using scapegoat_node = common_node<scapegoat_node_template, Key, Value>;
+
+template <typename Value>
+using scapegoat_implicit_node = implicit_node<scapegoat_node_template, Value>;
+
+template <typename Key>
+using scapegoat_key_node = key_node<scapegoat_node_template, Key>;
+
+template <typename Value>
+using scapegoat_implicit_reverse_node = implicit_reverse_node<scapegoat_node_template, Value>;
+
+template <typename Policy>
+using scapegoat_implicit_monoid_node = implicit_monoid_node<scapegoat_node_template, Policy>;
+
+template <typename Key, typename Node>
+using scapegoat_compact_node_template = scapegoat_node_template<Key, Node, uint32_t>;
+
+template <typename Key, typename Value>
+using scapegoat_compact_node = common_node<scapegoat_compact_node_template, Key, Value>;
+
+template <typename Value>
+using scapegoat_compact_implicit_node = implicit_node<scapegoat_compact_node_template, Value>;
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "trees.h"
+
+// Binary dumps of trees: a header followed by the elements in order ((key, value), key or
+// value, depending on the node), so that load() rebuilds the tree with build_from_sorted in
+// O(n) instead of n inserts. Works with every tree that has in-order iteration and
+// build_from_sorted. Keys and values are stored as raw bytes, so they must be trivially
+// copyable, and a dump can only be read by a build with the same types and byte order.
+
+struct tree_dump_header {
+    char magic[8] = {'S', 'T', 'R', 'E', 'E', 'D', 'M', 'P'};
+    uint32_t version = 1;
+    uint32_t key_size = 0;
+    uint32_t value_size = 0;
+    uint32_t reserved = 0;
+    uint64_t count = 0;
+};
+
+template <typename Node>
+struct node_value {
+    using type = null_type;
+};
+
+template <typename Node>
+    requires requires { &Node::value; }
+struct node_value<Node> {
+    using type = decltype(Node::value);
+};
+
+// The element a node is saved as and rebuilt from.
+template <typename Node>
+struct tree_dump_traits {
+    static constexpr bool has_key = !std::is_same_v<typename Node::key_t, null_type>;
+    static constexpr bool has_value = !std::is_same_v<typename node_value<Node>::type, null_type>;
+
+    using key_t = typename Node::key_t;
+    using value_t = typename node_value<Node>::type;
+    using record_t = std::conditional_t<has_key && has_value, std::pair<key_t, value_t>,
+                                        std::conditional_t<has_key, key_t, value_t>>;
+
+    static_assert(std::is_trivially_copyable_v<key_t> && std::is_trivially_copyable_v<value_t>,
+                  "keys and values are saved as raw bytes");
+
+    static constexpr size_t key_size = has_key ? sizeof(key_t) : 0;
+    static constexpr size_t value_size = has_value ? sizeof(value_t) : 0;
+
+    static void write(char* out, const Node& node) {
+        if constexpr (has_key) std::memcpy(out, &node.key, key_size);
+        if constexpr (has_value) std::memcpy(out + key_size, &node.value, value_size);
+    }
+
+    static void read(const char* in, record_t& record) {
+        if constexpr (has_key && has_value) {
+            std::memcpy(&record.first, in, key_size);
+            std::memcpy(&record.second, in + key_size, value_size);
+        } else if constexpr (has_key) {
+            std::memcpy(&record, in, key_size);
+        } else {
+            std::memcpy(&record, in, value_size);
+        }
+    }
+};
+
+// Elements are staged through a buffer of about this many bytes.
+inline constexpr size_t tree_dump_buffer_size = 1 << 16;
+
+template <typename Tree>
+bool save(Tree& tree, std::ostream& out) {
+    using traits = tree_dump_traits<typename Tree::node_t>;
+    constexpr size_t record_size = traits::key_size + traits::value_size;
+
+    tree_dump_header header;
+    header.key_size = traits::key_size;
+    header.value_size = traits::value_size;
+    header.count = tree.size();
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    std::vector<char> buffer;
+    buffer.reserve(tree_dump_buffer_size + record_size);
+    for (auto& node : tree) {
+        buffer.resize(buffer.size() + record_size);
+        traits::write(buffer.data() + buffer.size() - record_size, node);
+        if (buffer.size() >= tree_dump_buffer_size) {
+            out.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+    out.write(buffer.data(), buffer.size());
+    return bool(out);
+}
+
+// Replaces the content of `tree` with a dump written by save(). Returns false, leaving the tree
+// empty, if the stream does not hold a complete dump of this node type.
+template <typename Tree>
+bool load(Tree& tree, std::istream& in, const execution_policy& policy = sequential_policy()) {
+    using traits = tree_dump_traits<typename Tree::node_t>;
+    constexpr size_t record_size = traits::key_size + traits::value_size;
+
+    tree.clear();
+    tree_dump_header expected, header;
+    in.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!in || std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 ||
+        header.version != expected.version || header.key_size != traits::key_size ||
+        header.value_size != traits::value_size) {
+        return false;
+    }
+
+    // The records grow with the data actually read, so a corrupted count fails at the end of
+    // the stream instead of being allocated up front.
+    std::vector<typename traits::record_t> records;
+    std::vector<char> buffer;
+    const size_t chunk = std::max<size_t>(1, tree_dump_buffer_size / std::max<size_t>(1, record_size));
+    while (records.size() < header.count) {
+        size_t count = std::min<uint64_t>(chunk, header.count - records.size());
+        buffer.resize(count * record_size);
+        in.read(buffer.data(), buffer.size());
+        if (!in) return false;
+        size_t first = records.size();
+        records.resize(first + count);
+        for (size_t j = 0; j < count; ++j) traits::read(buffer.data() + j * record_size, records[first + j]);
+    }
+    tree.build_from_sorted(records.begin(), records.end(), policy);
+    return true;
+}
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include <vector>
+
+// Range-partitioned tree for concurrent writers: the key space is split into N ranges, each
+// held by an independent Tree (treap, AVL, rb_tree, splay_tree) behind its own mutex, so
+// updates of different ranges do not contend. Shard sizes are published separately, which
+// answers the global order_of_key and get_kth without locking every shard.
+//
+// Boundaries are chosen by rebalance(), which moves nodes between neighbouring shards with
+// split_k and merge so that all shards get an equal share; it runs automatically when a shard
+// outgrows the average by half. Equal keys, which treap and splay_tree keep, stay in one shard:
+// a cut inside a run of them moves to the start of the run. Before the first rebalance every
+// key goes to the first shard, unless boundaries are given to the constructor. Rebalancing
+// waits for running operations, everything else only locks the shard of its key.
+//
+// Nodes move between shards, so all shards share copies of one allocator, which has to be
+// thread safe. Nodes may only be accessed inside visit callbacks.
+template <typename Tree, size_t N>
+class sharded_tree {
+    static_assert(N > 0);
+    static_assert(Tree::allocator_t::thread_safe, "shards are updated concurrently through one allocator");
+
+public:
+    using key_t = typename Tree::key_t;
+    using node_t = typename Tree::node_t;
+    using allocator_t = typename Tree::allocator_t;
+
+    explicit sharded_tree(const allocator_t& allocator = allocator_t()) {
+        for (auto& shard : shards) shard.tree.allocator = allocator;
+    }
+
+    // `bounds` holds N - 1 increasing keys; shard i gets the keys in [bounds[i - 1], bounds[i]).
+    explicit sharded_tree(std::vector<key_t> bounds, const allocator_t& allocator = allocator_t())
+        : sharded_tree(allocator) {
+        assert(bounds.size() == N - 1 && std::is_sorted(bounds.begin(), bounds.end()));
+        this->bounds = std::move(bounds);
+    }
+
+    sharded_tree(const sharded_tree&) = delete;
+    sharded_tree& operator=(const sharded_tree&) = delete;
+
+    ~sharded_tree() {
+        for (auto& shard : shards) shard.tree.clear();
+    }
+
+    template <typename... Args>
+    void insert(const key_t& key, Args&&... args) {
+        bool skewed;
+        {
+            std::shared_lock layout(layout_mutex);
+            shard_t& shard = shards[shard_of(key)];
+            std::lock_guard lock(shard.mutex);
+            shard.tree.insert(key, std::forward<Args>(args)...);
+            size_t size = shard.tree.size();
+            shard.size.store(size, std::memory_order_relaxed);
+            skewed = size % check_period == 0 && is_skewed(size);
+        }
+        if (skewed) rebalance();
+    }
+
+    void erase(const key_t& key) {
+        std::shared_lock layout(layout_mutex);
+        shard_t& shard = shards[shard_of(key)];
+        std::lock_guard lock(shard.mutex);
+        shard.tree.erase(key);
+        shard.size.store(shard.tree.size(), std::memory_order_relaxed);
+    }
+
+    bool exists(const key_t& key) const {
+        return visit(key, [](const node_t&) {});
+    }
+
+    // Calls f(node) under the shard lock if the key is present; returns whether it is.
+    template <typename F>
+    bool visit(const key_t& key, F&& f) const {
+        std::shared_lock layout(layout_mutex);
+        shard_t& shard = shards[shard_of(key)];
+        std::lock_guard lock(shard.mutex);
+        node_t* node = shard.tree.find(key);
+        if (node == nullptr) return false;
+        std::forward<F>(f)(*node);
+        return true;
+    }
+
+    // Calls f(node) under the shard lock for the k-th key; returns whether there is one.
+    // Ranks are exact only while no update is running.
+    template <typename F>
+    bool visit_kth(size_t k, F&& f) const {
+        std::shared_lock layout(layout_mutex);
+        size_t i = 0;
+        for (; i + 1 < N; ++i) {
+            size_t size = shards[i].size.load(std::memory_order_relaxed);
+            if (k < size) break;
+            k -= size;
+        }
+        shard_t& shard = shards[i];
+        std::lock_guard lock(shard.mutex);
+        if (k >= shard.tree.size()) return false;
+        std::forward<F>(f)(*shard.tree.get_kth(k));
+        return true;
+    }
+
+    // Number of keys less than `key`; exact only while no update is running.
+    size_t order_of_key(const key_t& key) const {
+        std::shared_lock layout(layout_mutex);
+        size_t i = shard_of(key);
+        size_t result = 0;
+        for (size_t j = 0; j < i; ++j) result += shards[j].size.load(std::memory_order_relaxed);
+        std::lock_guard lock(shards[i].mutex);
+        return result + shards[i].tree.order_of_key(key);
+    }
+
+    size_t size() const {
+        size_t result = 0;
+        for (auto& shard : shards) result += shard.size.load(std::memory_order_relaxed);
+        return result;
+    }
+
+    // Gives every shard an equal share of the keys and moves the boundaries accordingly.
+    void rebalance() {
+        std::unique_lock layout(layout_mutex);
+        size_t total = size();
+        if (total < N) return;
+
+        for (size_t i = 0; i + 1 < N; ++i) {
+            size_t target = (i + 1) * total / N - i * total / N;
+            Tree& tree = shards[i].tree;
+            if (tree.size() > target) {
+                auto [left, right] = Tree::split_k(tree.root, target);
+                tree.root = left;
+                shards[i + 1].tree.root = Tree::merge(right, shards[i + 1].tree.root);
+            }
+            for (size_t j = i + 1; j < N && tree.size() < target; ++j) {
+                Tree& next = shards[j].tree;
+                auto [left, right] = Tree::split_k(next.root, std::min(target - tree.size(), next.size()));
+                next.root = right;
+                tree.root = Tree::merge(tree.root, left);
+            }
+
+            // Keys equal to the first key of the following shards move there with it.
+            size_t j = i + 1;
+            while (j < N && shards[j].tree.root == nullptr) ++j;
+            if (j == N) continue;
+            const key_t& next_min = shards[j].tree.get_min()->key;
+            auto [left, run] = Tree::split_k(tree.root, count_less(tree.root, next_min));
+            tree.root = left;
+            shards[i + 1].tree.root = Tree::merge(run, shards[i + 1].tree.root);
+        }
+
+        // An empty shard gets an empty range; the last shard keeps at least its share.
+        bounds.resize(N - 1);
+        for (size_t i = N; i-- > 0;) {
+            shards[i].size.store(shards[i].tree.size(), std::memory_order_relaxed);
+            if (i == 0) break;
+            node_t* min = shards[i].tree.get_min();
+            assert(min != nullptr || i + 1 < N);
+            bounds[i - 1] = min != nullptr ? min->key : bounds[i];
+        }
+    }
+
+private:
+    // A shard is checked every check_period of its sizes and rebalanced once it holds more than
+    // 1.5 times the average.
+    static constexpr size_t check_period = 1024;
+
+    struct alignas(64) shard_t {
+        std::mutex mutex;
+        Tree tree;
+        std::atomic<size_t> size{0};
+    };
+
+    // Number of keys less than `key`, counting every copy of equal keys.
+    static size_t count_less(node_t* node, const key_t& key) {
+        size_t result = 0;
+        while (node != nullptr) {
+            node->push();
+            if (node->key < key) {
+                result += get_size(node->left) + 1;
+                node = node->right;
+            } else {
+                node = node->left;
+            }
+        }
+        return result;
+    }
+
+    size_t shard_of(const key_t& key) const {
+        return std::upper_bound(bounds.begin(), bounds.end(), key) - bounds.begin();
+    }
+
+    bool is_skewed(size_t shard_size) const {
+        return N > 1 && 2 * N * shard_size > 3 * size();
+    }
+
+    mutable std::array<shard_t, N> shards;
+    std::vector<key_t> bounds;
+    mutable std::shared_mutex layout_mutex;
+};
@@ -1,12 +1,51 @@
 #pragma once
 
+#include <type_traits>
 #include "trees.h"
 
-template <typename Node>
-class splay_tree : public binary_tree<Node> {
+// How reads (find, exists, get_kth, get_min, order_of_key) restructure a splay tree. Updates
+// always splay fully. Full splaying moves every accessed node to the root; semi-splaying
+// (Sleator, Tarjan) only rotates each zig-zig pair once and leaves the node near the root,
+// with about half the rotations; periodic splaying splays on every Period-th read and leaves
+// the tree untouched otherwise. The last two write less on read-heavy, skewed workloads,
+// where the hot nodes are already close to the root.
+struct full_splaying {
+    static constexpr bool semi = false;
+
+    bool due() {
+        return true;
+    }
+};
+
+struct semi_splaying {
+    static constexpr bool semi = true;
+
+    bool due() {
+        return true;
+    }
+};
+
+template <size_t Period>
+struct periodic_splaying {
+    static_assert(Period > 0);
+    static constexpr bool semi = false;
+
+    bool due() {
+        if (++accesses < Period) return false;
+        accesses = 0;
+        return true;
+    }
+
+    size_t accesses = 0;
+};
+
+template <typename Node, typename Allocator = default_node_allocator<Node>, typename Splaying = full_splaying>
+class splay_tree : public binary_tree<Node, Allocator>,
+                   public join_operations<splay_tree<Node, Allocator, Splaying>> {
 
 public:
-    using key_t = typename binary_tree<Node>::key_t;
+    using binary_tree<Node, Allocator>::binary_tree;
+    using key_t = typename binary_tree<Node, Allocator>::key_t;
 
     void splay_kth(size_t k);
     Node* find(const key_t& key);
@@ -35,25 +74,43 @@ public:
     Node* cut_subsegment(size_t l, size_t r);
     void insert_subsegment(size_t i, Node* t);
 
+    // Range operations go through cut_subsegment so that the accessed nodes are splayed.
+    auto query(size_t l, size_t r);
+    template <typename Tag>
+    void apply(size_t l, size_t r, const Tag& tag);
+
 private:
-    static inline Node* rotate_right(Node* pivot, std::vector<Node*>& update_stack);
-    static inline Node* rotate_left(Node* pivot, std::vector<Node*>& update_stack);
-    static inline Node* break_left(Node* v, Node* &l_root, Node* &l, std::vector<Node*>& update_stack);
-    static inline Node* break_right(Node* v, Node* &r_root, Node* &r, std::vector<Node*>& update_stack);
-    static inline void assemble(Node* cur, Node* &l_root, Node* &r_root, Node* &l, Node* &r, std::vector<Node*>& update_stack);
+    friend struct join_algorithms<splay_tree>;
+
+    static Node* _merge(Node* left, Node* mid, Node* right);
+    static std::tuple<Node*, Node*, Node*> _split_key(Node* node, const key_t& key);
+
+    static inline Node* rotate_right(Node* pivot);
+    static inline Node* rotate_left(Node* pivot);
+    static inline Node* break_left(Node* v, Node* &l);
+    static inline Node* break_right(Node* v, Node* &r);
+    static inline Node* assemble(Node* cur, Node* l, Node* r);
+
+    Node* splay_key(const key_t& key);
+    static inline Node* rotate_up(Node* node, Node* child);
+    static void semi_splay(path_stack<Node**>& path);
+
+    [[no_unique_address]] Splaying splaying;
 };
 
-template <typename Node>
-void splay_tree<Node>::splay_kth(size_t k) {
+// Top-down splaying. The nodes split off to the left and right trees are chained bottom-up
+// through their free child pointer (right for the left tree, left for the right tree), so that
+// assemble() can walk each spine from the bottom, restore the pointers and update the nodes in
+// order without any extra memory.
+template <typename Node, typename Allocator, typename Splaying>
+void splay_tree<Node, Allocator, Splaying>::splay_kth(size_t k) {
     if (this->root == nullptr) return;
+    SEARCH_TREES_RECORD(splay);
     Node* cur = this->root;
     if (cur) cur->push();
     size_t cur_index = get_size(cur->left);
-    Node* l_root = nullptr, *r_root = nullptr;
     Node* l = nullptr, *r = nullptr;
 
-    std::vector<Node*> update_stack;
-
     while (cur_index != k) {
         if (cur) cur->push();
         if (k < cur_index) {
@@ -62,15 +119,15 @@ void splay_tree<Node>::splay_kth(size_t k) {
             if (k < cur_index) {
                 if (cur->left->left) cur->left->left->push();
                 cur_index -= get_size(cur->left->left->right) + 1;
-                cur = rotate_right(cur, update_stack);
-                cur = break_right(cur, r_root, r, update_stack);
+                cur = rotate_right(cur);
+                cur = break_right(cur, r);
             } else if (k > cur_index) {
                 if (cur->left->right) cur->left->right->push();
                 cur_index += get_size(cur->left->right->left) + 1;
-                cur = break_right(cur, r_root, r, update_stack);
-                cur = break_left(cur, l_root, l, update_stack);
+                cur = break_right(cur, r);
+                cur = break_left(cur, l);
             } else {
-                cur = break_right(cur, r_root, r, update_stack);
+                cur = break_right(cur, r);
             }
         } else {
             if (cur->right) cur->right->push();
@@ -78,115 +135,193 @@ void splay_tree<Node>::splay_kth(size_t k) {
             if (k < cur_index) {
                 if (cur->right->left) cur->right->left->push();
                 cur_index -= get_size(cur->right->left->right) + 1;
-                cur = break_left(cur, l_root, l, update_stack);
-                cur = break_right(cur, r_root, r, update_stack);
+                cur = break_left(cur, l);
+                cur = break_right(cur, r);
             } else if (cur_index < k) {
                 if (cur->right->right) cur->right->right->push();
                 cur_index += get_size(cur->right->right->left) + 1;
-                cur = rotate_left(cur, update_stack);
-                cur = break_left(cur, l_root, l, update_stack);
+                cur = rotate_left(cur);
+                cur = break_left(cur, l);
             } else {
-                cur = break_left(cur, l_root, l, update_stack);
+                cur = break_left(cur, l);
             }
         }
     }
-    this->root = cur;
-    assemble(cur, l_root, r_root, l, r, update_stack);
-
-    for (auto it = update_stack.rbegin(); it != update_stack.rend(); ++it) {
-        if (*it) (*it)->update();
-    }
-    this->root->update();
+    this->root = assemble(cur, l, r);
 }
 
-template <typename Node>
-Node* splay_tree<Node>::rotate_left(Node *pivot, std::vector<Node*>& update_stack) {
+// The rotated-down pivot is final and updated here; the new pivot is always split off next
+// and updated with its spine.
+template <typename Node, typename Allocator, typename Splaying>
+Node* splay_tree<Node, Allocator, Splaying>::rotate_left(Node *pivot) {
+    SEARCH_TREES_RECORD(rotation);
+    SEARCH_TREES_RECORD(splay_step);
     if (pivot) pivot->push();
     Node* new_pivot = pivot->right;
     if (new_pivot) new_pivot->push();
 
     pivot->right = new_pivot->left;
     new_pivot->left = pivot;
-
-    update_stack.push_back(new_pivot);
-    update_stack.push_back(pivot);
+    pivot->update();
 
     return new_pivot;
 }
 
-template <typename Node>
-Node* splay_tree<Node>::rotate_right(Node *pivot, std::vector<Node*>& update_stack) {
+template <typename Node, typename Allocator, typename Splaying>
+Node* splay_tree<Node, Allocator, Splaying>::rotate_right(Node *pivot) {
+    SEARCH_TREES_RECORD(rotation);
+    SEARCH_TREES_RECORD(splay_step);
     if (pivot) pivot->push();
     Node* new_pivot = pivot->left;
     if (new_pivot) new_pivot->push();
 
     pivot->left = new_pivot->right;
     new_pivot->right = pivot;
-
-    update_stack.push_back(new_pivot);
-    update_stack.push_back(pivot);
+    pivot->update();
 
     return new_pivot;
 }
 
-template <typename Node>
-Node* splay_tree<Node>::break_left(Node* v, Node* &l_root, Node* &l, std::vector<Node*>& update_stack) {
+template <typename Node, typename Allocator, typename Splaying>
+Node* splay_tree<Node, Allocator, Splaying>::break_left(Node* v, Node* &l) {
+    SEARCH_TREES_RECORD(splay_step);
     v->push();
     Node* tmp = v->right;
     if (tmp) tmp->push();
 
-    v->right = nullptr;
-
-    if (!l) l_root = (l = v);
-    else l = (l->right = v);
-
-    update_stack.push_back(v);
+    v->right = l;
+    l = v;
 
     return tmp;
 }
 
-template <typename Node>
-Node* splay_tree<Node>::break_right(Node* v, Node* &r_root, Node* &r, std::vector<Node*>& update_stack) {
+template <typename Node, typename Allocator, typename Splaying>
+Node* splay_tree<Node, Allocator, Splaying>::break_right(Node* v, Node* &r) {
+    SEARCH_TREES_RECORD(splay_step);
     v->push();
     Node* tmp = v->left;
     if (tmp) tmp->push();
-    v->left = nullptr;
-
-    if (!r) r_root = (r = v);
-    else r = (r->left = v);
 
-    update_stack.push_back(v);
+    v->left = r;
+    r = v;
 
     return tmp;
 }
 
-template <typename Node>
-void splay_tree<Node>::assemble(Node* cur, Node* &l_root, Node* &r_root, Node* &l, Node* &r, std::vector<Node*>& update_stack) {
+template <typename Node, typename Allocator, typename Splaying>
+Node* splay_tree<Node, Allocator, Splaying>::assemble(Node* cur, Node* l, Node* r) {
     cur->push();
     if (cur->left) cur->left->push();
     if (cur->right) cur->right->push();
 
-    if (!l_root) l_root = (l = cur->left);
-    else l->right = cur->left;
+    Node* left = cur->left;
+    while (l) {
+        Node* up = l->right;
+        l->right = left;
+        l->update();
+        left = l;
+        l = up;
+    }
 
-    if (!r_root) r_root = (r = cur->right);
-    else r->left = cur->right;
+    Node* right = cur->right;
+    while (r) {
+        Node* up = r->left;
+        r->left = right;
+        r->update();
+        right = r;
+        r = up;
+    }
 
-    cur->left = l_root;
-    cur->right = r_root;
+    cur->left = left;
+    cur->right = right;
+    cur->update();
+    return cur;
+}
 
-    update_stack.push_back(l);
-    update_stack.push_back(r);
-    update_stack.push_back(cur);
+template <typename Node, typename Allocator, typename Splaying>
+Node* splay_tree<Node, Allocator, Splaying>::rotate_up(Node* node, Node* child) {
+    SEARCH_TREES_RECORD(rotation);
+    if (child == node->left) {
+        node->left = child->right;
+        child->right = node;
+    } else {
+        node->right = child->left;
+        child->left = node;
+    }
+    node->update();
+    child->update();
+    return child;
 }
 
-template <typename Node>
-Node* splay_tree<Node>::find(const key_t& key) {
+// Bottom-up semi-splaying along the slots of the access path (the last one holds the accessed
+// node). A zig-zig step rotates the parent over the grandparent and continues from the parent,
+// a zig-zag step is the splay double rotation. The nodes above a step keep their subtrees, so
+// only rotated nodes are updated.
+template <typename Node, typename Allocator, typename Splaying>
+void splay_tree<Node, Allocator, Splaying>::semi_splay(path_stack<Node**>& path) {
+    if (path.empty()) return;
+    SEARCH_TREES_RECORD(splay);
+    Node** slot = path.pop();
+    while (!path.empty()) {
+        Node** parent_slot = path.pop();
+        SEARCH_TREES_RECORD(splay_step);
+        if (path.empty()) {
+            *parent_slot = rotate_up(*parent_slot, *slot);
+            return;
+        }
+        Node** grand_slot = path.pop();
+        SEARCH_TREES_RECORD(splay_step);
+        Node* parent = *parent_slot;
+        Node* grand = *grand_slot;
+        if ((grand->left == parent) == (parent->left == *slot)) {
+            *grand_slot = rotate_up(grand, parent);
+        } else {
+            *parent_slot = rotate_up(parent, *slot);
+            *grand_slot = rotate_up(grand, *parent_slot);
+        }
+        slot = grand_slot;
+    }
+}
+
+template <typename Node, typename Allocator, typename Splaying>
+Node* splay_tree<Node, Allocator, Splaying>::find(const key_t& key) {
     if (!this->root) return nullptr;
+    if (!splaying.due()) return binary_tree<Node, Allocator>::find(key);
+
+    if constexpr (Splaying::semi) {
+        SEARCH_TREES_RECORD(search);
+        path_stack<Node**> path;
+        Node** slot = &this->root;
+        while (Node* cur = *slot) {
+            SEARCH_TREES_RECORD(visit);
+            cur->push();
+            path.push(slot);
+            if (key < cur->key) {
+                if (!cur->left) break;
+                slot = &cur->left;
+            } else if (cur->key < key) {
+                if (!cur->right) break;
+                slot = &cur->right;
+            } else {
+                break;
+            }
+        }
+        Node* cur = *slot;
+        semi_splay(path);
+        return cur->key == key ? cur : nullptr;
+    } else {
+        return splay_key(key);
+    }
+}
 
+// Splays the node with `key`, or the last node on its search path if there is none.
+template <typename Node, typename Allocator, typename Splaying>
+Node* splay_tree<Node, Allocator, Splaying>::splay_key(const key_t& key) {
+    SEARCH_TREES_RECORD(search);
     Node* cur = this->root;
     size_t cur_index = get_size(cur->left);
     while (cur) {
+        SEARCH_TREES_RECORD(visit);
         cur->push();
         if (key < cur->key) {
             if (cur->left) cur_index -= get_size(cur->left->right) + 1;
@@ -203,36 +338,61 @@ Node* splay_tree<Node>::find(const key_t& key) {
     return cur;
 }
 
-template <typename Node>
-bool splay_tree<Node>::exists(const key_t& key) {
+template <typename Node, typename Allocator, typename Splaying>
+bool splay_tree<Node, Allocator, Splaying>::exists(const key_t& key) {
     return find(key) != nullptr;
 }
 
-template <typename Node>
-Node* splay_tree<Node>::get_kth(size_t k) {
-    splay_kth(k);
-    return this->root;
+template <typename Node, typename Allocator, typename Splaying>
+Node* splay_tree<Node, Allocator, Splaying>::get_kth(size_t k) {
+    if (!splaying.due()) return binary_tree<Node, Allocator>::get_kth(k);
+
+    if constexpr (Splaying::semi) {
+        SEARCH_TREES_RECORD(search);
+        path_stack<Node**> path;
+        Node** slot = &this->root;
+        while (Node* cur = *slot) {
+            SEARCH_TREES_RECORD(visit);
+            cur->push();
+            path.push(slot);
+            size_t left_size = get_size(cur->left);
+            if (left_size == k) {
+                semi_splay(path);
+                return cur;
+            }
+            if (left_size > k) {
+                slot = &cur->left;
+            } else {
+                k -= left_size + 1;
+                slot = &cur->right;
+            }
+        }
+        return nullptr;
+    } else {
+        SEARCH_TREES_RECORD(search);
+        splay_kth(k);
+        return this->root;
+    }
 }
 
-template <typename Node>
-Node* splay_tree<Node>::get_min() {
-    splay_kth(0);
-    return this->root;
+template <typename Node, typename Allocator, typename Splaying>
+Node* splay_tree<Node, Allocator, Splaying>::get_min() {
+    return get_kth(0);
 }
 
-template <typename Node>
-size_t splay_tree<Node>::order_of_key(const key_t& key) {
+template <typename Node, typename Allocator, typename Splaying>
+size_t splay_tree<Node, Allocator, Splaying>::order_of_key(const key_t& key) {
     if (!this->root) return 0;
     find(key);
-    return binary_tree<Node>::order_of_key(this->root, key);
+    return binary_tree<Node, Allocator>::order_of_key(this->root, key);
 }
 
-template <typename Node>
-Node* splay_tree<Node>::merge(Node *left, Node *right) {
+template <typename Node, typename Allocator, typename Splaying>
+Node* splay_tree<Node, Allocator, Splaying>::merge(Node *left, Node *right) {
     if (!left) return right;
     if (!right) return left;
 
-    auto tree = splay_tree<Node> {left};
+    auto tree = splay_tree {left};
     tree.splay_kth(get_size(left) - 1);
     left = tree.root;
     left->right = right;
@@ -241,12 +401,12 @@ Node* splay_tree<Node>::merge(Node *left, Node *right) {
     return left;
 }
 
-template <typename Node>
-std::pair<Node*, Node*> splay_tree<Node>::split(Node* root, const key_t& key) {
+template <typename Node, typename Allocator, typename Splaying>
+std::pair<Node*, Node*> splay_tree<Node, Allocator, Splaying>::split(Node* root, const key_t& key) {
     if (!root) return {nullptr, nullptr};
-    splay_tree<Node> tree {root};
+    splay_tree tree {root};
 
-    size_t order = binary_tree<Node>::order_of_key(root, key);
+    size_t order = binary_tree<Node, Allocator>::order_of_key(root, key);
     if (order < tree.size()) tree.splay_kth(order);
     else return {root, nullptr};
 
@@ -257,12 +417,33 @@ std::pair<Node*, Node*> splay_tree<Node>::split(Node* root, const key_t& key) {
     return {left, tree.root};
 }
 
-template <typename Node>
-std::pair<Node*, Node*> splay_tree<Node>::split_k(Node *root, size_t k) {
+template <typename Node, typename Allocator, typename Splaying>
+Node* splay_tree<Node, Allocator, Splaying>::_merge(Node* left, Node* mid, Node* right) {
+    if (!mid) return merge(left, right);
+    mid->left = left;
+    mid->right = right;
+    mid->update();
+    return mid;
+}
+
+template <typename Node, typename Allocator, typename Splaying>
+std::tuple<Node*, Node*, Node*> splay_tree<Node, Allocator, Splaying>::_split_key(Node* root, const key_t& key) {
+    auto [left, right] = split(root, key);
+    if (!right || right->key != key) return std::make_tuple(left, nullptr, right);
+
+    Node* mid = right;
+    right = mid->right;
+    mid->right = nullptr;
+    mid->update();
+    return std::make_tuple(left, mid, right);
+}
+
+template <typename Node, typename Allocator, typename Splaying>
+std::pair<Node*, Node*> splay_tree<Node, Allocator, Splaying>::split_k(Node *root, size_t k) {
     if (k == 0) return {nullptr, root};
     if (k == get_size(root)) return {root, nullptr};
 
-    splay_tree<Node> tree {root};
+    splay_tree tree {root};
     tree.splay_kth(k);
     Node* left = tree.root->left;
     tree.root->left = nullptr;
@@ -271,8 +452,8 @@ std::pair<Node*, Node*> splay_tree<Node>::split_k(Node *root, size_t k) {
     return {left, tree.root};
 }
 
-template <typename Node>
-void splay_tree<Node>::insert(Node* node) {
+template <typename Node, typename Allocator, typename Splaying>
+void splay_tree<Node, Allocator, Splaying>::insert(Node* node) {
     auto [left, right] = split(this->root, node->key);
     node->left = left;
     node->right = right;
@@ -280,71 +461,90 @@ void splay_tree<Node>::insert(Node* node) {
     this->root = node;
 }
 
-template<typename Node>
+template <typename Node, typename Allocator, typename Splaying>
 template<typename... Args>
-void splay_tree<Node>::insert(const key_t &key, Args &&...args) {
-    insert(new Node(key, std::forward<Args>(args)...));
+void splay_tree<Node, Allocator, Splaying>::insert(const key_t &key, Args &&...args) {
+    insert(this->allocator.create(key, std::forward<Args>(args)...));
 }
 
-template <typename Node>
-void splay_tree<Node>::erase(const key_t& key) {
-    find(key);
+template <typename Node, typename Allocator, typename Splaying>
+void splay_tree<Node, Allocator, Splaying>::erase(const key_t& key) {
+    if (!this->root || !splay_key(key)) return;
     Node* mid = this->root;
     this->root = merge(this->root->left, this->root->right);
-    delete mid;
+    this->allocator.destroy(mid);
 }
 
-template <typename Node>
-void splay_tree<Node>::erase_kth(size_t k) {
+template <typename Node, typename Allocator, typename Splaying>
+void splay_tree<Node, Allocator, Splaying>::erase_kth(size_t k) {
     splay_kth(k);
     Node* mid = this->root;
     this->root = merge(this->root->left, this->root->right);
-    delete mid;
+    this->allocator.destroy(mid);
 }
 
-template <typename Node>
-void splay_tree<Node>::insert_kth(size_t k, Node *node) {
+template <typename Node, typename Allocator, typename Splaying>
+void splay_tree<Node, Allocator, Splaying>::insert_kth(size_t k, Node *node) {
     auto [left, right] = split_k(this->root, k);
     this->root = merge(merge(left, node), right);
 }
 
-template <typename Node>
+template <typename Node, typename Allocator, typename Splaying>
 template<typename... Args>
-void splay_tree<Node>::insert_kth(size_t k, Args &&...args) {
-    insert_kth(k, new Node(std::forward<Args>(args)...));
+void splay_tree<Node, Allocator, Splaying>::insert_kth(size_t k, Args &&...args) {
+    insert_kth(k, this->allocator.create(std::forward<Args>(args)...));
 }
 
-template <typename Node>
-Node* splay_tree<Node>::cut_subsegment(size_t l, size_t r) {
+template <typename Node, typename Allocator, typename Splaying>
+Node* splay_tree<Node, Allocator, Splaying>::cut_subsegment(size_t l, size_t r) {
     auto [left, right] = split_k(this->root, r + 1);
     auto [left2, right2] = split_k(left, l);
     this->root = merge(left2, right);
     return right2;
 }
 
-template <typename Node>
-void splay_tree<Node>::insert_subsegment(size_t i, Node* t) {
+template <typename Node, typename Allocator, typename Splaying>
+void splay_tree<Node, Allocator, Splaying>::insert_subsegment(size_t i, Node* t) {
     auto [left, right] = split_k(this->root, i);
     this->root = merge(merge(left, t), right);
 }
 
-template <typename Key, typename Node>
+template <typename Node, typename Allocator, typename Splaying>
+auto splay_tree<Node, Allocator, Splaying>::query(size_t l, size_t r) {
+    Node* segment = cut_subsegment(l, r);
+    auto result = segment ? segment->summary : Node::policy_t::identity();
+    insert_subsegment(l, segment);
+    return result;
+}
+
+template <typename Node, typename Allocator, typename Splaying>
+template <typename Tag>
+void splay_tree<Node, Allocator, Splaying>::apply(size_t l, size_t r, const Tag& tag) {
+    Node* segment = cut_subsegment(l, r);
+    if (segment) segment->apply(tag);
+    insert_subsegment(l, segment);
+}
+
+template <typename Key, typename Node, typename Size = size_t>
 struct splay_node_template {
     using key_t = Key;
 
-    [[no_unique_address]] key_t key;
     Node* left;
     Node* right;
-    size_t size;
+    Size size;
+    [[no_unique_address]] key_t key;
 
     splay_node_template() : left(nullptr), right(nullptr), size(1) {}
-    splay_node_template(const key_t& key) : key(key), left(nullptr), right(nullptr), size(1) {}
+    splay_node_template(const key_t& key) : left(nullptr), right(nullptr), size(1), key(key) {}
 
     void update() {
+        SEARCH_TREES_RECORD(update);
         size = 1 + get_size(left) + get_size(right);
     }
 
-    void push() {}
+    void push() {
+        SEARCH_TREES_RECORD(push);
+    }
 };
 
 template <typename Key, typename Value>
@@ -358,3 +558,15 @@ using splay_key_node = key_node<splay_node_template, Key>;
 
 template <typename Value>
 using splay_implicit_reverse_node = implicit_reverse_node<splay_node_template, Value>;
+
+template <typename Policy>
+using splay_implicit_monoid_node = implicit_monoid_node<splay_node_template, Policy>;
+
+template <typename Key, typename Node>
+using splay_compact_node_template = splay_node_template<Key, Node, uint32_t>;
+
+template <typename Key, typename Value>
+using splay_compact_node = common_node<splay_compact_node_template, Key, Value>;
+
+template <typename Value>
+using splay_compact_implicit_node = implicit_node<splay_compact_node_template, Value>;
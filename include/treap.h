@@ -1,17 +1,30 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <random>
+#include <tuple>
 #include "trees.h"
 
-template <typename Node>
-class treap : public binary_tree<Node> {
+template <typename Node, typename Allocator = default_node_allocator<Node>>
+class treap : public binary_tree<Node, Allocator>, public join_operations<treap<Node, Allocator>> {
 public:
-    using key_t = typename binary_tree<Node>::key_t;
+    using binary_tree<Node, Allocator>::binary_tree;
+    using key_t = typename binary_tree<Node, Allocator>::key_t;
+    using iterator = typename binary_tree<Node, Allocator>::iterator;
 
     template <typename... Args>
     void insert(const key_t& key, Args&&... args);
     void insert(Node* node);
 
+    // Inserts next to `hint` (end() stands for the last node). With end() as the hint, a key
+    // not less than the largest one is joined along the right spine; otherwise the search starts from
+    // the lowest node on the hint's root path whose subtree spans the key, so an insert d
+    // positions away from the hint compares O(log d) keys. The sizes are still updated up to the root.
+    template <typename... Args>
+    void insert(iterator hint, const key_t& key, Args&&... args);
+    void insert(iterator hint, Node* node);
+
     void erase(const key_t& key);
     void erase_kth(size_t k);
 
@@ -25,143 +38,367 @@ public:
 
     Node* cut_subsegment(size_t l, size_t r);
     void insert_subsegment(size_t i, Node* t);
+
+    template <typename Iterator>
+    void build_from_sorted(Iterator first, Iterator last, const execution_policy& policy = sequential_policy());
+
+private:
+    friend struct join_algorithms<treap>;
+
+    static Node* _merge(Node* left, Node* mid, Node* right);
+    static std::tuple<Node*, Node*, Node*> _split_key(Node* node, const key_t& key);
 };
 
-template <typename Node>
-std::pair<Node*, Node*> treap<Node>::split(Node* node, const key_t& key) {
-    if (node == nullptr) {
-        return {nullptr, nullptr};
-    }
-    node->push();
-    if (node->key < key) {
-        auto [left, right] = split(node->right, key);
-        node->right = left;
-        node->update();
-        return {node, right};
-    } else {
-        auto [left, right] = split(node->left, key);
-        node->left = right;
-        node->update();
-        return {left, node};
+// Split and merge run top-down: the nodes are linked into the slots (child pointers) of the
+// pieces on the way down, and the sizes of the visited nodes are updated afterwards, deepest
+// first, so neither recursion nor temporary pairs are needed.
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> treap<Node, Allocator>::split(Node* node, const key_t& key) {
+    Node* left = nullptr;
+    Node* right = nullptr;
+    Node** left_slot = &left;
+    Node** right_slot = &right;
+    path_stack<Node*> path;
+    while (node != nullptr) {
+        SEARCH_TREES_RECORD(split_step);
+        node->push();
+        path.push(node);
+        if (node->key < key) {
+            *left_slot = node;
+            left_slot = &node->right;
+            node = node->right;
+        } else {
+            *right_slot = node;
+            right_slot = &node->left;
+            node = node->left;
+        }
     }
+    *left_slot = nullptr;
+    *right_slot = nullptr;
+    while (!path.empty()) path.pop()->update();
+    return {left, right};
 }
 
-template <typename Node>
-std::pair<Node*, Node*> treap<Node>::split_k(Node* node, size_t k) {
-    if (node == nullptr) return {nullptr, nullptr};
-    node->push();
-
-    if (k == 0) return {nullptr, node};
-    if (k == get_size(node)) return {node, nullptr};
-
-    size_t left_size = get_size(node->left);
-    if (left_size >= k) {
-        auto [left, right] = split_k(node->left, k);
-        node->left = right;
-        node->update();
-        return {left, node};
-    } else {
-        auto [left, right] = split_k(node->right, k - left_size - 1);
-        node->right = left;
-        node->update();
-        return {node, right};
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> treap<Node, Allocator>::split_k(Node* node, size_t k) {
+    Node* left = nullptr;
+    Node* right = nullptr;
+    Node** left_slot = &left;
+    Node** right_slot = &right;
+    path_stack<Node*> path;
+    while (node != nullptr) {
+        SEARCH_TREES_RECORD(split_step);
+        node->push();
+        if (k == 0 || k == get_size(node)) break;
+        path.push(node);
+        size_t left_size = get_size(node->left);
+        if (left_size >= k) {
+            *right_slot = node;
+            right_slot = &node->left;
+            node = node->left;
+        } else {
+            k -= left_size + 1;
+            *left_slot = node;
+            left_slot = &node->right;
+            node = node->right;
+        }
     }
+    // The subtree where the split stopped falls entirely on one side.
+    *left_slot = k == 0 ? nullptr : node;
+    *right_slot = k == 0 ? node : nullptr;
+    while (!path.empty()) path.pop()->update();
+    return {left, right};
 }
 
-template <typename Node>
-Node* treap<Node>::merge(Node* left, Node* right) {
-    if (left == nullptr) return right;
-    if (right == nullptr) return left;
+template <typename Node, typename Allocator>
+Node* treap<Node, Allocator>::merge(Node* left, Node* right) {
+    Node* root = nullptr;
+    Node** slot = &root;
+    path_stack<Node*> path;
+    while (left != nullptr && right != nullptr) {
+        SEARCH_TREES_RECORD(join_step);
+        right->push();
+        left->push();
+        if (left->priority > right->priority) {
+            path.push(left);
+            *slot = left;
+            slot = &left->right;
+            left = left->right;
+        } else {
+            path.push(right);
+            *slot = right;
+            slot = &right->left;
+            right = right->left;
+        }
+    }
+    *slot = left != nullptr ? left : right;
+    while (!path.empty()) path.pop()->update();
+    return root;
+}
 
-    right->push();
-    left->push();
+template <typename Node, typename Allocator>
+Node* treap<Node, Allocator>::_merge(Node* left, Node* mid, Node* right) {
+    return merge(merge(left, mid), right);
+}
 
-    if (left->priority > right->priority) {
-        left->right = merge(left->right, right);
-        left->update();
-        return left;
-    } else {
-        right->left = merge(left, right->left);
-        right->update();
-        return right;
+template <typename Node, typename Allocator>
+std::tuple<Node*, Node*, Node*> treap<Node, Allocator>::_split_key(Node* node, const key_t& key) {
+    Node* left = nullptr;
+    Node* mid = nullptr;
+    Node* right = nullptr;
+    Node** left_slot = &left;
+    Node** right_slot = &right;
+    path_stack<Node*> path;
+    while (node != nullptr) {
+        SEARCH_TREES_RECORD(split_step);
+        node->push();
+        if (node->key < key) {
+            path.push(node);
+            *left_slot = node;
+            left_slot = &node->right;
+            node = node->right;
+        } else if (key < node->key) {
+            path.push(node);
+            *right_slot = node;
+            right_slot = &node->left;
+            node = node->left;
+        } else {
+            mid = node;
+            *left_slot = node->left;
+            *right_slot = node->right;
+            node->left = nullptr;
+            node->right = nullptr;
+            node->update();
+            break;
+        }
+    }
+    if (mid == nullptr) {
+        *left_slot = nullptr;
+        *right_slot = nullptr;
     }
+    while (!path.empty()) path.pop()->update();
+    return std::make_tuple(left, mid, right);
 }
 
-template <typename Node>
-Node* treap<Node>::cut_subsegment(size_t l, size_t r) {
+template <typename Node, typename Allocator>
+Node* treap<Node, Allocator>::cut_subsegment(size_t l, size_t r) {
     auto [left, right] = split_k(this->root, r + 1);
     auto [left2, right2] = split_k(left, l);
     this->root = merge(left2, right);
     return right2;
 }
 
-template <typename Node>
-void treap<Node>::insert_subsegment(size_t i, Node* t) {
+template <typename Node, typename Allocator>
+void treap<Node, Allocator>::insert_subsegment(size_t i, Node* t) {
     auto [left, right] = split_k(this->root, i);
     this->root = merge(merge(left, t), right);
 }
 
-template <typename Node>
+template <typename Node, typename Allocator>
 template <typename... Args>
-void treap<Node>::insert(const key_t& key, Args&&... args) {
-    insert(new Node(key, std::forward<Args>(args)...));
+void treap<Node, Allocator>::insert(const key_t& key, Args&&... args) {
+    insert(this->allocator.create(key, std::forward<Args>(args)...));
 }
 
-template <typename Node>
-void treap<Node>::insert(Node* node) {
+template <typename Node, typename Allocator>
+void treap<Node, Allocator>::insert(Node* node) {
     auto [left, right] = split(this->root, node->key);
     this->root = merge(merge(left, node), right);
 }
 
-template <typename Node>
-void treap<Node>::erase(const key_t& key) {
-    auto [left, right] = split(this->root, key);
-    auto [left2, right2] = split_k(right, 1);
-    this->root = merge(left, right2);
+template <typename Node, typename Allocator>
+template <typename... Args>
+void treap<Node, Allocator>::insert(iterator hint, const key_t& key, Args&&... args) {
+    insert(hint, this->allocator.create(key, std::forward<Args>(args)...));
+}
+
+// The node takes the place of the first node of lower priority on the search path, which is
+// either an ancestor of the start of the finger search or below it, and the subtree there is
+// split around it. The nodes on the hint's path have been pushed by the iterator.
+template <typename Node, typename Allocator>
+void treap<Node, Allocator>::insert(iterator hint, Node* node) {
+    if (hint == this->end()) {
+        Node* last = this->max_in_subtree(this->root);
+        if (last == nullptr || !(node->key < last->key)) {
+            this->root = merge(this->root, node);
+            return;
+        }
+    }
+    std::vector<Node*> nodes = this->finger_path(hint, node->key);
+    size_t length = nodes.size();
+    while (length > 0 && nodes[length - 1]->priority < node->priority) --length;
+
+    path_stack<Node*> path;
+    Node** slot = &this->root;
+    for (size_t i = 0; i < length; ++i) {
+        Node* parent = nodes[i];
+        path.push(parent);
+        if (i + 1 < nodes.size()) {
+            slot = nodes[i + 1] == parent->left ? &parent->left : &parent->right;
+        } else {
+            slot = node->key < parent->key ? &parent->left : &parent->right;
+        }
+    }
+    while (*slot != nullptr && !((*slot)->priority < node->priority)) {
+        Node* current = *slot;
+        current->push();
+        path.push(current);
+        slot = node->key < current->key ? &current->left : &current->right;
+    }
+    auto [left, right] = split(*slot, node->key);
+    node->left = left;
+    node->right = right;
+    node->update();
+    *slot = node;
+    while (!path.empty()) path.pop()->update();
 }
 
-template <typename Node>
-void treap<Node>::erase_kth(size_t k) {
+template <typename Node, typename Allocator>
+void treap<Node, Allocator>::erase(const key_t& key) {
+    auto [left, mid, right] = _split_key(this->root, key);
+    if (mid) this->allocator.destroy(mid);
+    this->root = merge(left, right);
+}
+
+template <typename Node, typename Allocator>
+void treap<Node, Allocator>::erase_kth(size_t k) {
     auto [left, right] = split_k(this->root, k);
     auto [left2, right2] = split_k(right, 1);
+    if (left2) this->allocator.destroy(left2);
     this->root = merge(left, right2);
 }
 
-template <typename Node>
+template <typename Node, typename Allocator>
 template <typename... Args>
-void treap<Node>::insert_kth(size_t k, Args&&... args) {
-    insert_kth(k, new Node(std::forward<Args>(args)...));
+void treap<Node, Allocator>::insert_kth(size_t k, Args&&... args) {
+    insert_kth(k, this->allocator.create(std::forward<Args>(args)...));
 }
 
-template<typename Node>
-void treap<Node>::insert_kth(size_t k, Node* node) {
+template <typename Node, typename Allocator>
+void treap<Node, Allocator>::insert_kth(size_t k, Node* node) {
     auto [left, right] = split_k(this->root, k);
     this->root = merge(merge(left, node), right);
 }
 
+// Cartesian tree construction: keeps the right spine on a stack, each node is pushed and popped once.
+// The parallel build creates a balanced tree instead and lifts the largest priority of every
+// subtree to its root, which keeps the heap order. Key-derived priorities must stay those of
+// their keys, so such treaps always take the Cartesian build.
+template <typename Node, typename Allocator>
+template <typename Iterator>
+void treap<Node, Allocator>::build_from_sorted(Iterator first, Iterator last, const execution_policy& policy) {
+    if constexpr (std::random_access_iterator<Iterator> && !Node::priority_t::key_derived) {
+        if (this->node_policy(policy).threads > 1) {
+            this->build(first, last, policy, [](Node* node, size_t) {
+                if (node->left) node->priority = std::max(node->priority, node->left->priority);
+                if (node->right) node->priority = std::max(node->priority, node->right->priority);
+                node->update();
+            });
+            return;
+        }
+    }
+
+    this->clear();
+    this->allocator.reserve(std::distance(first, last));
+
+    std::vector<Node*> spine;
+    for (; first != last; ++first) {
+        Node* node = create_node(this->allocator, *first);
+        Node* last_popped = nullptr;
+        while (!spine.empty() && spine.back()->priority < node->priority) {
+            last_popped = spine.back();
+            last_popped->update();
+            spine.pop_back();
+        }
+        node->left = last_popped;
+        if (!spine.empty()) spine.back()->right = node;
+        spine.push_back(node);
+    }
+    for (auto it = spine.rbegin(); it != spine.rend(); ++it) {
+        (*it)->update();
+    }
+    this->root = spine.empty() ? nullptr : spine.front();
+}
+
 using rnd_t = std::mt19937;
-rnd_t rnd = rnd_t(std::random_device()());
+inline thread_local rnd_t rnd = rnd_t(std::random_device()());
+
+// Priority sources: a node takes its priority from Priority::next(key), or Priority::next()
+// for nodes without a key, when it is constructed.
+//
+// random_priority is splitmix64 on a thread-local state: a few arithmetic instructions per
+// node and no shared state between threads. mt19937_priority draws from the thread-local
+// Mersenne Twister `rnd` instead. hashed_priority derives the priority from a hash of the key,
+// so the shape of the treap depends only on its set of keys (equal sets give equal trees,
+// independently of the order of the updates); keys chosen against the hash can unbalance it.
+// A source sets key_derived when its priorities are a function of the key.
+inline uint64_t mix_priority(uint64_t x) {
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
 
-template <typename Key, typename Node>
+struct random_priority {
+    static constexpr bool key_derived = false;
+
+    static uint32_t next() {
+        thread_local uint64_t state = (uint64_t(std::random_device()()) << 32) | std::random_device()();
+        return uint32_t(mix_priority(state += 0x9e3779b97f4a7c15ull) >> 32);
+    }
+
+    template <typename Key>
+    static uint32_t next(const Key&) {
+        return next();
+    }
+};
+
+struct mt19937_priority {
+    static constexpr bool key_derived = false;
+
+    static uint32_t next() {
+        return uint32_t(rnd());
+    }
+
+    template <typename Key>
+    static uint32_t next(const Key&) {
+        return next();
+    }
+};
+
+struct hashed_priority {
+    static constexpr bool key_derived = true;
+
+    template <typename Key>
+    static uint32_t next(const Key& key) {
+        return uint32_t(mix_priority(std::hash<Key>()(key)) >> 32);
+    }
+};
+
+// Priorities are 32-bit for every Size.
+template <typename Key, typename Node, typename Size = size_t, typename Priority = random_priority>
 class treap_node_template {
 public:
     using key_t = Key;
-
-    [[no_unique_address]] Key key;
-    size_t priority;
-    size_t size;
+    using priority_t = Priority;
 
     Node* left;
     Node* right;
 
-    treap_node_template() : priority(rnd()), size(1), left(nullptr), right(nullptr) {}
-    treap_node_template(const Key& key) : key(key), priority(rnd()), size(1), left(nullptr), right(nullptr) {}
+    Size size;
+    uint32_t priority;
+    [[no_unique_address]] Key key;
+
+    treap_node_template() : left(nullptr), right(nullptr), size(1), priority(Priority::next()) {}
+    treap_node_template(const Key& key) : left(nullptr), right(nullptr), size(1), priority(Priority::next(key)), key(key) {}
 
     void update() {
+        SEARCH_TREES_RECORD(update);
         size = 1 + get_size(left) + get_size(right);
     }
 
-    void push() {}
+    void push() {
+        SEARCH_TREES_RECORD(push);
+    }
 };
 
 template <typename Key, typename Value>
@@ -174,4 +411,25 @@ template <typename Key>
 using treap_key_node = key_node<treap_node_template, Key>;
 
 template <typename Value>
-using treap_implicit_reverse_node = implicit_reverse_node<treap_node_template, Value>;
\ No newline at end of file
+using treap_implicit_reverse_node = implicit_reverse_node<treap_node_template, Value>;
+
+template <typename Policy>
+using treap_implicit_monoid_node = implicit_monoid_node<treap_node_template, Policy>;
+
+template <typename Key, typename Node>
+using treap_compact_node_template = treap_node_template<Key, Node, uint32_t>;
+
+template <typename Key, typename Value>
+using treap_compact_node = common_node<treap_compact_node_template, Key, Value>;
+
+template <typename Value>
+using treap_compact_implicit_node = implicit_node<treap_compact_node_template, Value>;
+
+template <typename Key, typename Node>
+using treap_hashed_node_template = treap_node_template<Key, Node, size_t, hashed_priority>;
+
+template <typename Key, typename Value>
+using treap_hashed_node = common_node<treap_hashed_node_template, Key, Value>;
+
+template <typename Key>
+using treap_hashed_key_node = key_node<treap_hashed_node_template, Key>;
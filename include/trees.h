@@ -1,34 +1,228 @@
 #pragma once
 
+#include <algorithm>
+#include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 #include <vector>
+#include "execution.h"
+#include "frozen_tree.h"
+#include "node_allocator.h"
 
 struct null_type {};
 
-template <typename Node>
+// Constructs a node from a range element: pairs and tuples are unpacked into the node constructor.
+template <typename Allocator, typename T>
+auto create_node(Allocator& allocator, const T& item) {
+    if constexpr (requires { std::tuple_size<T>::value; }) {
+        return std::apply([&](const auto&... args) { return allocator.create(args...); }, item);
+    } else {
+        return allocator.create(item);
+    }
+}
+
+// Key of a range element: the first component of pairs and tuples, the element itself otherwise.
+template <typename T>
+const auto& item_key(const T& item) {
+    if constexpr (requires { std::tuple_size<T>::value; }) {
+        return std::get<0>(item);
+    } else {
+        return item;
+    }
+}
+
+// Calls f(node); returns false if f asks to stop by returning false.
+template <typename F, typename Node>
+bool visit_node(F& f, Node& node) {
+    if constexpr (std::is_same_v<std::invoke_result_t<F&, Node&>, bool>) {
+        return f(node);
+    } else {
+        f(node);
+        return true;
+    }
+}
+
+// Stack for the nodes of a root-to-leaf path in iterative descents. The usual depths fit in the
+// inline buffer; only deeper paths spill to the heap.
+template <typename T, size_t InlineCapacity = 64>
+class path_stack {
+public:
+    void push(const T& item) {
+        if (count < InlineCapacity) {
+            items[count] = item;
+        } else {
+            overflow.push_back(item);
+        }
+        ++count;
+    }
+
+    T pop() {
+        --count;
+        if (count < InlineCapacity) return items[count];
+        T item = overflow.back();
+        overflow.pop_back();
+        return item;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+private:
+    T items[InlineCapacity];
+    std::vector<T> overflow;
+    size_t count = 0;
+};
+
+template <typename Node, typename Allocator = default_node_allocator<Node>>
 class tree {
 public:
-    tree(Node* root = nullptr) : root(root) {}
+    tree(Node* root = nullptr, const Allocator& allocator = Allocator()) : root(root), allocator(allocator) {}
 
     using key_t = typename Node::key_t;
+    using node_t = Node;
+    using allocator_t = Allocator;
 
     Node* root;
+    [[no_unique_address]] Allocator allocator;
 };
 
+// In-order iterator for trees without parent pointers. It keeps the path from the root to the
+// current node, so ++ and -- are O(1) amortized and every node is pushed before its children
+// are read. Iterators are invalidated by any modification of the tree.
 template <typename Node>
-class binary_tree : public tree<Node> {
+class tree_iterator {
 public:
-    using key_t = typename tree<Node>::key_t;
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = Node;
+    using difference_type = std::ptrdiff_t;
+    using pointer = Node*;
+    using reference = Node&;
+
+    tree_iterator() = default;
+    tree_iterator(Node* root, std::vector<Node*> path) : root(root), path(std::move(path)) {}
+
+    reference operator*() const {
+        return *path.back();
+    }
+
+    pointer operator->() const {
+        return path.back();
+    }
+
+    tree_iterator& operator++() {
+        Node* node = path.back();
+        if (node->right != nullptr) {
+            descend(node->right, &Node::left);
+        } else {
+            ascend(&Node::right);
+        }
+        return *this;
+    }
+
+    tree_iterator& operator--() {
+        if (path.empty()) {
+            descend(root, &Node::right);
+        } else if (path.back()->left != nullptr) {
+            descend(path.back()->left, &Node::right);
+        } else {
+            ascend(&Node::left);
+        }
+        return *this;
+    }
+
+    tree_iterator operator++(int) {
+        tree_iterator result = *this;
+        ++*this;
+        return result;
+    }
 
-    std::vector<Node*> get_traversal() {
-        std::vector<Node*> result;
-        traversal(tree<Node>::root, result);
+    tree_iterator operator--(int) {
+        tree_iterator result = *this;
+        --*this;
+        return result;
+    }
+
+    bool operator==(const tree_iterator& other) const {
+        return current() == other.current();
+    }
+
+private:
+    Node* current() const {
+        return path.empty() ? nullptr : path.back();
+    }
+
+    // Appends `node` and its chain of `child` descendants.
+    void descend(Node* node, Node* Node::*child) {
+        while (node != nullptr) {
+            node->push();
+            path.push_back(node);
+            node = node->*child;
+        }
+    }
+
+    // Climbs while the current node is the `child` of its parent.
+    void ascend(Node* Node::*child) {
+        Node* node = path.back();
+        path.pop_back();
+        while (!path.empty() && path.back()->*child == node) {
+            node = path.back();
+            path.pop_back();
+        }
+    }
+
+    template <typename, typename>
+    friend class binary_tree;
+
+    Node* root = nullptr;
+    std::vector<Node*> path;
+};
+
+template <typename Node, typename Allocator = default_node_allocator<Node>>
+class binary_tree : public tree<Node, Allocator> {
+public:
+    using tree<Node, Allocator>::tree;
+    using key_t = typename tree<Node, Allocator>::key_t;
+    using iterator = tree_iterator<Node>;
+
+    iterator begin() {
+        std::vector<Node*> path;
+        for (Node* node = tree<Node, Allocator>::root; node != nullptr; node = node->left) {
+            node->push();
+            path.push_back(node);
+        }
+        return iterator(tree<Node, Allocator>::root, std::move(path));
+    }
+
+    iterator end() {
+        return iterator(tree<Node, Allocator>::root, {});
+    }
+
+    // First node with a key not less than `key`.
+    iterator lower_bound(const key_t& key) {
+        return bound(key, [](const key_t& node_key, const key_t& key) { return !(node_key < key); });
+    }
+
+    // First node with a key greater than `key`.
+    iterator upper_bound(const key_t& key) {
+        return bound(key, [](const key_t& node_key, const key_t& key) { return key < node_key; });
+    }
+
+    std::vector<Node*> get_traversal(const execution_policy& policy = sequential_policy()) {
+        std::vector<Node*> result(size());
+        traversal(tree<Node, Allocator>::root, result.data(), policy);
         return result;
     } 
 
     Node* find(const key_t& key) {
-        Node* node = tree<Node>::root;
+        SEARCH_TREES_RECORD(search);
+        Node* node = tree<Node, Allocator>::root;
         while (node != nullptr) {
+            SEARCH_TREES_RECORD(visit);
             node->push();
             if (node->key == key) {
                 return node;
@@ -50,13 +244,24 @@ public:
         return node;
     }
 
+    Node* max_in_subtree(Node* node) {
+        if (node) node->push();
+        while (node != nullptr && node->right != nullptr) {
+            node = node->right;
+            node->push();
+        }
+        return node;
+    }
+
     Node* get_min() {
-        return min_in_subtree(tree<Node>::root);
+        return min_in_subtree(tree<Node, Allocator>::root);
     }
 
     Node* get_kth(size_t k) {
-        Node* node = tree<Node>::root;
+        SEARCH_TREES_RECORD(search);
+        Node* node = tree<Node, Allocator>::root;
         while (node != nullptr) {
+            SEARCH_TREES_RECORD(visit);
             node->push();
             size_t left_size = get_size(node->left);
             if (left_size == k) {
@@ -72,7 +277,7 @@ public:
     }
 
     Node* next(const key_t& key) {
-        Node* node = tree<Node>::root;
+        Node* node = tree<Node, Allocator>::root;
         Node* result = nullptr;
         while (node != nullptr) {
             node->push();
@@ -87,7 +292,7 @@ public:
     }
 
     Node* prev(const key_t& key) {
-        Node* node = tree<Node>::root;
+        Node* node = tree<Node, Allocator>::root;
         Node* result = nullptr;
         while (node != nullptr) {
             node->push();
@@ -102,8 +307,10 @@ public:
     }
 
     static size_t order_of_key(Node* node, const key_t& key) {
+        SEARCH_TREES_RECORD(search);
         size_t result = 0;
         while (node != nullptr) {
+            SEARCH_TREES_RECORD(visit);
             node->push();
             if (node->key == key) {
                 return result + get_size(node->left);
@@ -118,7 +325,7 @@ public:
     }
 
     size_t order_of_key(const key_t& key) {
-        return order_of_key(tree<Node>::root, key);
+        return order_of_key(tree<Node, Allocator>::root, key);
     }
 
     bool exists(const key_t& key) {
@@ -126,38 +333,529 @@ public:
     }
 
     size_t size()  {
-        return get_size(tree<Node>::root);
+        return get_size(tree<Node, Allocator>::root);
     }
 
-    void destroy(Node* node) {
+    void destroy(Node* node, const execution_policy& policy = sequential_policy()) {
         if (node == nullptr) return;
-        destroy(node->left);
-        destroy(node->right);
-        delete node;
+        if (!node_policy(policy).forks(node->size)) {
+            // Rotates left children up until the root has none, then frees it: no stack at all.
+            while (node != nullptr) {
+                if (Node* left = node->left) {
+                    node->left = left->right;
+                    left->right = node;
+                    node = left;
+                } else {
+                    Node* right = node->right;
+                    this->allocator.destroy(node);
+                    node = right;
+                }
+            }
+            return;
+        }
+        Node* left = node->left;
+        Node* right = node->right;
+        size_t size = node->size;
+        this->allocator.destroy(node);
+        fork_join(node_policy(policy), size,
+                  [&](const execution_policy& p) { destroy(left, p); },
+                  [&](const execution_policy& p) { destroy(right, p); });
+    }
+
+    void clear(const execution_policy& policy = sequential_policy()) {
+        if (!(std::is_trivially_destructible_v<Node> && this->allocator.release())) {
+            destroy(tree<Node, Allocator>::root, policy);
+        }
+        tree<Node, Allocator>::root = nullptr;
+    }
+
+    // Replaces the content with a perfectly balanced tree in O(n).
+    template <typename Iterator>
+    void build_from_sorted(Iterator first, Iterator last, const execution_policy& policy = sequential_policy()) {
+        build(first, last, policy, [](Node* node, size_t) { node->update(); });
+    }
+
+    // Immutable, cache-friendly copy of the current content; see frozen_tree.
+    frozen_tree<Node> freeze() {
+        return frozen_tree<Node>(*this);
+    }
+
+    // Summary of the elements at positions [l, r]; needs a node with a monoid policy.
+    auto query(size_t l, size_t r) {
+        return query(tree<Node, Allocator>::root, l, r);
     }
 
-    void clear() {
-        destroy(tree<Node>::root);
-        tree<Node>::root = nullptr;
+    // Applies `tag` to every element at positions [l, r].
+    template <typename Tag>
+    void apply(size_t l, size_t r, const Tag& tag) {
+        apply(tree<Node, Allocator>::root, l, r, tag);
+    }
+
+    // Calls f(node) for every node; with a parallel policy the order of the calls is unspecified.
+    template <typename F>
+    void for_each(F f, const execution_policy& policy = sequential_policy()) {
+        for_each(tree<Node, Allocator>::root, f, policy);
+    }
+
+    // Folds map(node) over the nodes in order; combine has to be associative.
+    template <typename T, typename Map, typename Combine>
+    T reduce(T identity, Map map, Combine combine, const execution_policy& policy = sequential_policy()) {
+        return reduce(tree<Node, Allocator>::root, identity, map, combine, policy);
+    }
+
+    // Calls f(node) in order for the nodes with keys in [lo, hi], pushing tags on the way and
+    // keeping only the path to the current node; stops early if f returns false.
+    template <typename F>
+    void for_each_in_range(const key_t& lo, const key_t& hi, F f) {
+        scan(lower_bound(lo), end(), [&](const Node& node) { return hi < node.key; }, f);
+    }
+
+    // Same for the nodes at positions [l, r].
+    template <typename F>
+    void for_each_kth_range(size_t l, size_t r, F f) {
+        if (l > r) return;
+        scan(kth_iterator(l), end(), [count = r - l + 1](const Node&) mutable { return count-- == 0; }, f);
     }
 
 protected:
-    void traversal(Node* node, std::vector<Node*>& result) {
+    // Iterator to the node at position k, or end().
+    iterator kth_iterator(size_t k) {
+        std::vector<Node*> path;
+        for (Node* node = tree<Node, Allocator>::root; node != nullptr;) {
+            node->push();
+            path.push_back(node);
+            size_t left_size = get_size(node->left);
+            if (left_size == k) {
+                return iterator(tree<Node, Allocator>::root, std::move(path));
+            } else if (left_size > k) {
+                node = node->left;
+            } else {
+                node = node->right;
+                k -= left_size + 1;
+            }
+        }
+        return end();
+    }
+
+    // Finger search for hinted inserts: the root path of `hint` (of the last node for end()) cut
+    // at the lowest node whose subtree spans `key`, with keys equal to a node's key going right.
+    // Climbing through a right child link keeps the upper bound of the key range (a left link the
+    // lower bound), so only the other links cost a comparison, O(log d) of them for a key d
+    // positions away from the hint. The tree must not be empty.
+    static std::vector<Node*> finger_path(iterator hint, const key_t& key) {
+        if (hint.path.empty()) --hint;
+        std::vector<Node*> path = std::move(hint.path);
+        size_t length = path.size();
+        bool right_of_hint = !(key < path.back()->key);
+        for (size_t i = path.size() - 1; i > 0; --i) {
+            Node* parent = path[i - 1];
+            if ((path[i] == parent->left) != right_of_hint) continue;
+            // A key equal to the parent's moves the start up to it, where a search finds it.
+            if (right_of_hint ? key < parent->key : parent->key < key) break;
+            length = i;
+        }
+        path.resize(length);
+        return path;
+    }
+
+    // Visits the nodes from `it` until `stop(node)` holds or f returns false.
+    template <typename Iterator, typename Stop, typename F>
+    static void scan(Iterator it, Iterator end, Stop stop, F& f) {
+        for (; it != end && !stop(*it); ++it) {
+            if (!visit_node(f, *it)) return;
+        }
+    }
+
+    // Keeps the root path up to the last node satisfying `goes_left`, which is the answer.
+    template <typename Predicate>
+    iterator bound(const key_t& key, Predicate goes_left) {
+        std::vector<Node*> path;
+        size_t length = 0;
+        for (Node* node = tree<Node, Allocator>::root; node != nullptr;) {
+            node->push();
+            path.push_back(node);
+            if (goes_left(node->key, key)) {
+                length = path.size();
+                node = node->left;
+            } else {
+                node = node->right;
+            }
+        }
+        path.resize(length);
+        return iterator(tree<Node, Allocator>::root, std::move(path));
+    }
+
+    // Nodes are only created and destroyed concurrently when the allocator supports it.
+    static execution_policy node_policy(const execution_policy& policy) {
+        return Allocator::thread_safe ? policy : sequential_policy();
+    }
+
+    // `finish(node, depth)` is called for every node once both of its children are linked.
+    template <typename Iterator, typename Finish>
+    void build(Iterator first, Iterator last, const execution_policy& policy, Finish finish) {
+        clear();
+        size_t count = std::distance(first, last);
+        this->allocator.reserve(count);
+        if constexpr (std::random_access_iterator<Iterator>) {
+            if (node_policy(policy).threads > 1) {
+                tree<Node, Allocator>::root = build_balanced(first, count, 0, finish, node_policy(policy));
+                return;
+            }
+        }
+        tree<Node, Allocator>::root = build_balanced(first, count, 0, finish);
+    }
+
+    template <typename Iterator, typename Finish>
+    Node* build_balanced(Iterator& it, size_t count, size_t depth, Finish& finish) {
+        if (count == 0) return nullptr;
+        Node* left = build_balanced(it, count / 2, depth + 1, finish);
+        Node* node = create_node(this->allocator, *it);
+        ++it;
+        node->left = left;
+        node->right = build_balanced(it, count - count / 2 - 1, depth + 1, finish);
+        finish(node, depth);
+        return node;
+    }
+
+    template <typename Iterator, typename Finish>
+    Node* build_balanced(Iterator first, size_t count, size_t depth, Finish& finish, const execution_policy& policy) {
+        if (count == 0) return nullptr;
+        Node* left;
+        Node* right;
+        fork_join(policy, count,
+                  [&](const execution_policy& p) { left = build_balanced(first, count / 2, depth + 1, finish, p); },
+                  [&](const execution_policy& p) {
+                      right = build_balanced(first + (count / 2 + 1), count - count / 2 - 1, depth + 1, finish, p);
+                  });
+        Node* node = create_node(this->allocator, first[count / 2]);
+        node->left = left;
+        node->right = right;
+        finish(node, depth);
+        return node;
+    }
+
+    // Sequential traversals walk an iterator, so degenerate trees cannot overflow the stack.
+    void traversal(Node* node, Node** out, const execution_policy& policy) {
+        if (node == nullptr) return;
+        if (!policy.forks(node->size)) {
+            std::vector<Node*> path;
+            for (Node* next = node; next != nullptr; next = next->left) {
+                next->push();
+                path.push_back(next);
+            }
+            iterator end(node, {});
+            for (iterator it(node, std::move(path)); it != end; ++it) *out++ = &*it;
+            return;
+        }
+        node->push();
+        size_t left_size = get_size(node->left);
+        out[left_size] = node;
+        fork_join(policy, node->size,
+                  [&](const execution_policy& p) { traversal(node->left, out, p); },
+                  [&](const execution_policy& p) { traversal(node->right, out + left_size + 1, p); });
+    }
+
+    // Positions are relative to the subtree of `node`. Subtrees that are covered completely
+    // are answered by their summary, so only the two boundary paths are visited.
+    static auto query(Node* node, size_t l, size_t r) {
+        using policy_t = typename Node::policy_t;
+        if (node == nullptr || l > r) return policy_t::identity();
+        if (l == 0 && r + 1 >= node->size) return node->summary;
+        node->push();
+        size_t left_size = get_size(node->left);
+        auto result = policy_t::identity();
+        if (l < left_size) {
+            result = query(node->left, l, std::min(r, left_size - 1));
+        }
+        if (l <= left_size && left_size <= r) {
+            result = policy_t::combine(result, policy_t::summarize(node->value));
+        }
+        if (r > left_size) {
+            size_t from = std::max(l, left_size + 1) - left_size - 1;
+            result = policy_t::combine(result, query(node->right, from, r - left_size - 1));
+        }
+        return result;
+    }
+
+    template <typename Tag>
+    static void apply(Node* node, size_t l, size_t r, const Tag& tag) {
+        using policy_t = typename Node::policy_t;
+        if (node == nullptr || l > r) return;
+        if (l == 0 && r + 1 >= node->size) {
+            node->apply(tag);
+            return;
+        }
+        node->push();
+        size_t left_size = get_size(node->left);
+        if (l < left_size) {
+            apply(node->left, l, std::min(r, left_size - 1), tag);
+        }
+        if (l <= left_size && left_size <= r) {
+            policy_t::apply_value(node->value, tag);
+        }
+        if (r > left_size) {
+            apply(node->right, std::max(l, left_size + 1) - left_size - 1, r - left_size - 1, tag);
+        }
+        node->update();
+    }
+
+    template <typename F>
+    void for_each(Node* node, F& f, const execution_policy& policy) {
         if (node == nullptr) return;
         node->push();
-        traversal(node->left, result);
-        result.push_back(node);
-        traversal(node->right, result);
+        f(node);
+        fork_join(policy, node->size,
+                  [&](const execution_policy& p) { for_each(node->left, f, p); },
+                  [&](const execution_policy& p) { for_each(node->right, f, p); });
     }
 
+    template <typename T, typename Map, typename Combine>
+    T reduce(Node* node, const T& identity, Map& map, Combine& combine, const execution_policy& policy) {
+        if (node == nullptr) return identity;
+        node->push();
+        T left = identity, right = identity;
+        fork_join(policy, node->size,
+                  [&](const execution_policy& p) { left = reduce(node->left, identity, map, combine, p); },
+                  [&](const execution_policy& p) { right = reduce(node->right, identity, map, combine, p); });
+        return combine(combine(left, map(node)), right);
+    }
 };
 
+// Node templates take the type of the subtree size as their Size parameter; uint32_t is enough
+// for trees with fewer than 2^32 nodes and halves that bookkeeping.
 template <typename Node>
 size_t get_size(Node* node) {
     if (node == nullptr) return 0;
     return node->size;
 }
 
+// Join-based bulk algorithms. They only need a three-way split by key (Tree::_split_key),
+// a three-way join (Tree::_merge) and Tree::merge, and do O(m log(n / m + 1)) work for a
+// sorted batch of m keys instead of O(m log n) for m separate operations.
+template <typename Tree>
+struct join_algorithms {
+    using node_t = typename Tree::node_t;
+    using key_t = typename Tree::key_t;
+
+    // Three-way splits into the nodes before, at and after the split point, without recursion:
+    // the descent detaches every node it passes (Tree::clear_vertex) and records it with the
+    // subtree that stays on its side, and these are joined back bottom-up, nearest first.
+    // split_k splits at the k-th node (counting from 1), split_key at the node with `key`.
+    static std::tuple<node_t*, node_t*, node_t*> split_k(node_t* node, size_t k) {
+        path_stack<split_step> path;
+        while (node != nullptr) {
+            SEARCH_TREES_RECORD(split_step);
+            node->push();
+            node_t* node_left = node->left;
+            node_t* node_right = node->right;
+            size_t left_size = get_size(node_left);
+            Tree::clear_vertex(node);
+            if (left_size + 1 == k) return join_path(path, node_left, node, node_right);
+            if (left_size >= k) {
+                path.push({node, node_right, false});
+                node = node_left;
+            } else {
+                path.push({node, node_left, true});
+                k -= left_size + 1;
+                node = node_right;
+            }
+        }
+        return join_path(path, nullptr, nullptr, nullptr);
+    }
+
+    static std::tuple<node_t*, node_t*, node_t*> split_key(node_t* node, const key_t& key) {
+        path_stack<split_step> path;
+        while (node != nullptr) {
+            SEARCH_TREES_RECORD(split_step);
+            node->push();
+            node_t* node_left = node->left;
+            node_t* node_right = node->right;
+            Tree::clear_vertex(node);
+            if (key < node->key) {
+                path.push({node, node_right, false});
+                node = node_left;
+            } else if (node->key < key) {
+                path.push({node, node_left, true});
+                node = node_right;
+            } else {
+                return join_path(path, node_left, node, node_right);
+            }
+        }
+        return join_path(path, nullptr, nullptr, nullptr);
+    }
+
+    template <typename Iterator>
+    static void insert_batch(Tree& tree, Iterator first, Iterator last) {
+        using item_t = typename std::iterator_traits<Iterator>::value_type;
+        std::vector<item_t> items(first, last);
+        auto less = [](const item_t& a, const item_t& b) { return item_key(a) < item_key(b); };
+        std::stable_sort(items.begin(), items.end(), less);
+        auto equal = [](const item_t& a, const item_t& b) { return !(item_key(a) < item_key(b)); };
+        items.erase(std::unique(items.begin(), items.end(), equal), items.end());
+        tree.root = insert_sorted(tree, tree.root, items.begin(), items.end());
+    }
+
+    template <typename Iterator>
+    static void erase_batch(Tree& tree, Iterator first, Iterator last) {
+        std::vector<typename Tree::key_t> keys(first, last);
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        tree.root = erase_sorted(tree, tree.root, keys.begin(), keys.end());
+    }
+
+    // Items must be sorted by key without duplicates. Keys already present keep their node.
+    template <typename Iterator>
+    static node_t* insert_sorted(Tree& tree, node_t* node, Iterator first, Iterator last) {
+        if (first == last) return node;
+        Iterator mid = first + (last - first) / 2;
+        auto [left, found, right] = Tree::_split_key(node, item_key(*mid));
+        if (!found) found = create_node(tree.allocator, *mid);
+        left = insert_sorted(tree, left, first, mid);
+        right = insert_sorted(tree, right, mid + 1, last);
+        return Tree::_merge(left, found, right);
+    }
+
+    // The set operations consume both inputs: every node of `a` and `b` is either moved into the
+    // result or destroyed. Union keeps the node of `a` for keys present in both trees.
+    static node_t* set_union(Tree& tree, node_t* a, node_t* b, const execution_policy& policy) {
+        if (!a) return b;
+        if (!b) return a;
+        size_t work = a->size + b->size;
+        auto [b_left, b_mid, b_right] = Tree::_split_key(b, b->key);
+        auto [left, mid, right] = Tree::_split_key(a, b_mid->key);
+        if (mid) {
+            tree.allocator.destroy(b_mid);
+        } else {
+            mid = b_mid;
+        }
+        fork_join(node_policy(policy), work,
+                  [&](const execution_policy& p) { left = set_union(tree, left, b_left, p); },
+                  [&](const execution_policy& p) { right = set_union(tree, right, b_right, p); });
+        return Tree::_merge(left, mid, right);
+    }
+
+    static node_t* set_intersection(Tree& tree, node_t* a, node_t* b, const execution_policy& policy) {
+        if (!a || !b) {
+            tree.destroy(a, policy);
+            tree.destroy(b, policy);
+            return nullptr;
+        }
+        size_t work = a->size + b->size;
+        auto [b_left, b_mid, b_right] = Tree::_split_key(b, b->key);
+        auto [left, mid, right] = Tree::_split_key(a, b_mid->key);
+        tree.allocator.destroy(b_mid);
+        fork_join(node_policy(policy), work,
+                  [&](const execution_policy& p) { left = set_intersection(tree, left, b_left, p); },
+                  [&](const execution_policy& p) { right = set_intersection(tree, right, b_right, p); });
+        return mid ? Tree::_merge(left, mid, right) : Tree::merge(left, right);
+    }
+
+    static node_t* set_difference(Tree& tree, node_t* a, node_t* b, const execution_policy& policy) {
+        if (!a || !b) {
+            tree.destroy(b, policy);
+            return a;
+        }
+        size_t work = a->size + b->size;
+        auto [b_left, b_mid, b_right] = Tree::_split_key(b, b->key);
+        auto [left, mid, right] = Tree::_split_key(a, b_mid->key);
+        tree.allocator.destroy(b_mid);
+        if (mid) tree.allocator.destroy(mid);
+        fork_join(node_policy(policy), work,
+                  [&](const execution_policy& p) { left = set_difference(tree, left, b_left, p); },
+                  [&](const execution_policy& p) { right = set_difference(tree, right, b_right, p); });
+        return Tree::merge(left, right);
+    }
+
+    // Keeps the nodes satisfying pred(node) and destroys the rest.
+    template <typename Predicate>
+    static node_t* filter(Tree& tree, node_t* node, Predicate& pred, const execution_policy& policy) {
+        if (!node) return nullptr;
+        size_t work = node->size;
+        auto [left, mid, right] = Tree::_split_key(node, node->key);
+        fork_join(node_policy(policy), work,
+                  [&](const execution_policy& p) { left = filter(tree, left, pred, p); },
+                  [&](const execution_policy& p) { right = filter(tree, right, pred, p); });
+        if (pred(mid)) return Tree::_merge(left, mid, right);
+        tree.allocator.destroy(mid);
+        return Tree::merge(left, right);
+    }
+
+    static execution_policy node_policy(const execution_policy& policy) {
+        return Tree::allocator_t::thread_safe ? policy : sequential_policy();
+    }
+
+    template <typename Iterator>
+    static node_t* erase_sorted(Tree& tree, node_t* node, Iterator first, Iterator last) {
+        if (first == last || !node) return node;
+        Iterator mid = first + (last - first) / 2;
+        auto [left, found, right] = Tree::_split_key(node, *mid);
+        if (found) tree.allocator.destroy(found);
+        left = erase_sorted(tree, left, first, mid);
+        right = erase_sorted(tree, right, mid + 1, last);
+        return Tree::merge(left, right);
+    }
+
+    struct split_step {
+        node_t* node;
+        node_t* subtree;   // the child of `node` that stays on its side
+        bool to_left;
+    };
+
+    static std::tuple<node_t*, node_t*, node_t*> join_path(path_stack<split_step>& path, node_t* left,
+                                                          node_t* mid, node_t* right) {
+        while (!path.empty()) {
+            split_step step = path.pop();
+            if (step.to_left) {
+                left = Tree::_merge(step.subtree, step.node, left);
+            } else {
+                right = Tree::_merge(right, step.node, step.subtree);
+            }
+        }
+        return std::make_tuple(left, mid, right);
+    }
+};
+
+// The bulk operations of a tree on top of join_algorithms<Tree>. Engines that provide its
+// primitives inherit them next to binary_tree, passing themselves as Tree.
+template <typename Tree>
+class join_operations {
+public:
+    template <typename Iterator>
+    void insert_batch(Iterator first, Iterator last) {
+        join_algorithms<Tree>::insert_batch(self(), first, last);
+    }
+
+    template <typename Iterator>
+    void erase_batch(Iterator first, Iterator last) {
+        join_algorithms<Tree>::erase_batch(self(), first, last);
+    }
+
+    void set_union(Tree& other, const execution_policy& policy = sequential_policy()) {
+        self().root = join_algorithms<Tree>::set_union(self(), self().root, other.root, policy);
+        other.root = nullptr;
+    }
+
+    void set_intersection(Tree& other, const execution_policy& policy = sequential_policy()) {
+        self().root = join_algorithms<Tree>::set_intersection(self(), self().root, other.root, policy);
+        other.root = nullptr;
+    }
+
+    void set_difference(Tree& other, const execution_policy& policy = sequential_policy()) {
+        self().root = join_algorithms<Tree>::set_difference(self(), self().root, other.root, policy);
+        other.root = nullptr;
+    }
+
+    template <typename Predicate>
+    void filter(Predicate pred, const execution_policy& policy = sequential_policy()) {
+        self().root = join_algorithms<Tree>::filter(self(), self().root, pred, policy);
+    }
+
+private:
+    Tree& self() {
+        return static_cast<Tree&>(*this);
+    }
+};
+
 template <template<typename TKey, typename Node> class Template, typename Key, typename Value=null_type>
 struct common_node : public Template<Key, common_node<Template, Key, Value>> {
     using Template<Key, common_node<Template, Key, Value> >::Template;
@@ -198,6 +896,7 @@ struct implicit_reverse_node : public Template<null_type, implicit_reverse_node<
     }
 
     void push() {
+        SEARCH_TREES_RECORD(push);
         if (reversed) {
             std::swap(this->left, this->right);
             if (this->left != nullptr) this->left->reversed ^= 1;
@@ -211,6 +910,49 @@ struct implicit_reverse_node : public Template<null_type, implicit_reverse_node<
     }
 };
 
+// Implicit node that keeps the summary of its subtree and a pending tag for its children.
+// Policy supplies the monoid and the tags acting on it:
+//   value_t, summary_t, tag_t,
+//   identity(), summarize(value), combine(left, right),
+//   apply_value(value, tag), apply_summary(summary, tag, size) and compose(older, newer).
+// A tagged node has already applied the tag to its own value and summary; push() hands it down.
+template <template<typename TKey, typename Node> class Template, typename Policy>
+struct implicit_monoid_node : public Template<null_type, implicit_monoid_node<Template, Policy>> {
+    using Template<null_type, implicit_monoid_node<Template, Policy> >::Template;
+    using policy_t = Policy;
+    using value_t = typename Policy::value_t;
+    using summary_t = typename Policy::summary_t;
+    using tag_t = typename Policy::tag_t;
+
+    value_t value;
+    summary_t summary;
+    tag_t tag;
+    bool tagged;
+
+    implicit_monoid_node(const value_t& value) : Template<null_type, implicit_monoid_node<Template, Policy> >(),
+            value(value), summary(Policy::summarize(value)), tag(), tagged(false) {}
 
+    void update() {
+        push();
+        Template<null_type, implicit_monoid_node<Template, Policy> >::update();
+        summary = Policy::summarize(value);
+        if (this->left != nullptr) summary = Policy::combine(this->left->summary, summary);
+        if (this->right != nullptr) summary = Policy::combine(summary, this->right->summary);
+    }
 
+    void push() {
+        SEARCH_TREES_RECORD(push);
+        if (tagged) {
+            if (this->left != nullptr) this->left->apply(tag);
+            if (this->right != nullptr) this->right->apply(tag);
+            tagged = false;
+        }
+    }
 
+    void apply(const tag_t& new_tag) {
+        Policy::apply_value(value, new_tag);
+        Policy::apply_summary(summary, new_tag, this->size);
+        tag = tagged ? Policy::compose(tag, new_tag) : new_tag;
+        tagged = true;
+    }
+};
@@ -0,0 +1,416 @@
+#pragma once
+
+#include <tuple>
+#include "trees.h"
+
+// Size-based balance shared by wb_tree and scapegoat_tree (Adams' variant with delta = 3,
+// ratio = 2, as in Haskell's Data.Map). A subtree may be at most `delta` times as large as its
+// sibling; a rotation is double when the inner grandchild is at least `ratio` times as large
+// as the outer one. Only the subtree size every node already keeps is consulted.
+template <typename Node>
+struct weight_balance {
+    static constexpr size_t delta = 3;
+    static constexpr size_t ratio = 2;
+
+    static inline bool is_balanced(Node* node);
+    static inline Node* rotate_left(Node* pivot);
+    static inline Node* rotate_right(Node* pivot);
+    static inline Node* balance(Node* node);
+    static Node* join(Node* left, Node* mid, Node* right);
+};
+
+template <typename Node>
+bool weight_balance<Node>::is_balanced(Node* node) {
+    size_t left_size = get_size(node->left);
+    size_t right_size = get_size(node->right);
+    return left_size + right_size <= 1 ||
+           (left_size <= delta * right_size && right_size <= delta * left_size);
+}
+
+template <typename Node>
+Node* weight_balance<Node>::rotate_right(Node* pivot) {
+    SEARCH_TREES_RECORD(rotation);
+    if (pivot) pivot->push();
+    Node* q = pivot->left;
+    if (q) q->push();
+
+    pivot->left = q->right;
+    q->right = pivot;
+
+    pivot->update();
+    q->update();
+
+    return q;
+}
+
+template <typename Node>
+Node* weight_balance<Node>::rotate_left(Node* pivot) {
+    SEARCH_TREES_RECORD(rotation);
+    if (pivot) pivot->push();
+    Node* q = pivot->right;
+    if (q) q->push();
+
+    pivot->right = q->left;
+    q->left = pivot;
+
+    pivot->update();
+    q->update();
+
+    return q;
+}
+
+// Restores the weight invariant at `node` after one of its subtrees grew or shrank by a
+// bounded factor (a single insert or erase below it, or one step of a join).
+template <typename Node>
+Node* weight_balance<Node>::balance(Node* node) {
+    node->push();
+    size_t left_size = get_size(node->left);
+    size_t right_size = get_size(node->right);
+    if (left_size + right_size > 1) {
+        if (right_size > delta * left_size) {
+            Node* right = node->right;
+            right->push();
+            if (get_size(right->left) >= ratio * get_size(right->right)) {
+                node->right = rotate_right(right);
+            }
+            return rotate_left(node);
+        }
+        if (left_size > delta * right_size) {
+            Node* left = node->left;
+            left->push();
+            if (get_size(left->right) >= ratio * get_size(left->left)) {
+                node->left = rotate_left(left);
+            }
+            return rotate_right(node);
+        }
+    }
+    node->update();
+    return node;
+}
+
+// Join: descend the spine of the heavier tree until the lighter one is within `delta` of the
+// subtree there, hang `mid` in its place and rebalance on the way back up.
+template <typename Node>
+Node* weight_balance<Node>::join(Node* left, Node* mid, Node* right) {
+    SEARCH_TREES_RECORD(join_step);
+    if (mid) mid->push();
+    if (left) left->push();
+    if (right) right->push();
+
+    if (!mid) {
+        if (!right) return left;
+        if (!left) return right;
+    }
+
+    size_t left_size = get_size(left);
+    size_t right_size = get_size(right);
+    if (right_size > delta * left_size) {
+        right->left = join(left, mid, right->left);
+        return balance(right);
+    }
+    if (left_size > delta * right_size) {
+        left->right = join(left->right, mid, right);
+        return balance(left);
+    }
+    mid->left = left;
+    mid->right = right;
+    mid->update();
+    return mid;
+}
+
+// Weight-balanced tree: insert and erase rebalance their path with single and double
+// rotations, like AVL, but judge balance by subtree sizes instead of a height field.
+template <typename Node, typename Allocator = default_node_allocator<Node>>
+class wb_tree: public binary_tree<Node, Allocator>, public join_operations<wb_tree<Node, Allocator>> {
+public:
+    using binary_tree<Node, Allocator>::binary_tree;
+    using key_t = typename binary_tree<Node, Allocator>::key_t;
+    using iterator = typename binary_tree<Node, Allocator>::iterator;
+
+    template <typename... Args>
+    void insert(const key_t& key, Args&&... args);
+    void insert(Node* node);
+
+    // Hinted insert. With end() as the hint and a key not less than the largest one, the node
+    // is joined along the right spine without a search; otherwise it is a plain insert.
+    template <typename... Args>
+    void insert(iterator hint, const key_t& key, Args&&... args);
+    void insert(iterator hint, Node* node);
+
+    void erase(const key_t& key);
+
+    template <typename... Args>
+    void insert_kth(size_t k, Args&&... args);
+    void insert_kth(size_t k, Node* node);
+    void erase_kth(size_t k);
+
+    static Node* merge(Node* left, Node* right);
+    static std::pair<Node*, Node*> split(Node* node, const key_t& key);
+    static std::pair<Node*, Node*> split_k(Node* node, size_t k);
+
+    Node* cut_subsegment(size_t l, size_t r);
+    void insert_subsegment(size_t i, Node* t);
+
+    template<typename... Args>
+    void push_back(Args&&... args);
+
+private:
+    friend struct join_algorithms<wb_tree>;
+    using balancing = weight_balance<Node>;
+
+    static inline void clear_vertex(Node* node);
+
+    Node* _insert(Node* node, Node* parent);
+    Node* _erase(Node* parent, const key_t& key);
+    static Node* _remove_min(Node* parent);
+
+    static Node* _merge(Node* left, Node* mid, Node* right);
+    static std::tuple<Node*, Node*, Node*> _split_k(Node* node, size_t k);
+    static std::tuple<Node*, Node*, Node*> _split_key(Node* node, const key_t& key);
+};
+
+template <typename Node, typename Allocator>
+void wb_tree<Node, Allocator>::clear_vertex(Node* node) {
+    if (node == nullptr) return;
+    node->left = nullptr;
+    node->right = nullptr;
+    node->update();
+}
+
+// Insert and erase descend iteratively, keeping the slots (child pointers) that lead to the
+// changed node, and rebalance the path bottom-up through them.
+template <typename Node, typename Allocator>
+Node* wb_tree<Node, Allocator>::_insert(Node* node, Node* parent) {
+    path_stack<Node**> path;
+    Node** slot = &parent;
+    while (*slot != nullptr) {
+        Node* current = *slot;
+        current->push();
+        if (node->key == current->key) {
+            this->allocator.destroy(node);
+            return parent;
+        }
+        path.push(slot);
+        slot = node->key < current->key ? &current->left : &current->right;
+    }
+    *slot = node;
+    while (!path.empty()) {
+        slot = path.pop();
+        *slot = balancing::balance(*slot);
+    }
+    return parent;
+}
+
+template <typename Node, typename Allocator>
+template <typename... Args>
+void wb_tree<Node, Allocator>::insert(const key_t& key, Args&&... args) {
+    insert(this->allocator.create(key, std::forward<Args>(args)...));
+}
+
+template <typename Node, typename Allocator>
+void wb_tree<Node, Allocator>::insert(Node* node) {
+    if (!node) return;
+    this->root = _insert(node, this->root);
+}
+
+template <typename Node, typename Allocator>
+template <typename... Args>
+void wb_tree<Node, Allocator>::insert(iterator hint, const key_t& key, Args&&... args) {
+    insert(hint, this->allocator.create(key, std::forward<Args>(args)...));
+}
+
+template <typename Node, typename Allocator>
+void wb_tree<Node, Allocator>::insert(iterator hint, Node* node) {
+    if (hint == this->end()) {
+        Node* last = this->max_in_subtree(this->root);
+        if (last == nullptr || last->key < node->key) {
+            this->root = _merge(this->root, node, nullptr);
+            return;
+        }
+    }
+    insert(node);
+}
+
+template <typename Node, typename Allocator>
+Node* wb_tree<Node, Allocator>::_remove_min(Node *parent) {
+    if (!parent) return nullptr;
+    path_stack<Node**> path;
+    Node** slot = &parent;
+    while ((*slot)->left) {
+        (*slot)->push();
+        path.push(slot);
+        slot = &(*slot)->left;
+    }
+    *slot = (*slot)->right;
+    while (!path.empty()) {
+        slot = path.pop();
+        *slot = balancing::balance(*slot);
+    }
+    return parent;
+}
+
+template <typename Node, typename Allocator>
+Node* wb_tree<Node, Allocator>::_erase(Node* parent, const key_t& key) {
+    path_stack<Node**> path;
+    Node** slot = &parent;
+    while (*slot != nullptr) {
+        Node* current = *slot;
+        current->push();
+        if (key < current->key) {
+            path.push(slot);
+            slot = &current->left;
+        } else if (key > current->key) {
+            path.push(slot);
+            slot = &current->right;
+        } else {
+            Node* left = current->left;
+            Node* right = current->right;
+            this->allocator.destroy(current);
+            if (!right) {
+                *slot = left;
+            } else {
+                Node* min = binary_tree<Node, Allocator>::min_in_subtree(right);
+                min->right = _remove_min(right);
+                min->left = left;
+                *slot = balancing::balance(min);
+            }
+            break;
+        }
+    }
+    while (!path.empty()) {
+        slot = path.pop();
+        *slot = balancing::balance(*slot);
+    }
+    return parent;
+}
+
+template <typename Node, typename Allocator>
+void wb_tree<Node, Allocator>::erase(const key_t& key) {
+    this->root = _erase(this->root, key);
+}
+
+template <typename Node, typename Allocator>
+Node* wb_tree<Node, Allocator>::_merge(Node *left, Node *mid, Node *right) {
+    return balancing::join(left, mid, right);
+}
+
+template <typename Node, typename Allocator>
+Node* wb_tree<Node, Allocator>::merge(Node* left, Node* right) {
+    if (!left) return right;
+    if (!right) return left;
+
+    auto [left_part, mid] = split_k(left, get_size(left) - 1);
+    return _merge(left_part, mid, right);
+}
+
+template <typename Node, typename Allocator>
+std::tuple<Node*, Node*, Node*> wb_tree<Node, Allocator>::_split_k(Node* node, size_t k) {
+    return join_algorithms<wb_tree>::split_k(node, k);
+}
+
+template <typename Node, typename Allocator>
+std::tuple<Node*, Node*, Node*> wb_tree<Node, Allocator>::_split_key(Node* node, const key_t& key) {
+    return join_algorithms<wb_tree>::split_key(node, key);
+}
+
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> wb_tree<Node, Allocator>::split_k(Node* node, size_t k) {
+    auto [left, mid, right] = _split_k(node, k);
+    left = _merge(left, mid, nullptr);
+    return {left, right};
+}
+
+template <typename Node, typename Allocator>
+std::pair<Node*, Node*> wb_tree<Node, Allocator>::split(Node* node, const key_t& key) {
+    size_t k = binary_tree<Node, Allocator>::order_of_key(node, key);
+    return split_k(node, k);
+}
+
+template <typename Node, typename Allocator>
+void wb_tree<Node, Allocator>::insert_kth(size_t k, Node *node) {
+    auto [left, right] = split_k(this->root, k);
+    this->root = _merge(left, node, right);
+}
+
+template <typename Node, typename Allocator>
+template <typename... Args>
+void wb_tree<Node, Allocator>::insert_kth(size_t k, Args&&... args) {
+    insert_kth(k, this->allocator.create(std::forward<Args>(args)...));
+}
+
+template <typename Node, typename Allocator>
+Node* wb_tree<Node, Allocator>::cut_subsegment(size_t l, size_t r) {
+    auto [left, join, right] = _split_k(this->root, l);
+    auto [mid, right2] = split_k(right, r - l + 1);
+    this->root = _merge(left, join, right2);
+    return mid;
+}
+
+template <typename Node, typename Allocator>
+void wb_tree<Node, Allocator>::insert_subsegment(size_t i, Node* t) {
+    auto [left, join, right] = _split_k(this->root, i);
+    this->root = merge(_merge(left, join, t), right);
+}
+
+template <typename Node, typename Allocator>
+void wb_tree<Node, Allocator>::erase_kth(size_t k) {
+    auto [left, mid, right] = _split_k(this->root, k + 1);
+    if (mid) this->allocator.destroy(mid);
+    this->root = merge(left, right);
+}
+
+template <typename Node, typename Allocator>
+template <typename... Args>
+void wb_tree<Node, Allocator>::push_back(Args&&... args) {
+    this->root = _merge(this->root, this->allocator.create(std::forward<Args>(args)...), nullptr);
+}
+
+template <typename Key, typename Node, typename Size = size_t>
+struct wb_node_template {
+    using key_t = Key;
+
+    Node* left;
+    Node* right;
+    Size size;
+    [[no_unique_address]] key_t key;
+
+    wb_node_template() : left(nullptr), right(nullptr) {
+        update();
+    }
+    wb_node_template(const key_t& key) : left(nullptr), right(nullptr), key(key) {
+        update();
+    }
+
+    void update() {
+        SEARCH_TREES_RECORD(update);
+        size = 1 + get_size(left) + get_size(right);
+    }
+
+    void push() {
+        SEARCH_TREES_RECORD(push);
+    }
+};
+
+template <typename Key, typename Value>
+using wb_node = common_node<wb_node_template, Key, Value>;
+
+template <typename Value>
+using wb_implicit_node = implicit_node<wb_node_template, Value>;
+
+template <typename Key>
+using wb_key_node = key_node<wb_node_template, Key>;
+
+template <typename Value>
+using wb_implicit_reverse_node = implicit_reverse_node<wb_node_template, Value>;
+
+template <typename Policy>
+using wb_implicit_monoid_node = implicit_monoid_node<wb_node_template, Policy>;
+
+template <typename Key, typename Node>
+using wb_compact_node_template = wb_node_template<Key, Node, uint32_t>;
+
+template <typename Key, typename Value>
+using wb_compact_node = common_node<wb_compact_node_template, Key, Value>;
+
+template <typename Value>
+using wb_compact_implicit_node = implicit_node<wb_compact_node_template, Value>;
@@ -0,0 +1,113 @@
+// Built with SEARCH_TREES_INSTRUMENTATION, separately from the uninstrumented tests.
+#include "gtest/gtest.h"
+#include "avl.h"
+#include "splay_tree.h"
+#include <random>
+#include <utility>
+#include <vector>
+
+template <typename Node>
+size_t subtree_depth(Node* node) {
+    return node == nullptr ? 0 : 1 + std::max(subtree_depth(node->left), subtree_depth(node->right));
+}
+
+TEST(InstrumentationTest, CountersTest) {
+    using Tree = AVL<avl_node<int, int>>;
+    Tree tree;
+    tree_stats stats;
+    {
+        stats_scope scope(stats);
+        for (int i = 0; i < 1000; ++i) tree.insert(i, i);
+    }
+    ASSERT_EQ(stats[tree_event::allocation], 1000u);
+    ASSERT_GT(stats[tree_event::rotation], 0u);
+    ASSERT_GT(stats[tree_event::update], 0u);
+    ASSERT_GT(stats[tree_event::push], 0u);
+
+    // Events outside every scope are not counted.
+    stats.reset();
+    tree.find(500);
+    ASSERT_EQ(stats[tree_event::search], 0u);
+
+    {
+        stats_scope scope(stats);
+        ASSERT_EQ(tree.find(500)->key, 500);
+        ASSERT_EQ(tree.order_of_key(250), 250u);
+    }
+    ASSERT_EQ(stats[tree_event::search], 2u);
+    ASSERT_GE(stats[tree_event::visit], 2u);
+    ASSERT_LE(stats[tree_event::visit], 2 * subtree_depth(tree.root));
+
+    // The innermost scope takes the events; the hook sees each of them.
+    tree_stats inner;
+    uint64_t hooked = 0;
+    inner.context = &hooked;
+    inner.hook = [](tree_event, void* context) { ++*static_cast<uint64_t*>(context); };
+    stats.reset();
+    {
+        stats_scope outer_scope(stats);
+        {
+            stats_scope inner_scope(inner);
+            auto [left, right] = Tree::split_k(tree.root, 300);
+            tree.root = Tree::merge(left, right);
+        }
+        tree.erase(0);
+    }
+    ASSERT_GT(inner[tree_event::split_step], 0u);
+    ASSERT_LE(inner[tree_event::split_step], 2 * subtree_depth(tree.root));
+    ASSERT_GT(inner[tree_event::join_step], 0u);
+    uint64_t total = 0;
+    for (uint64_t count : inner.counts) total += count;
+    ASSERT_EQ(hooked, total);
+    ASSERT_EQ(stats[tree_event::split_step], 0u);
+    ASSERT_EQ(stats[tree_event::deallocation], 1u);
+    tree.clear();
+}
+
+TEST(InstrumentationTest, SplayDepthTest) {
+    splay_tree<splay_node<int, int>> tree;
+    for (int i = 0; i < 1000; ++i) tree.insert(i * 7 % 1000, i);
+
+    // A splay moves the accessed node up by its whole depth.
+    std::mt19937 gen(0);
+    for (int i = 0; i < 100; ++i) {
+        size_t k = gen() % tree.size();
+        size_t depth = 0;
+        auto node = tree.root;
+        for (size_t rest = k; get_size(node->left) != rest; ++depth) {
+            if (get_size(node->left) > rest) {
+                node = node->left;
+            } else {
+                rest -= get_size(node->left) + 1;
+                node = node->right;
+            }
+        }
+
+        tree_stats stats;
+        {
+            stats_scope scope(stats);
+            ASSERT_EQ(tree.get_kth(k), node);
+        }
+        ASSERT_EQ(tree.root, node);
+        ASSERT_EQ(stats[tree_event::splay], 1u);
+        ASSERT_EQ(stats[tree_event::splay_step], depth);
+    }
+    tree.clear();
+}
+
+// Workers forked by a parallel policy count into the scope of the thread that forked them.
+TEST(InstrumentationTest, ParallelPolicyTest) {
+    std::vector<std::pair<int, int>> items;
+    for (int i = 0; i < 10000; ++i) items.emplace_back(i, i);
+
+    AVL<avl_node<int, int>> tree;
+    tree_stats stats;
+    {
+        stats_scope scope(stats);
+        tree.build_from_sorted(items.begin(), items.end(), parallel_policy(8, 64));
+    }
+    ASSERT_EQ(tree.size(), items.size());
+    ASSERT_EQ(stats[tree_event::allocation], items.size());
+    ASSERT_EQ(active_tree_stats, nullptr);
+    tree.clear();
+}
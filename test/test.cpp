@@ -4,7 +4,27 @@
 #include "rb_tree.h"
 #include "avl.h"
 #include "splay_tree.h"
+#include "wb_tree.h"
+#include "scapegoat_tree.h"
+#include "btree.h"
+#include "range_policies.h"
+#include "persistent_treap.h"
+#include "persistent_avl.h"
+#include "concurrent_tree.h"
+#include "concurrent_skiplist.h"
+#include "sharded_tree.h"
+#include "serialization.h"
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
 #include <map>
+#include <sstream>
+#include <mutex>
+#include <random>
+#include <thread>
 
 TEST(IncludeTest, IncludeTest) {}
 
@@ -17,16 +37,98 @@ class ImplicitTreeTest: public ::testing::Test {};
 template <typename Tree>
 class ReverseTreeTest: public ::testing::Test {};
 
+template <typename Tree>
+class PoolAllocatorTest: public ::testing::Test {};
+
+template <typename Tree>
+class MonoidTreeTest: public ::testing::Test {};
+
 typedef ::testing::Types<   treap<treap_node<int, int>>, AVL<avl_node<int, int>>,
-                            rb_tree<rb_node<int, int>>, splay_tree<splay_node<int, int>> > SearchTreeTypes;
+                            rb_tree<rb_node<int, int>>, splay_tree<splay_node<int, int>>,
+                            treap<treap_compact_node<int, int>>, AVL<avl_compact_node<int, int>>,
+                            rb_tree<rb_compact_node<int, int>>, splay_tree<splay_compact_node<int, int>>,
+                            btree<btree_node<int, int>>, btree<btree_node<int, int>, 4, 2>,
+                            splay_tree<splay_node<int, int>, default_node_allocator<splay_node<int, int>>, semi_splaying>,
+                            splay_tree<splay_node<int, int>, default_node_allocator<splay_node<int, int>>,
+                                       periodic_splaying<4>>,
+                            wb_tree<wb_node<int, int>>, scapegoat_tree<scapegoat_node<int, int>> > SearchTreeTypes;
 typedef ::testing::Types<   treap<treap_implicit_node<int>>, AVL<avl_implicit_node<int>>,
-                            rb_tree<rb_implicit_node<int>>, splay_tree<splay_implicit_node<int>> > ImplicitSearchTreeTypes;
+                            rb_tree<rb_implicit_node<int>>, splay_tree<splay_implicit_node<int>>,
+                            treap<treap_compact_implicit_node<int>>, AVL<avl_compact_implicit_node<int>>,
+                            rb_tree<rb_compact_implicit_node<int>>, splay_tree<splay_compact_implicit_node<int>>,
+                            btree<btree_implicit_node<int>>, btree<btree_implicit_node<int>, 4, 2>,
+                            wb_tree<wb_implicit_node<int>>, scapegoat_tree<scapegoat_implicit_node<int>> > ImplicitSearchTreeTypes;
 typedef ::testing::Types<   treap<treap_implicit_reverse_node<int>>, AVL<avl_implicit_reverse_node<int>>,
-                            rb_tree<rb_implicit_reverse_node<int>>, splay_tree<splay_implicit_reverse_node<int>> > ReverseSearchTreeTypes;
+                            rb_tree<rb_implicit_reverse_node<int>>, splay_tree<splay_implicit_reverse_node<int>>,
+                            btree<btree_implicit_node<int>>, btree<btree_implicit_node<int>, 4, 2>,
+                            wb_tree<wb_implicit_reverse_node<int>>,
+                            scapegoat_tree<scapegoat_implicit_reverse_node<int>> > ReverseSearchTreeTypes;
 
 TYPED_TEST_SUITE(SearchTreeTest, SearchTreeTypes);
 TYPED_TEST_SUITE(ImplicitTreeTest, ImplicitSearchTreeTypes);
+typedef ::testing::Types<   treap<treap_node<int, int>, pool_node_allocator<treap_node<int, int>>>,
+                            AVL<avl_node<int, int>, pool_node_allocator<avl_node<int, int>>>,
+                            rb_tree<rb_node<int, int>, pool_node_allocator<rb_node<int, int>>>,
+                            splay_tree<splay_node<int, int>, pool_node_allocator<splay_node<int, int>>>,
+                            wb_tree<wb_node<int, int>, pool_node_allocator<wb_node<int, int>>>,
+                            scapegoat_tree<scapegoat_node<int, int>, pool_node_allocator<scapegoat_node<int, int>>> > PoolSearchTreeTypes;
+
 TYPED_TEST_SUITE(ReverseTreeTest, ReverseSearchTreeTypes);
+TYPED_TEST_SUITE(PoolAllocatorTest, PoolSearchTreeTypes);
+
+typedef sum_add_policy<long long> sum_add;
+typedef ::testing::Types<   treap<treap_implicit_monoid_node<sum_add>>, AVL<avl_implicit_monoid_node<sum_add>>,
+                            rb_tree<rb_implicit_monoid_node<sum_add>>, splay_tree<splay_implicit_monoid_node<sum_add>>,
+                            wb_tree<wb_implicit_monoid_node<sum_add>>,
+                            scapegoat_tree<scapegoat_implicit_monoid_node<sum_add>> > MonoidTreeTypes;
+TYPED_TEST_SUITE(MonoidTreeTest, MonoidTreeTypes);
+
+// Counts live nodes, so persistent trees can be checked for leaks and for path copying.
+template <typename Node>
+struct counting_node_allocator : default_node_allocator<Node> {
+    static inline std::atomic<long long> live = 0;
+
+    template <typename... Args>
+    Node* create(Args&&... args) {
+        ++live;
+        return default_node_allocator<Node>::create(std::forward<Args>(args)...);
+    }
+
+    void destroy(Node* node) {
+        --live;
+        default_node_allocator<Node>::destroy(node);
+    }
+};
+
+template <typename Tree>
+class PersistentTreeTest: public ::testing::Test {};
+
+template <typename Tree>
+class PersistentImplicitTreeTest: public ::testing::Test {};
+
+typedef ::testing::Types<   persistent_treap<persistent_treap_node<int, int>, counting_node_allocator<persistent_treap_node<int, int>>>,
+                            persistent_avl<persistent_avl_node<int, int>, counting_node_allocator<persistent_avl_node<int, int>>> > PersistentTreeTypes;
+typedef ::testing::Types<   persistent_treap<persistent_treap_implicit_node<int>>,
+                            persistent_avl<persistent_avl_implicit_node<int>> > PersistentImplicitTreeTypes;
+TYPED_TEST_SUITE(PersistentTreeTest, PersistentTreeTypes);
+TYPED_TEST_SUITE(PersistentImplicitTreeTest, PersistentImplicitTreeTypes);
+
+template <typename Tree>
+class ShardedTreeTest: public ::testing::Test {};
+
+typedef ::testing::Types<   treap<treap_node<int, int>>, AVL<avl_node<int, int>>,
+                            rb_tree<rb_node<int, int>>, splay_tree<splay_node<int, int>>,
+                            wb_tree<wb_node<int, int>>, scapegoat_tree<scapegoat_node<int, int>> > ShardedTreeTypes;
+TYPED_TEST_SUITE(ShardedTreeTest, ShardedTreeTypes);
+
+TEST(CompactNodeTest, LayoutTest) {
+    static_assert(sizeof(treap_compact_node<int, int>) < sizeof(treap_node<int, int>));
+    static_assert(sizeof(avl_compact_node<int, int>) < sizeof(avl_node<int, int>));
+    static_assert(sizeof(rb_compact_node<int, int>) < sizeof(rb_node<int, int>));
+    static_assert(sizeof(splay_compact_node<int, int>) <= 4 * sizeof(void*));
+    static_assert(sizeof(treap_key_node<int>) <= 4 * sizeof(void*));
+    static_assert(sizeof(rb_node<int, int>) <= 6 * sizeof(void*));
+}
 
 TYPED_TEST(SearchTreeTest, SimpleTest) {
     TypeParam tree;
@@ -84,21 +186,386 @@ TYPED_TEST(SearchTreeTest, BigTest) {
     }
 }
 
-TYPED_TEST(SearchTreeTest, PerfomanceTest) {
+TYPED_TEST(SearchTreeTest, BuildFromSortedTest) {
     TypeParam tree;
-    srand(0);
+    std::vector<std::pair<int, int>> items;
+    for (int i = 0; i < 1000; ++i) {
+        items.emplace_back(2 * i, i);
+    }
+    tree.build_from_sorted(items.begin(), items.end());
 
-    for (int i = 0; i < 500000; ++i) {
-        int key = rand();
-        if (tree.exists(key)) {
+    ASSERT_EQ(tree.size(), items.size());
+    auto v = tree.get_traversal();
+    for (int i = 0; i < v.size(); ++i) {
+        ASSERT_EQ(v[i]->key, items[i].first);
+        ASSERT_EQ(v[i]->value, items[i].second);
+    }
+
+    std::map<int, int> map(items.begin(), items.end());
+    srand(0);
+    for (int i = 0; i < 20000; ++i) {
+        int key = rand() % 3000;
+        if (map.count(key)) {
             tree.erase(key);
+            map.erase(key);
         } else {
             tree.insert(key, i);
+            map[key] = i;
+        }
+    }
+    ASSERT_EQ(tree.size(), map.size());
+    for (auto [key, value] : map) {
+        ASSERT_EQ(tree.find(key)->value, value);
+    }
+}
+
+TYPED_TEST(SearchTreeTest, BatchTest) {
+    TypeParam tree;
+    std::map<int, int> map;
+    srand(0);
+
+    for (int round = 0; round < 200; ++round) {
+        std::vector<std::pair<int, int>> batch;
+        std::vector<int> keys;
+        for (int i = 0; i < 300; ++i) {
+            int key = rand() % 5000;
+            batch.emplace_back(key, round);
+            if (!map.count(key)) map[key] = round;
+            keys.push_back(rand() % 5000);
+        }
+        tree.insert_batch(batch.begin(), batch.end());
+        ASSERT_EQ(tree.size(), map.size());
+
+        if (round % 2) {
+            tree.erase_batch(keys.begin(), keys.end());
+            for (int key : keys) map.erase(key);
+            ASSERT_EQ(tree.size(), map.size());
+        }
+    }
+
+    for (auto [key, value] : map) {
+        ASSERT_EQ(tree.find(key)->value, value);
+    }
+    auto v = tree.get_traversal();
+    for (int i = 0; i + 1 < v.size(); ++i) {
+        ASSERT_TRUE(v[i]->key < v[i + 1]->key);
+    }
+}
+
+TYPED_TEST(SearchTreeTest, SetOperationsTest) {
+    srand(0);
+    for (int round = 0; round < 50; ++round) {
+        for (int op = 0; op < 3; ++op) {
+            TypeParam a, b;
+            std::map<int, int> map_a, map_b;
+            int count_a = rand() % 2000, count_b = rand() % 200;
+            for (int i = 0; i < count_a; ++i) {
+                int key = rand() % 4000;
+                if (!map_a.count(key)) a.insert(key, 0), map_a[key] = 0;
+            }
+            for (int i = 0; i < count_b; ++i) {
+                int key = rand() % 4000;
+                if (!map_b.count(key)) b.insert(key, 1), map_b[key] = 1;
+            }
+
+            std::map<int, int> expected;
+            if (op == 0) {
+                a.set_union(b);
+                expected = map_b;
+                for (auto [key, value] : map_a) expected[key] = value;
+            } else if (op == 1) {
+                a.set_intersection(b);
+                for (auto [key, value] : map_a) {
+                    if (map_b.count(key)) expected[key] = value;
+                }
+            } else {
+                a.set_difference(b);
+                for (auto [key, value] : map_a) {
+                    if (!map_b.count(key)) expected[key] = value;
+                }
+            }
+
+            ASSERT_EQ(b.root, nullptr);
+            ASSERT_EQ(a.size(), expected.size());
+            auto v = a.get_traversal();
+            int i = 0;
+            for (auto [key, value] : expected) {
+                ASSERT_EQ(v[i]->key, key);
+                ASSERT_EQ(v[i]->value, value);
+                ++i;
+            }
+            a.clear();
+        }
+    }
+}
+
+TYPED_TEST(SearchTreeTest, ParallelTest) {
+    parallel_policy policy(8, 64);
+    std::vector<std::pair<int, int>> items;
+    for (int i = 0; i < 100000; ++i) {
+        items.emplace_back(i, i % 7);
+    }
+
+    TypeParam tree;
+    tree.build_from_sorted(items.begin(), items.end(), policy);
+    ASSERT_EQ(tree.size(), items.size());
+
+    tree.for_each([](auto* node) { node->value += 1; }, policy);
+    long long sum = tree.reduce(0LL, [](auto* node) { return (long long) node->value; },
+                                [](long long a, long long b) { return a + b; }, policy);
+    long long expected = 0;
+    for (auto [key, value] : items) expected += value + 1;
+    ASSERT_EQ(sum, expected);
+
+    TypeParam other;
+    std::vector<std::pair<int, int>> odd;
+    for (int i = 1; i < 300000; i += 2) {
+        odd.emplace_back(i, -1);
+    }
+    other.build_from_sorted(odd.begin(), odd.end());
+    tree.set_union(other, policy);
+    ASSERT_EQ(tree.size(), 100000 / 2 + odd.size());
+
+    tree.filter([](auto* node) { return node->key % 3 == 0; }, policy);
+    std::vector<std::pair<int, int>> expected_items;
+    for (int key = 0; key < 300000; key += 3) {
+        if (key < 100000) expected_items.emplace_back(key, key % 7 + 1);
+        else if (key % 2) expected_items.emplace_back(key, -1);
+    }
+    auto v = tree.get_traversal(policy);
+    ASSERT_EQ(v.size(), expected_items.size());
+    for (int i = 0; i < v.size(); ++i) {
+        ASSERT_EQ(v[i]->key, expected_items[i].first);
+        ASSERT_EQ(v[i]->value, expected_items[i].second);
+    }
+
+    ASSERT_EQ(tree.find(3000)->key, 3000);
+    tree.erase(3000);
+    tree.insert(3001, 0);
+    ASSERT_EQ(tree.size(), expected_items.size());
+    tree.clear(policy);
+    ASSERT_EQ(tree.size(), 0);
+}
+
+TYPED_TEST(SearchTreeTest, IteratorTest) {
+    static_assert(std::bidirectional_iterator<typename TypeParam::iterator>);
+    TypeParam tree;
+    std::map<int, int> map;
+    ASSERT_TRUE(tree.begin() == tree.end());
+
+    srand(0);
+    for (int i = 0; i < 10000; ++i) {
+        int key = rand() % 20000;
+        if (map.count(key)) continue;
+        tree.insert(key, i);
+        map[key] = i;
+    }
+
+    auto expected = map.begin();
+    for (auto& node : tree) {
+        ASSERT_EQ(node.key, expected->first);
+        ASSERT_EQ(node.value, expected->second);
+        ++expected;
+    }
+    ASSERT_TRUE(expected == map.end());
+
+    auto it = tree.end();
+    for (auto rit = map.rbegin(); rit != map.rend(); ++rit) {
+        --it;
+        ASSERT_EQ(it->key, rit->first);
+    }
+    ASSERT_TRUE(it == tree.begin());
+
+    for (int key = -1; key <= 20001; key += 7) {
+        auto lower = tree.lower_bound(key);
+        auto upper = tree.upper_bound(key);
+        auto map_lower = map.lower_bound(key);
+        auto map_upper = map.upper_bound(key);
+        ASSERT_EQ(lower == tree.end(), map_lower == map.end());
+        ASSERT_EQ(upper == tree.end(), map_upper == map.end());
+        if (map_lower != map.end()) {
+            ASSERT_EQ(lower->key, map_lower->first);
+        }
+        if (map_upper != map.end()) {
+            ASSERT_EQ(upper->key, map_upper->first);
+        }
+        if (map_lower != map.begin()) {
+            ASSERT_EQ((--lower)->key, std::prev(map_lower)->first);
+        }
+        if (map_upper != map.end() && std::next(map_upper) != map.end()) {
+            ASSERT_EQ((++upper)->key, std::next(map_upper)->first);
+        }
+    }
+    tree.clear();
+}
+
+TYPED_TEST(SearchTreeTest, FreezeTest) {
+    TypeParam tree;
+    std::map<int, int> map;
+    ASSERT_EQ(tree.freeze().find(0), nullptr);
+
+    srand(0);
+    for (int i = 0; i < 10000; ++i) {
+        int key = rand() % 30000;
+        if (map.count(key)) continue;
+        tree.insert(key, i);
+        map[key] = i;
+    }
+
+    auto frozen = tree.freeze();
+    ASSERT_EQ(frozen.size(), map.size());
+    ASSERT_EQ(frozen.get_min()->key, map.begin()->first);
+    int rank = 0;
+    for (auto [key, value] : map) {
+        ASSERT_EQ(frozen.get_kth(rank)->key, key);
+        ASSERT_EQ(frozen.get_kth(rank)->value, value);
+        ++rank;
+    }
+    ASSERT_EQ(frozen.get_kth(rank), nullptr);
+
+    for (int key = -1; key <= 30001; ++key) {
+        auto lower = map.lower_bound(key);
+        auto upper = map.upper_bound(key);
+        auto found = frozen.find(key);
+        if (lower != map.end() && lower->first == key) {
+            ASSERT_NE(found, nullptr);
+            ASSERT_EQ(found->value, lower->second);
+        } else {
+            ASSERT_EQ(found, nullptr);
+        }
+        ASSERT_EQ(frozen.order_of_key(key), std::distance(map.begin(), lower));
+        ASSERT_EQ(frozen.next(key) ? frozen.next(key)->key : -2, upper != map.end() ? upper->first : -2);
+        ASSERT_EQ(frozen.prev(key) ? frozen.prev(key)->key : -2, lower != map.begin() ? std::prev(lower)->first : -2);
+    }
+
+    tree.clear();
+    ASSERT_EQ(frozen.size(), map.size());
+    ASSERT_TRUE(std::equal(frozen.begin(), frozen.end(), map.begin(),
+                           [](auto& node, auto& item) { return node.key == item.first; }));
+}
+
+TYPED_TEST(SearchTreeTest, SaveLoadTest) {
+    TypeParam tree;
+    srand(0);
+    for (int i = 0; i < 10000; ++i) {
+        tree.insert(rand() % 20000, i);
+    }
+
+    std::stringstream stream;
+    ASSERT_TRUE(save(tree, stream));
+    TypeParam loaded;
+    ASSERT_TRUE(load(loaded, stream));
+    ASSERT_EQ(loaded.size(), tree.size());
+    auto it = loaded.begin();
+    for (auto& node : tree) {
+        ASSERT_EQ(it->key, node.key);
+        ASSERT_EQ(it->value, node.value);
+        ++it;
+    }
+    ASSERT_EQ(loaded.get_kth(loaded.size() / 2)->key, tree.get_kth(tree.size() / 2)->key);
+
+    std::stringstream truncated(stream.str().substr(0, 100));
+    ASSERT_FALSE(load(loaded, truncated));
+    ASSERT_EQ(loaded.size(), 0);
+    std::stringstream foreign("not a dump");
+    ASSERT_FALSE(load(loaded, foreign));
+
+    // A corrupted count runs into the end of the stream instead of being allocated up front.
+    std::string dump = stream.str();
+    uint64_t huge_count = uint64_t(1) << 60;
+    std::memcpy(dump.data() + offsetof(tree_dump_header, count), &huge_count, sizeof(huge_count));
+    std::stringstream corrupted(dump);
+    ASSERT_FALSE(load(loaded, corrupted));
+    ASSERT_EQ(loaded.size(), 0);
+    tree.clear();
+}
+
+TYPED_TEST(SearchTreeTest, FrozenFileTest) {
+    TypeParam tree;
+    srand(0);
+    for (int i = 0; i < 10000; ++i) {
+        tree.insert(rand() % 20000, i);
+    }
+    auto frozen = tree.freeze();
+
+    std::string path = ::testing::TempDir() + "frozen_file_test.bin";
+    {
+        std::ofstream out(path, std::ios::binary);
+        ASSERT_TRUE(frozen.save(out));
+    }
+
+    decltype(frozen) mapped, loaded;
+    ASSERT_TRUE(mapped.map(path.c_str()));
+    std::ifstream in(path, std::ios::binary);
+    ASSERT_TRUE(loaded.load(in));
+    for (auto* copy : {&mapped, &loaded}) {
+        ASSERT_EQ(copy->size(), frozen.size());
+        for (int key = -1; key <= 20001; key += 3) {
+            ASSERT_EQ(copy->exists(key), frozen.exists(key));
+            ASSERT_EQ(copy->order_of_key(key), frozen.order_of_key(key));
+            if (frozen.exists(key)) {
+                ASSERT_EQ(copy->find(key)->value, frozen.find(key)->value);
+            }
+        }
+        for (size_t k = 0; k < frozen.size(); k += 11) {
+            ASSERT_EQ(copy->get_kth(k)->key, frozen.get_kth(k)->key);
         }
     }
-    while (tree.size() > 0) {
-        tree.erase(tree.get_kth(rand() % tree.size())->key);
+    std::remove(path.c_str());
+    ASSERT_FALSE(mapped.map(path.c_str()));
+    ASSERT_EQ(mapped.size(), 0);
+
+    // A header with a huge count and matching section offsets, followed by too little data.
+    std::stringstream saved;
+    ASSERT_TRUE(frozen.save(saved));
+    std::string snapshot = saved.str();
+    uint64_t fields[4];  // count, keys_offset, ranks_offset, nodes_offset
+    std::memcpy(fields, snapshot.data() + 24, sizeof(fields));
+    auto align_up = [](uint64_t offset) { return (offset + 63) / 64 * 64; };
+    fields[0] = uint64_t(1) << 31;
+    fields[2] = align_up(fields[1] + (fields[0] + 1) * sizeof(typename decltype(frozen)::key_t));
+    fields[3] = align_up(fields[2] + (fields[0] + 1) * sizeof(uint32_t));
+    std::memcpy(snapshot.data() + 24, fields, sizeof(fields));
+    std::stringstream corrupted(snapshot);
+    ASSERT_FALSE(loaded.load(corrupted));
+    ASSERT_EQ(loaded.size(), 0);
+    tree.clear();
+}
+
+TYPED_TEST(SearchTreeTest, RangeScanTest) {
+    TypeParam tree;
+    std::map<int, int> map;
+    srand(0);
+    for (int i = 0; i < 10000; ++i) {
+        int key = rand() % 20000;
+        if (map.count(key)) continue;
+        tree.insert(key, i);
+        map[key] = i;
+    }
+    std::vector<int> keys;
+    for (auto [key, value] : map) keys.push_back(key);
+
+    for (int i = 0; i < 100; ++i) {
+        int lo = rand() % 20000 - 10, hi = lo + rand() % 3000;
+        std::vector<int> visited, expected;
+        tree.for_each_in_range(lo, hi, [&](auto& node) { visited.push_back(node.key); });
+        for (auto it = map.lower_bound(lo); it != map.end() && it->first <= hi; ++it) expected.push_back(it->first);
+        ASSERT_EQ(visited, expected);
+
+        size_t l = rand() % keys.size(), r = l + rand() % 500;
+        visited.clear();
+        tree.for_each_kth_range(l, r, [&](auto& node) { visited.push_back(node.key); });
+        ASSERT_EQ(visited, std::vector<int>(keys.begin() + l, keys.begin() + std::min(r + 1, keys.size())));
     }
+
+    size_t count = 0;
+    tree.for_each_in_range(INT_MIN, INT_MAX, [&](auto&) { return ++count < 10; });
+    ASSERT_EQ(count, 10);
+    count = 0;
+    tree.for_each_kth_range(5, 4, [&](auto&) { ++count; });
+    tree.for_each_in_range(1, 0, [&](auto&) { ++count; });
+    ASSERT_EQ(count, 0);
+    tree.clear();
 }
 
 TYPED_TEST(ImplicitTreeTest, SimpleTest) {
@@ -138,6 +605,24 @@ TYPED_TEST(ImplicitTreeTest, CutTest) {
     ASSERT_EQ(tree.get_kth(3)->value, -1);
 }
 
+TYPED_TEST(ImplicitTreeTest, SaveLoadTest) {
+    TypeParam tree;
+    for (int i = 0; i < 5000; ++i) {
+        tree.insert_kth(i / 2, i);
+    }
+
+    std::stringstream stream;
+    ASSERT_TRUE(save(tree, stream));
+    TypeParam loaded;
+    ASSERT_TRUE(load(loaded, stream));
+    ASSERT_EQ(loaded.size(), tree.size());
+    for (size_t i = 0; i < tree.size(); i += 7) {
+        ASSERT_EQ(loaded.get_kth(i)->value, tree.get_kth(i)->value);
+    }
+    tree.clear();
+    loaded.clear();
+}
+
 TYPED_TEST(ImplicitTreeTest, BigTest) {
     TypeParam tree;
     std::vector<int> values;
@@ -164,20 +649,24 @@ TYPED_TEST(ImplicitTreeTest, BigTest) {
     }
 }
 
-TYPED_TEST(ImplicitTreeTest, PerfomanceTest) {
+TYPED_TEST(ImplicitTreeTest, BuildFromSortedTest) {
     TypeParam tree;
-    srand(0);
+    std::vector<int> values;
+    for (int i = 0; i < 1000; ++i) {
+        values.push_back(rand());
+    }
+    tree.build_from_sorted(values.begin(), values.end());
 
-    for (int i = 0; i < 500000; ++i) {
-        int type = rand() % 3;
-        if (type <= 1) {
-            int val = rand();
-            int pos = rand() % (tree.size() + 1);
-            tree.insert_kth(pos, val);
-        } else {
-            int pos = rand() % tree.size();
-            tree.erase_kth(pos);
-        }
+    for (int i = 0; i < 1000; ++i) {
+        int pos = rand() % (values.size() + 1);
+        tree.insert_kth(pos, i);
+        values.insert(values.begin() + pos, i);
+        pos = rand() % values.size();
+        tree.erase_kth(pos);
+        values.erase(values.begin() + pos);
+    }
+    for (int i = 0; i < values.size(); ++i) {
+        ASSERT_EQ(tree.get_kth(i)->value, values[i]);
     }
 }
 
@@ -188,6 +677,354 @@ void reverse_segment(Tree& tree, int l, int r) {
     tree.insert_subsegment(l, node);
 }
 
+template <typename Tree>
+void check_split_merge() {
+    Tree tree;
+    std::vector<typename Tree::key_t> keys;
+    srand(0);
+    for (int i = 0; i < 5000; ++i) {
+        keys.push_back(rand() % 100000);
+        tree.insert(keys.back(), i);
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    for (int round = 0; round < 200; ++round) {
+        auto key = rand() % 100001;
+        auto [left, right] = Tree::split(tree.root, key);
+        Tree a = {left}, b = {right};
+        size_t expected = std::lower_bound(keys.begin(), keys.end(), key) - keys.begin();
+        ASSERT_EQ(a.size(), expected);
+        ASSERT_EQ(b.size(), keys.size() - expected);
+        if (a.size()) {
+            ASSERT_TRUE(a.get_kth(a.size() - 1)->key < key);
+        }
+        if (b.size()) {
+            ASSERT_FALSE(b.get_min()->key < key);
+        }
+        tree.root = Tree::merge(a.root, b.root);
+        ASSERT_EQ(tree.order_of_key(key), expected);
+    }
+
+    size_t i = 0;
+    for (auto& node : tree) {
+        ASSERT_EQ(node.key, keys[i++]);
+    }
+    ASSERT_EQ(i, keys.size());
+    tree.clear();
+}
+
+// A treap degenerated into a chain by its priorities: deeper than any stack of recursive calls.
+TEST(TreapTest, DeepTreeTest) {
+    const int n = 1000000;
+    treap<treap_node<int, int>> tree;
+    std::vector<treap_node<int, int>*> chain(n);
+    for (int i = 0; i < n; ++i) {
+        chain[i] = tree.allocator.create(i, i);
+        chain[i]->priority = n - i;
+    }
+    for (int i = n - 1; i >= 0; --i) {
+        chain[i]->right = i + 1 < n ? chain[i + 1] : nullptr;
+        chain[i]->update();
+    }
+    tree.root = chain[0];
+
+    auto [left, right] = decltype(tree)::split(tree.root, n / 2);
+    ASSERT_EQ(get_size(left), size_t(n / 2));
+    ASSERT_EQ(get_size(right), size_t(n - n / 2));
+    tree.root = decltype(tree)::merge(left, right);
+    ASSERT_EQ(tree.size(), size_t(n));
+
+    tree.erase(n - 1);
+    tree.insert(n - 1, 0);
+    auto [first, rest] = decltype(tree)::split_k(tree.root, n - 1);
+    ASSERT_EQ(get_size(first), size_t(n - 1));
+    tree.root = decltype(tree)::merge(first, rest);
+
+    auto traversal = tree.get_traversal();
+    ASSERT_EQ(traversal.size(), size_t(n));
+    for (int i = 0; i < n; ++i) ASSERT_EQ(traversal[i]->key, i);
+    tree.clear();
+}
+
+// Mostly increasing keys, appended through end(), with late arrivals inserted next to a hint
+// that is close (lower_bound) or far (begin) from their position.
+template <typename Tree>
+void check_hinted_insert() {
+    Tree tree;
+    std::map<int, int> map;
+    std::mt19937 gen(0);
+    for (int i = 0; i < 20000; ++i) {
+        int key = 10 * i;
+        auto hint = tree.end();
+        if (i % 7 == 3) {
+            key = 10 * int(gen() % (i + 1)) + 5;
+            hint = i % 2 ? tree.lower_bound(key) : tree.begin();
+        }
+        if (map.count(key)) continue;
+        tree.insert(hint, key, i);
+        map[key] = i;
+    }
+
+    ASSERT_EQ(tree.size(), map.size());
+    size_t k = 0;
+    for (auto [key, value] : map) {
+        ASSERT_EQ(tree.find(key)->value, value);
+        if (k % 101 == 0) {
+            ASSERT_EQ(tree.get_kth(k)->key, key);
+        }
+        ++k;
+    }
+    std::vector<int> traversal;
+    for (auto* node : tree.get_traversal()) traversal.push_back(node->key);
+    std::vector<int> expected;
+    for (auto [key, value] : map) expected.push_back(key);
+    ASSERT_EQ(traversal, expected);
+    tree.clear();
+}
+
+TEST(HintedInsertTest, SequentialTest) {
+    check_hinted_insert<treap<treap_node<int, int>>>();
+    check_hinted_insert<AVL<avl_node<int, int>>>();
+    check_hinted_insert<rb_tree<rb_node<int, int>>>();
+    check_hinted_insert<wb_tree<wb_node<int, int>>>();
+    check_hinted_insert<scapegoat_tree<scapegoat_node<int, int>>>();
+}
+
+// Returns the height after checking the AVL balance and the augmented fields.
+template <typename Node>
+int check_avl(Node* node) {
+    if (node == nullptr) return 0;
+    int left_height = check_avl(node->left);
+    int right_height = check_avl(node->right);
+    EXPECT_LE(std::abs(left_height - right_height), 1);
+    EXPECT_EQ(node->height, 1 + std::max(left_height, right_height));
+    EXPECT_EQ(node->size, 1 + get_size(node->left) + get_size(node->right));
+    return node->height;
+}
+
+template <typename Node>
+void check_heap(Node* node) {
+    if (node == nullptr) return;
+    for (Node* child : {node->left, node->right}) {
+        if (child != nullptr) {
+            EXPECT_LE(child->priority, node->priority);
+        }
+    }
+    EXPECT_EQ(node->size, 1 + get_size(node->left) + get_size(node->right));
+    check_heap(node->left);
+    check_heap(node->right);
+}
+
+// Random keys inserted next to hints anywhere in the tree, so the finger search climbs from
+// every kind of position.
+template <typename Tree, typename Check>
+void check_random_hints(Check check) {
+    Tree tree;
+    std::map<int, int> map;
+    std::mt19937 gen(1);
+    for (int i = 0; i < 20000; ++i) {
+        int key = int(gen() % 100000);
+        auto hint = gen() % 4 == 0 ? tree.end() : tree.lower_bound(int(gen() % 100000));
+        if (map.count(key)) continue;
+        tree.insert(hint, key, i);
+        map[key] = i;
+    }
+    check(tree.root);
+
+    std::vector<int> traversal;
+    for (auto* node : tree.get_traversal()) traversal.push_back(node->key);
+    std::vector<int> expected;
+    for (auto [key, value] : map) expected.push_back(key);
+    ASSERT_EQ(traversal, expected);
+    tree.clear();
+}
+
+TEST(HintedInsertTest, RandomHintTest) {
+    check_random_hints<treap<treap_node<int, int>>>([](auto* root) { check_heap(root); });
+    check_random_hints<AVL<avl_node<int, int>>>([](auto* root) { check_avl(root); });
+
+    // A key already in the tree is found from any hint.
+    AVL<avl_node<int, int>> tree;
+    for (int i = 0; i < 1000; ++i) tree.insert(i, i);
+    for (int i = 0; i < 1000; i += 7) {
+        tree.insert(tree.lower_bound((i * 31) % 1000), i, -i);
+        tree.insert(tree.end(), i, -i);
+        tree.insert(tree.begin(), i, -i);
+    }
+    ASSERT_EQ(tree.size(), 1000);
+    ASSERT_EQ(tree.find(994)->value, 994);
+    tree.clear();
+}
+
+template <typename Node>
+size_t subtree_depth(Node* node) {
+    return node == nullptr ? 0 : 1 + std::max(subtree_depth(node->left), subtree_depth(node->right));
+}
+
+// Both engines balance on subtree sizes alone; sorted inserts, erases and joins of lopsided
+// parts must keep the depth logarithmic.
+template <typename Tree>
+void check_size_balance() {
+    const int n = 1 << 16;
+    const size_t max_depth = 2 * 16;
+    Tree tree;
+    for (int i = 0; i < n; ++i) tree.insert(i, i);
+    ASSERT_LE(subtree_depth(tree.root), max_depth);
+    for (int i = 0; i < n; i += 2) tree.erase(i);
+    ASSERT_LE(subtree_depth(tree.root), max_depth);
+
+    auto [left, right] = Tree::split_k(tree.root, 10);
+    tree.root = Tree::merge(left, right);
+    for (int i = 0; i < 1000; ++i) {
+        auto [head, tail] = Tree::split_k(tree.root, 1);
+        tree.root = Tree::merge(tail, head);
+    }
+    ASSERT_EQ(tree.size(), size_t(n / 2));
+    ASSERT_LE(subtree_depth(tree.root), max_depth);
+    tree.clear();
+}
+
+TEST(SizeBalancedTreeTest, DepthTest) {
+    check_size_balance<wb_tree<wb_node<int, int>>>();
+    check_size_balance<scapegoat_tree<scapegoat_node<int, int>>>();
+}
+
+// Records every update() and push() call, so an operation can be checked to recompute each
+// node it touches only once.
+template <typename Key, typename Node>
+struct recording_rb_node_template : rb_node_template<Key, Node> {
+    using rb_node_template<Key, Node>::rb_node_template;
+    static inline std::vector<const void*> updated, pushed;
+
+    void update() {
+        updated.push_back(this);
+        rb_node_template<Key, Node>::update();
+    }
+
+    void push() {
+        pushed.push_back(this);
+    }
+};
+
+// Returns the black height after checking colours, parent links and the augmented fields.
+template <typename Node>
+int check_red_black(Node* node) {
+    if (node == nullptr) return 1;
+    for (Node* child : {node->left, node->right}) {
+        if (child == nullptr) continue;
+        EXPECT_EQ(child->parent, node);
+        EXPECT_TRUE(node->black || child->black);
+    }
+    int left_height = check_red_black(node->left);
+    int right_height = check_red_black(node->right);
+    EXPECT_EQ(left_height, right_height);
+    EXPECT_EQ(node->black_height, left_height + node->black);
+    EXPECT_EQ(node->size, 1 + get_size(node->left) + get_size(node->right));
+    return left_height + node->black;
+}
+
+TEST(RbTreeTest, SingleUpdateTest) {
+    using node_t = common_node<recording_rb_node_template, int, int>;
+    auto& updated = recording_rb_node_template<int, node_t>::updated;
+    auto& pushed = recording_rb_node_template<int, node_t>::pushed;
+    auto each_once = [](std::vector<const void*> calls) {
+        std::sort(calls.begin(), calls.end());
+        return std::adjacent_find(calls.begin(), calls.end()) == calls.end();
+    };
+
+    rb_tree<node_t> tree;
+    std::mt19937 gen(0);
+    for (int i = 0; i < 5000; ++i) {
+        updated.clear();
+        pushed.clear();
+        tree.insert(int(gen() % 100000), i);
+        ASSERT_TRUE(each_once(updated));
+        ASSERT_TRUE(each_once(pushed));
+    }
+    for (int i = 0; i < 1000; ++i) {
+        updated.clear();
+        pushed.clear();
+        tree.insert(tree.end(), 100000 + i, i);
+        ASSERT_TRUE(each_once(updated));
+        ASSERT_TRUE(each_once(pushed));
+    }
+    check_red_black(tree.root);
+
+    // Merging a single node in front is one join along the left spine; the node itself also
+    // passes through the split in merge, so only the tree it is joined to is checked.
+    for (int i = 0; i < 1000; ++i) {
+        node_t* first = tree.allocator.create(-1 - i, i);
+        updated.clear();
+        tree.root = rb_tree<node_t>::merge(first, tree.root);
+        std::erase(updated, first);
+        ASSERT_TRUE(each_once(updated));
+    }
+    check_red_black(tree.root);
+
+    for (int i = 0; i < 200; ++i) {
+        size_t k = gen() % tree.size();
+        auto [left, right] = rb_tree<node_t>::split_k(tree.root, k);
+        check_red_black(left);
+        check_red_black(right);
+        tree.root = rb_tree<node_t>::merge(left, right);
+        tree.erase(tree.get_kth(gen() % tree.size())->key);
+    }
+    check_red_black(tree.root);
+    tree.clear();
+}
+
+// Hashed priorities make the shape a function of the key set alone.
+TEST(TreapTest, HashedPriorityTest) {
+    std::vector<int> keys(10000);
+    for (int i = 0; i < int(keys.size()); ++i) keys[i] = i * 7;
+    std::mt19937 gen(0);
+    std::shuffle(keys.begin(), keys.end(), gen);
+
+    treap<treap_hashed_node<int, int>> a, b;
+    for (int key : keys) a.insert(key, 0);
+    for (auto it = keys.rbegin(); it != keys.rend(); ++it) b.insert(*it, 0);
+    for (int i = 0; i < 100; ++i) {
+        a.erase(keys[i]);
+        b.insert(keys[i] + 1, 0);
+        b.erase(keys[i]);
+        b.erase(keys[i] + 1);
+    }
+
+    std::vector<std::pair<int, int>> shape_a, shape_b;
+    for (auto& node : a) shape_a.emplace_back(node.key, int(node.size));
+    for (auto& node : b) shape_b.emplace_back(node.key, int(node.size));
+    ASSERT_EQ(shape_a, shape_b);
+    ASSERT_EQ(a.root->key, b.root->key);
+    a.clear();
+    b.clear();
+
+    // Bulk builds keep the priorities of the keys, so they give the same shape as inserts.
+    std::vector<std::pair<int, int>> items;
+    for (int i = 0; i < 10000; ++i) items.emplace_back(i * 7, 0);
+    treap<treap_hashed_node<int, int>> c, d;
+    for (int key : keys) c.insert(key, 0);
+    d.build_from_sorted(items.begin(), items.end(), parallel_policy(8, 64));
+    for (int i = 0; i < 100; ++i) {
+        c.erase(keys[i]);
+        d.erase(keys[i]);
+        c.insert(keys[i] + 1, 0);
+        d.insert(keys[i] + 1, 0);
+    }
+    std::vector<std::pair<int, int>> shape_c, shape_d;
+    for (auto& node : c) shape_c.emplace_back(node.key, int(node.size));
+    for (auto& node : d) shape_d.emplace_back(node.key, int(node.size));
+    ASSERT_EQ(shape_c, shape_d);
+    c.clear();
+    d.clear();
+}
+
+TEST(BTreeTest, SplitMergeTest) {
+    check_split_merge<btree<btree_node<int, int>>>();
+    check_split_merge<btree<btree_node<int, int>, 4, 2>>();
+    check_split_merge<btree<btree_node<long long, int>, 5, 3>>();
+}
+
 TYPED_TEST(ReverseTreeTest, SimpleTest) {
     TypeParam tree;
 
@@ -239,3 +1076,500 @@ TYPED_TEST(ReverseTreeTest, BigTest) {
         ASSERT_EQ(tree.get_kth(i)->value, values[i]);
     }
 }
+
+TYPED_TEST(ReverseTreeTest, IteratorTest) {
+    TypeParam tree;
+    std::vector<int> values;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert_kth(i, i);
+        values.push_back(i);
+    }
+
+    srand(0);
+    for (int i = 0; i < 100; ++i) {
+        int l = rand() % 1000;
+        int r = l + rand() % (1000 - l);
+        reverse_segment(tree, l, r);
+        std::reverse(values.begin() + l, values.begin() + r + 1);
+
+        std::vector<int> forward, backward;
+        for (auto& node : tree) forward.push_back(node.value);
+        for (auto it = tree.end(); it != tree.begin();) backward.push_back((--it)->value);
+        std::reverse(backward.begin(), backward.end());
+        ASSERT_EQ(forward, values);
+        ASSERT_EQ(backward, values);
+    }
+}
+
+TYPED_TEST(ReverseTreeTest, KthRangeTest) {
+    TypeParam tree;
+    std::vector<int> values;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert_kth(i, i);
+        values.push_back(i);
+    }
+
+    srand(0);
+    for (int i = 0; i < 100; ++i) {
+        int l = rand() % 1000;
+        int r = l + rand() % (1000 - l);
+        reverse_segment(tree, l, r);
+        std::reverse(values.begin() + l, values.begin() + r + 1);
+
+        l = rand() % 1000;
+        r = l + rand() % (1000 - l);
+        std::vector<int> visited;
+        tree.for_each_kth_range(l, r, [&](auto& node) { visited.push_back(node.value); });
+        ASSERT_EQ(visited, std::vector<int>(values.begin() + l, values.begin() + r + 1));
+    }
+}
+
+TYPED_TEST(PoolAllocatorTest, ChurnTest) {
+    TypeParam tree;
+    std::map<int, int> map;
+    srand(0);
+
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 50000; ++i) {
+            int key = rand() % 1000;
+            if (map.count(key)) {
+                ASSERT_TRUE(tree.exists(key));
+                tree.erase(key);
+                map.erase(key);
+            } else {
+                tree.insert(key, i);
+                map[key] = i;
+            }
+        }
+        ASSERT_EQ(tree.size(), map.size());
+        for (auto [key, value] : map) {
+            ASSERT_EQ(tree.find(key)->value, value);
+        }
+        tree.clear();
+        map.clear();
+        ASSERT_EQ(tree.size(), 0);
+    }
+}
+
+TYPED_TEST(PoolAllocatorTest, SharedPoolTest) {
+    TypeParam tree;
+    for (int i = 0; i < 100; ++i) {
+        tree.insert(i, i);
+    }
+
+    auto [left, right] = TypeParam::split(tree.root, 50);
+    tree.root = left;
+    TypeParam other = {right, tree.allocator};
+
+    other.erase(75);
+    tree.clear();
+    ASSERT_EQ(other.size(), 49);
+    ASSERT_EQ(other.get_min()->key, 50);
+    ASSERT_FALSE(other.exists(75));
+
+    other.clear();
+}
+
+// An out-of-range erase_kth leaves the tree and the pool's free list untouched.
+template <typename Tree>
+void check_erase_kth_out_of_range() {
+    Tree tree;
+    tree.insert(1, 1);
+    tree.erase_kth(5);
+    ASSERT_EQ(tree.size(), 1);
+    tree.insert(2, 2);
+    tree.insert(3, 3);
+    ASSERT_EQ(tree.size(), 3);
+    ASSERT_EQ(tree.get_kth(2)->key, 3);
+    tree.clear();
+}
+
+TEST(PoolEraseKthTest, OutOfRangeTest) {
+    check_erase_kth_out_of_range<AVL<avl_node<int, int>, pool_node_allocator<avl_node<int, int>>>>();
+    check_erase_kth_out_of_range<rb_tree<rb_node<int, int>, pool_node_allocator<rb_node<int, int>>>>();
+    check_erase_kth_out_of_range<wb_tree<wb_node<int, int>, pool_node_allocator<wb_node<int, int>>>>();
+    check_erase_kth_out_of_range<scapegoat_tree<scapegoat_node<int, int>, pool_node_allocator<scapegoat_node<int, int>>>>();
+}
+
+TYPED_TEST(MonoidTreeTest, SumAddTest) {
+    TypeParam tree;
+    std::vector<long long> values;
+    srand(0);
+
+    for (int i = 0; i < 20000; ++i) {
+        int type = rand() % 6;
+        if (type <= 1 || values.size() <= 1) {
+            long long val = rand() % 1000;
+            int pos = rand() % (values.size() + 1);
+            tree.insert_kth(pos, val);
+            values.insert(values.begin() + pos, val);
+        } else if (type == 2) {
+            int pos = rand() % values.size();
+            tree.erase_kth(pos);
+            values.erase(values.begin() + pos);
+        } else {
+            int l = rand() % values.size();
+            int r = l + rand() % (values.size() - l);
+            if (type == 3) {
+                long long tag = rand() % 100 - 50;
+                tree.apply(l, r, tag);
+                for (int j = l; j <= r; ++j) values[j] += tag;
+            } else {
+                long long expected = 0;
+                for (int j = l; j <= r; ++j) expected += values[j];
+                ASSERT_EQ(tree.query(l, r), expected);
+            }
+        }
+    }
+
+    for (int i = 0; i < values.size(); ++i) {
+        ASSERT_EQ(tree.get_kth(i)->value, values[i]);
+    }
+    tree.clear();
+}
+
+TYPED_TEST(MonoidTreeTest, CutTest) {
+    TypeParam tree;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert_kth(i, (long long) i);
+    }
+
+    auto node = tree.cut_subsegment(100, 199);
+    ASSERT_EQ(node->summary, (100 + 199) * 100 / 2);
+    node->apply(1000LL);
+    tree.insert_subsegment(0, node);
+    ASSERT_EQ(tree.query(0, 99), (1100 + 1199) * 100 / 2);
+    ASSERT_EQ(tree.query(100, 199), (0 + 99) * 100 / 2);
+    ASSERT_EQ(tree.query(0, 999), 999 * 1000 / 2 + 100 * 1000);
+    ASSERT_EQ(tree.get_kth(0)->value, 1100);
+    tree.clear();
+}
+
+TEST(MonoidNodeTest, PoliciesTest) {
+    AVL<avl_implicit_monoid_node<min_add_policy<int>>> min_tree;
+    AVL<avl_implicit_monoid_node<max_add_policy<int>>> max_tree;
+    treap<treap_implicit_monoid_node<sum_assign_policy<long long>>> assign_tree;
+    std::vector<int> values;
+    srand(0);
+    for (int i = 0; i < 2000; ++i) {
+        int val = rand() % 1000;
+        min_tree.insert_kth(i, val);
+        max_tree.insert_kth(i, val);
+        assign_tree.insert_kth(i, (long long) val);
+        values.push_back(val);
+    }
+
+    for (int i = 0; i < 2000; ++i) {
+        int l = rand() % values.size();
+        int r = l + rand() % (values.size() - l);
+        int tag = rand() % 100 - 50;
+        if (i % 2) {
+            min_tree.apply(l, r, tag);
+            max_tree.apply(l, r, tag);
+            for (int j = l; j <= r; ++j) values[j] += tag;
+        } else {
+            ASSERT_EQ(min_tree.query(l, r), *std::min_element(values.begin() + l, values.begin() + r + 1));
+            ASSERT_EQ(max_tree.query(l, r), *std::max_element(values.begin() + l, values.begin() + r + 1));
+        }
+    }
+
+    assign_tree.apply(0, 1999, 1LL);
+    assign_tree.apply(500, 1499, 3LL);
+    assign_tree.apply(1000, 1099, 0LL);
+    ASSERT_EQ(assign_tree.query(0, 1999), 1000 + 900 * 3);
+    ASSERT_EQ(assign_tree.query(990, 1009), 10 * 3);
+    min_tree.clear();
+    max_tree.clear();
+    assign_tree.clear();
+}
+
+TYPED_TEST(PersistentTreeTest, VersionsTest) {
+    using allocator_t = typename TypeParam::allocator_t;
+    {
+        TypeParam tree;
+        std::vector<TypeParam> versions;
+        std::vector<std::map<int, int>> maps;
+        std::map<int, int> map;
+        srand(0);
+
+        for (int i = 0; i < 20000; ++i) {
+            int key = rand() % 2000;
+            if (map.count(key)) {
+                tree.erase(key);
+                map.erase(key);
+            } else {
+                tree.insert(key, i);
+                map[key] = i;
+            }
+            if (i % 1000 == 0) {
+                versions.push_back(tree.snapshot());
+                maps.push_back(map);
+            }
+        }
+
+        versions.push_back(tree);
+        maps.push_back(map);
+        tree.clear();
+        ASSERT_EQ(tree.size(), 0);
+
+        for (size_t v = 0; v < versions.size(); ++v) {
+            ASSERT_EQ(versions[v].size(), maps[v].size());
+            auto traversal = versions[v].get_traversal();
+            size_t i = 0;
+            for (auto [key, value] : maps[v]) {
+                ASSERT_EQ(traversal[i]->key, key);
+                ASSERT_EQ(traversal[i]->value, value);
+                ASSERT_EQ(versions[v].order_of_key(key), i);
+                ASSERT_EQ(versions[v].get_kth(i)->key, key);
+                ++i;
+            }
+        }
+
+        // An update of a shared version copies one path, not the tree.
+        TypeParam copy = versions.back();
+        long long before = allocator_t::live;
+        copy.insert(-1, 0);
+        ASSERT_LT(allocator_t::live - before, 100);
+        ASSERT_FALSE(versions.back().exists(-1));
+        ASSERT_TRUE(copy.exists(-1));
+        ASSERT_EQ(copy.get_min()->key, -1);
+    }
+    ASSERT_EQ(allocator_t::live, 0);
+}
+
+TYPED_TEST(PersistentTreeTest, SplitMergeTest) {
+    using allocator_t = typename TypeParam::allocator_t;
+    {
+        TypeParam tree;
+        for (int i = 0; i < 1000; ++i) {
+            tree.insert(i, i);
+        }
+
+        auto [left, right] = tree.split(500);
+        ASSERT_EQ(tree.size(), 1000);
+        ASSERT_EQ(left.size(), 500);
+        ASSERT_EQ(right.size(), 500);
+        ASSERT_EQ(right.get_min()->key, 500);
+        ASSERT_EQ(left.next(498)->key, 499);
+        ASSERT_EQ(left.next(499), nullptr);
+        ASSERT_EQ(right.prev(500), nullptr);
+
+        right.erase(700);
+        TypeParam merged = TypeParam::merge(left, right);
+        ASSERT_EQ(merged.size(), 999);
+        ASSERT_FALSE(merged.exists(700));
+        ASSERT_TRUE(tree.exists(700));
+        ASSERT_EQ(merged.get_kth(700)->key, 701);
+        if constexpr (requires { merged.get_root()->height; }) {
+            ASSERT_LE(merged.get_root()->height, 15);
+        }
+    }
+    ASSERT_EQ(allocator_t::live, 0);
+}
+
+TYPED_TEST(PersistentImplicitTreeTest, CutTest) {
+    TypeParam tree;
+    std::vector<int> values;
+    std::vector<TypeParam> versions;
+    std::vector<std::vector<int>> snapshots;
+    srand(0);
+
+    for (int i = 0; i < 20000; ++i) {
+        int type = rand() % 4;
+        if (type <= 1 || values.size() < 2) {
+            int val = rand();
+            int pos = rand() % (values.size() + 1);
+            tree.insert_kth(pos, val);
+            values.insert(values.begin() + pos, val);
+        } else if (type == 2) {
+            int pos = rand() % values.size();
+            tree.erase_kth(pos);
+            values.erase(values.begin() + pos);
+        } else {
+            int l = rand() % values.size();
+            int r = l + rand() % (values.size() - l);
+            TypeParam segment = tree.cut_subsegment(l, r);
+            std::vector<int> cut(values.begin() + l, values.begin() + r + 1);
+            values.erase(values.begin() + l, values.begin() + r + 1);
+            ASSERT_EQ(segment.size(), cut.size());
+
+            int pos = rand() % (values.size() + 1);
+            tree.insert_subsegment(pos, segment);
+            values.insert(values.begin() + pos, cut.begin(), cut.end());
+        }
+        if (i % 2000 == 0) {
+            versions.push_back(tree);
+            snapshots.push_back(values);
+        }
+    }
+
+    for (size_t v = 0; v < versions.size(); ++v) {
+        auto traversal = versions[v].get_traversal();
+        ASSERT_EQ(traversal.size(), snapshots[v].size());
+        for (size_t i = 0; i < traversal.size(); ++i) {
+            ASSERT_EQ(traversal[i]->value, snapshots[v][i]);
+        }
+    }
+    for (size_t i = 0; i < values.size(); ++i) {
+        ASSERT_EQ(tree.get_kth(i)->value, values[i]);
+    }
+}
+
+TEST(ConcurrentTreeTest, ReadersTest) {
+    using node_t = persistent_avl_node<int, int>;
+    using allocator_t = counting_node_allocator<node_t>;
+    {
+        concurrent_tree<persistent_avl<node_t, allocator_t>> tree;
+        const int n = 20000;
+        std::atomic<bool> done = false;
+        std::atomic<bool> consistent = true;
+
+        // The writer inserts 0, 1, 2, ... in order, so every version holds a prefix of them.
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; ++t) {
+            readers.emplace_back([&] {
+                while (!done) {
+                    bool ok = tree.read([](const auto& version) {
+                        size_t size = version.size();
+                        return (size == 0 || version.get_kth(size - 1)->key == int(size) - 1) &&
+                               version.exists(int(size) / 2) == (size > 0) && !version.exists(int(size));
+                    });
+                    auto snapshot = tree.snapshot();
+                    if (!ok || (snapshot.size() > 0 && !snapshot.exists(int(snapshot.size()) - 1))) {
+                        consistent = false;
+                    }
+                }
+            });
+        }
+
+        for (int i = 0; i < n; ++i) {
+            tree.insert(i, i);
+            if (i % 3 == 0) tree.erase(i);
+            if (i % 3 == 0) tree.insert(i, -i);
+        }
+        done = true;
+        for (auto& reader : readers) reader.join();
+
+        ASSERT_TRUE(consistent);
+        ASSERT_EQ(tree.size(), n);
+        tree.read([&](const auto& version) {
+            for (int i = 0; i < n; ++i) {
+                ASSERT_EQ(version.find(i)->value, i % 3 == 0 ? -i : i);
+            }
+        });
+    }
+    ASSERT_EQ(allocator_t::live, 0);
+}
+
+TEST(ConcurrentSkiplistTest, StressTest) {
+    concurrent_skiplist<int, int> list;
+    std::map<int, int> map;
+    std::mutex map_mutex;
+    std::atomic<bool> consistent = true;
+    const int threads = 8, key_range = 4000;
+
+    // Every thread owns the keys congruent to its index, so the reference map predicts its results.
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937 gen(t);
+            for (int i = 0; i < 20000; ++i) {
+                int key = int(gen() % (key_range / threads)) * threads + t;
+                int type = int(gen() % 4);
+                std::unique_lock lock(map_mutex);
+                bool present = map.count(key);
+                if (type == 0) {
+                    if (present) map.erase(key);
+                    lock.unlock();
+                    if (list.erase(key) != present) consistent = false;
+                } else if (type == 1) {
+                    if (!present) map[key] = i;
+                    lock.unlock();
+                    if (list.insert(key, i) == present) consistent = false;
+                } else if (type == 2) {
+                    auto expected = present ? std::optional<int>(map[key]) : std::nullopt;
+                    lock.unlock();
+                    if (list.find(key) != expected) consistent = false;
+                } else {
+                    lock.unlock();
+                    auto next = list.next(key);
+                    auto prev = list.prev(key);
+                    if ((next && next->first <= key) || (prev && prev->first >= key)) consistent = false;
+                }
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+
+    ASSERT_TRUE(consistent);
+    ASSERT_EQ(list.size(), map.size());
+    auto traversal = list.get_traversal();
+    std::vector<std::pair<int, int>> expected(map.begin(), map.end());
+    ASSERT_EQ(traversal, expected);
+    if (!map.empty()) {
+        ASSERT_EQ(list.get_min()->first, map.begin()->first);
+        ASSERT_EQ(list.next(map.begin()->first)->first, std::next(map.begin())->first);
+        ASSERT_EQ(list.prev(map.rbegin()->first + 1)->first, map.rbegin()->first);
+    }
+}
+
+TYPED_TEST(ShardedTreeTest, ConcurrentTest) {
+    sharded_tree<TypeParam, 8> tree;
+    const int threads = 4, keys_per_thread = 20000;
+
+    // Thread t inserts the keys congruent to t and erases every third of them.
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            for (int i = 0; i < keys_per_thread; ++i) {
+                int key = i * threads + t;
+                tree.insert(key, -key);
+                if (i % 3 == 0) tree.erase(key);
+            }
+        });
+    }
+    for (auto& worker : workers) worker.join();
+
+    std::vector<int> keys;
+    for (int key = 0; key < threads * keys_per_thread; ++key) {
+        if (key / threads % 3 != 0) keys.push_back(key);
+    }
+    ASSERT_EQ(tree.size(), keys.size());
+
+    tree.rebalance();
+    ASSERT_EQ(tree.size(), keys.size());
+    for (size_t i = 0; i < keys.size(); i += 97) {
+        ASSERT_EQ(tree.order_of_key(keys[i]), i);
+        int value = 0;
+        ASSERT_TRUE(tree.visit_kth(i, [&](const auto& node) { value = node.value; }));
+        ASSERT_EQ(value, -keys[i]);
+        ASSERT_TRUE(tree.exists(keys[i]));
+        ASSERT_FALSE(tree.exists(keys[i] / threads / 3 * 3 * threads));
+    }
+    ASSERT_FALSE(tree.visit_kth(keys.size(), [](const auto&) {}));
+    ASSERT_EQ(tree.order_of_key(INT_MAX), keys.size());
+}
+
+TEST(ShardedDuplicateTest, RebalanceTest) {
+    sharded_tree<treap<treap_node<int, int>>, 4> tree;
+    const int keys = 101, copies = 30;
+    for (int key = 0; key < keys; ++key) {
+        for (int i = 0; i < copies; ++i) tree.insert(key, i);
+    }
+
+    // Runs of 30 equal keys do not end at the equal-share cuts.
+    tree.rebalance();
+    ASSERT_EQ(tree.size(), size_t(keys * copies));
+    for (int key = 0; key < keys; ++key) {
+        // The rank of some copy of the key, as order_of_key of the treap.
+        size_t rank = tree.order_of_key(key);
+        ASSERT_GE(rank, size_t(key * copies));
+        ASSERT_LT(rank, size_t((key + 1) * copies));
+        ASSERT_TRUE(tree.exists(key));
+    }
+    for (int key = 0; key < keys; ++key) {
+        for (int i = 0; i < copies; ++i) tree.erase(key);
+        ASSERT_FALSE(tree.exists(key));
+    }
+    ASSERT_EQ(tree.size(), 0u);
+}